@@ -0,0 +1,7 @@
+// Stand-in for the SDK header of the same name, see AE_Effect.h
+#pragma once
+#if defined(_WIN32)
+#define AE_OS_WIN
+#else
+#define AE_OS_MAC
+#endif
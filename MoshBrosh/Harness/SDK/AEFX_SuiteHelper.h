@@ -0,0 +1,39 @@
+// Stand-in for the SDK header of the same name, see AE_Effect.h
+#pragma once
+#include "AE_Effect.h"
+#include "SPTypes.h"
+#include <stdexcept>
+
+template<typename SUITE_TYPE, bool ALLOW_NO_SUITE = false>
+class AEFX_SuiteScoper {
+public:
+    AEFX_SuiteScoper(const PF_InData* in_data, const char* suite_name, int32_t suite_version,
+                     PF_OutData* out_dataP = 0, const char* err_stringPC = "Not able to acquire AEFX Suite.")
+        : i_pica_basicP(in_data->pica_basicP), i_suite_name(suite_name),
+          i_suite_version(suite_version), i_suiteP(nullptr)
+    {
+        (void)out_dataP;
+        const void* suiteP = nullptr;
+        if (i_pica_basicP && i_pica_basicP->AcquireSuite(suite_name, suite_version, &suiteP) == kSPNoError) {
+            i_suiteP = (SUITE_TYPE*)suiteP;
+        }
+        if (!i_suiteP && !ALLOW_NO_SUITE) {
+            throw std::runtime_error(err_stringPC);
+        }
+    }
+
+    ~AEFX_SuiteScoper() {
+        if (i_suiteP) {
+            i_pica_basicP->ReleaseSuite(i_suite_name, i_suite_version);
+        }
+    }
+
+    const SUITE_TYPE* operator->() const { return i_suiteP; }
+    SUITE_TYPE* get() const { return i_suiteP; }
+
+private:
+    const SPBasicSuite* i_pica_basicP;
+    const char* i_suite_name;
+    int32_t i_suite_version;
+    SUITE_TYPE* i_suiteP;
+};
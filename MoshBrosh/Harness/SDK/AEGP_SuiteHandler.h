@@ -0,0 +1,3 @@
+// Stand-in for the SDK header of the same name, see AE_Effect.h
+#pragma once
+#include "SPTypes.h"
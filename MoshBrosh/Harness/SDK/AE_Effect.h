@@ -0,0 +1,541 @@
+// Minimal stand-in for the subset of the After Effects / Premiere Pro plug-in
+// SDK that MoshBrosh uses. Names and layouts follow the real SDK headers;
+// only the members the plugin touches are declared.
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+
+typedef unsigned char   A_u_char;
+typedef char            A_char;
+typedef int16_t         A_short;
+typedef uint16_t        A_u_short;
+typedef int32_t         A_long;
+typedef uint32_t        A_u_long;
+typedef int64_t         A_intptr_t;
+typedef unsigned char   A_Boolean;
+typedef float           PF_FpShort;
+typedef double          PF_FpLong;
+typedef A_long          PF_Err;
+typedef A_long          PF_ParamIndex;
+typedef A_long          PF_ParamValue;
+typedef A_Boolean       PF_Boolean;
+typedef A_u_short       PF_ChannelMask;
+typedef void*           PF_ProgPtr;
+typedef char**          PF_Handle;
+typedef const char**    PF_ConstHandle;
+typedef A_long          PF_Field;
+typedef A_long          PF_Quality;
+typedef A_long          PF_PixelFormat;
+typedef void*           PF_PixelPtr;
+typedef A_long          PF_ParamType;
+typedef A_long          PF_ParamFlags;
+typedef A_long          PF_ValueDisplayFlags;
+
+typedef struct { A_long left, top, right, bottom; } PF_LRect;
+typedef PF_LRect PF_Rect;
+typedef PF_LRect PF_UnionableRect;
+typedef struct { A_long num; A_u_long den; } PF_RationalScale;
+typedef struct { A_u_char alpha, red, green, blue; } PF_Pixel;
+typedef PF_Pixel PF_Pixel8;
+typedef struct { A_u_short alpha, red, green, blue; } PF_Pixel16;
+typedef struct { PF_FpShort alpha, red, green, blue; } PF_PixelFloat, PF_Pixel32;
+
+#ifndef FALSE
+#define FALSE 0
+#define TRUE 1
+#endif
+#define PF_MAX_CHAN8    255
+#define PF_MAX_CHAN16   32768
+
+enum {
+    PF_Err_NONE = 0,
+    PF_Err_OUT_OF_MEMORY = 4,
+    PF_Err_INTERNAL_STRUCT_DAMAGED = -1045,
+    PF_Err_INVALID_INDEX,
+    PF_Err_UNRECOGNIZED_PARAM_TYPE,
+    PF_Err_INVALID_CALLBACK,
+    PF_Err_BAD_CALLBACK_PARAM,
+    PF_Interrupt_CANCEL,
+    PF_Err_CANNOT_PARSE_KEYFRAME_TEXT
+};
+
+enum {
+    PF_Cmd_ABOUT = 0,
+    PF_Cmd_GLOBAL_SETUP,
+    PF_Cmd_UNUSED_0,
+    PF_Cmd_GLOBAL_SETDOWN,
+    PF_Cmd_PARAMS_SETUP,
+    PF_Cmd_SEQUENCE_SETUP,
+    PF_Cmd_SEQUENCE_RESETUP,
+    PF_Cmd_SEQUENCE_FLATTEN,
+    PF_Cmd_SEQUENCE_SETDOWN,
+    PF_Cmd_DO_DIALOG,
+    PF_Cmd_FRAME_SETUP,
+    PF_Cmd_RENDER,
+    PF_Cmd_FRAME_SETDOWN,
+    PF_Cmd_USER_CHANGED_PARAM,
+    PF_Cmd_UPDATE_PARAMS_UI,
+    PF_Cmd_EVENT,
+    PF_Cmd_GET_EXTERNAL_DEPENDENCIES,
+    PF_Cmd_COMPLETELY_GENERAL,
+    PF_Cmd_QUERY_DYNAMIC_FLAGS,
+    PF_Cmd_AUDIO_RENDER,
+    PF_Cmd_AUDIO_SETUP,
+    PF_Cmd_AUDIO_SETDOWN,
+    PF_Cmd_ARBITRARY_CALLBACK,
+    PF_Cmd_SMART_PRE_RENDER,
+    PF_Cmd_SMART_RENDER,
+    PF_Cmd_RESERVED1,
+    PF_Cmd_RESERVED2,
+    PF_Cmd_RESERVED3,
+    PF_Cmd_GET_FLATTENED_SEQUENCE_DATA,
+    PF_Cmd_TRANSLATE_PARAMS_TO_PREFS,
+    PF_Cmd_RESERVED4,
+    PF_Cmd_SMART_RENDER_GPU,
+    PF_Cmd_GPU_DEVICE_SETUP,
+    PF_Cmd_GPU_DEVICE_SETDOWN,
+    PF_Cmd_NUM_CMDS
+};
+typedef A_long PF_Cmd;
+
+enum {
+    PF_OutFlag_NONE                             = 0L,
+    PF_OutFlag_KEEP_RESOURCE_OPEN               = 1L << 0,
+    PF_OutFlag_WIDE_TIME_INPUT                  = 1L << 1,
+    PF_OutFlag_NON_PARAM_VARY                   = 1L << 2,
+    PF_OutFlag_RESERVED6                        = 1L << 3,
+    PF_OutFlag_SEQUENCE_DATA_NEEDS_FLATTENING   = 1L << 4,
+    PF_OutFlag_I_DO_DIALOG                      = 1L << 5,
+    PF_OutFlag_USE_OUTPUT_EXTENT                = 1L << 6,
+    PF_OutFlag_SEND_DO_DIALOG                   = 1L << 7,
+    PF_OutFlag_DISPLAY_ERROR_MESSAGE            = 1L << 8,
+    PF_OutFlag_I_EXPAND_BUFFER                  = 1L << 9,
+    PF_OutFlag_PIX_INDEPENDENT                  = 1L << 10,
+    PF_OutFlag_I_WRITE_INPUT_BUFFER             = 1L << 11,
+    PF_OutFlag_I_SHRINK_BUFFER                  = 1L << 12,
+    PF_OutFlag_WORKS_IN_PLACE                   = 1L << 13,
+    PF_OutFlag_RESERVED8                        = 1L << 14,
+    PF_OutFlag_CUSTOM_UI                        = 1L << 15,
+    PF_OutFlag_RESERVED7                        = 1L << 16,
+    PF_OutFlag_REFRESH_UI                       = 1L << 17,
+    PF_OutFlag_NOP_RENDER                       = 1L << 18,
+    PF_OutFlag_I_USE_SHUTTER_ANGLE              = 1L << 19,
+    PF_OutFlag_I_USE_AUDIO                      = 1L << 20,
+    PF_OutFlag_I_AM_OBSOLETE                    = 1L << 21,
+    PF_OutFlag_FORCE_RERENDER                   = 1L << 22,
+    PF_OutFlag_PiPL_OVERRIDES_OUTDATA_OUTFLAGS  = 1L << 23,
+    PF_OutFlag_I_HAVE_EXTERNAL_DEPENDENCIES     = 1L << 24,
+    PF_OutFlag_DEEP_COLOR_AWARE                 = 1L << 25,
+    PF_OutFlag_SEND_UPDATE_PARAMS_UI            = 1L << 26
+};
+
+enum {
+    PF_OutFlag2_NONE                                = 0L,
+    PF_OutFlag2_SUPPORTS_QUERY_DYNAMIC_FLAGS        = 1L << 0,
+    PF_OutFlag2_I_USE_3D_CAMERA                     = 1L << 1,
+    PF_OutFlag2_I_USE_3D_LIGHTS                     = 1L << 2,
+    PF_OutFlag2_PARAM_GROUP_START_COLLAPSED_FLAG    = 1L << 3,
+    PF_OutFlag2_I_AM_THREADSAFE                     = 1L << 4,
+    PF_OutFlag2_CAN_COMBINE_WITH_DESTINATION        = 1L << 5,
+    PF_OutFlag2_DOESNT_NEED_EMPTY_PIXELS            = 1L << 6,
+    PF_OutFlag2_REVEALS_ZERO_ALPHA                  = 1L << 7,
+    PF_OutFlag2_PRESERVES_FULLY_OPAQUE_PIXELS       = 1L << 8,
+    PF_OutFlag2_SUPPORTS_SMART_RENDER               = 1L << 10,
+    PF_OutFlag2_RESERVED9                           = 1L << 11,
+    PF_OutFlag2_FLOAT_COLOR_AWARE                   = 1L << 12,
+    PF_OutFlag2_I_USE_COLORSPACE_ENUMERATION        = 1L << 13,
+    PF_OutFlag2_I_AM_DEPRECATED                     = 1L << 14,
+    PF_OutFlag2_PPRO_DO_NOT_CLONE_SEQUENCE_DATA_FOR_RENDER = 1L << 15,
+    PF_OutFlag2_RESERVED10                          = 1L << 16,
+    PF_OutFlag2_AUTOMATIC_WIDE_TIME_INPUT           = 1L << 17,
+    PF_OutFlag2_I_USE_TIMECODE                      = 1L << 18,
+    PF_OutFlag2_DEPENDS_ON_UNREFERENCED_MASKS       = 1L << 19,
+    PF_OutFlag2_OUTPUT_IS_WATERMARKED               = 1L << 20,
+    PF_OutFlag2_I_MIX_GUID_DEPENDENCIES             = 1L << 21,
+    PF_OutFlag2_AE13_5_THREADSAFE                   = 1L << 22,
+    PF_OutFlag2_SUPPORTS_GET_FLATTENED_SEQUENCE_DATA = 1L << 23,
+    PF_OutFlag2_CUSTOM_UI_ASYNC_MANAGER             = 1L << 24,
+    PF_OutFlag2_SUPPORTS_GPU_RENDER_F32             = 1L << 25,
+    PF_OutFlag2_RESERVED12                          = 1L << 26,
+    PF_OutFlag2_SUPPORTS_THREADED_RENDERING         = 1L << 27,
+    PF_OutFlag2_MUTABLE_RENDER_SEQUENCE_DATA_SLOWER = 1L << 28
+};
+
+enum {
+    PF_Quality_DRAWING_AUDIO = -1,
+    PF_Quality_LO = 0,
+    PF_Quality_HI
+};
+
+enum {
+    PF_Field_FRAME = 0L,
+    PF_Field_UPPER = 1L,
+    PF_Field_LOWER = 2L
+};
+
+enum {
+    PF_PixelFormat_ARGB32  = 'argb',
+    PF_PixelFormat_ARGB64  = 'ar16',
+    PF_PixelFormat_ARGB128 = 'ar32',
+    PF_PixelFormat_GPU_BGRA128 = '@C4f',
+    PF_PixelFormat_RESERVED = 'ar12',
+    PF_PixelFormat_BGRA32  = 'bgra',
+    PF_PixelFormat_VUYA32  = 'vuya',
+    PF_PixelFormat_NTSCDV25 = 'dv25',
+    PF_PixelFormat_PALDV25 = 'dvp5',
+    PF_PixelFormat_INVALID = 'badf',
+    PF_PixelFormat_FORCE_LONG_INT = 0x7FFFFFFF
+};
+
+#define PF_Stage_DEVELOP    0
+#define PF_Stage_ALPHA      1
+#define PF_Stage_BETA       2
+#define PF_Stage_RELEASE    3
+
+#define PF_VERS_BUG_BITS    4L
+#define PF_VERS_STAGE_BITS  2L
+#define PF_VERS_MINOR_BITS  4L
+#define PF_VERS_MAJOR_BITS  3L
+#define PF_VERS_BUILD_BITS  9L
+#define PF_VERSION(VERS, SUBVERS, BUGVERS, STAGE, BUILD) \
+    ((((VERS) & 0x7f) << 19) | (((SUBVERS) & 0xf) << 15) | \
+     (((BUGVERS) & 0xf) << 11) | (((STAGE) & 0x3) << 9) | ((BUILD) & 0x1ff))
+
+#define PF_PLUG_IN_VERSION  13
+#define PF_PLUG_IN_SUBVERS  28
+
+enum {
+    PF_Param_RESERVED = -1,
+    PF_Param_LAYER = 0,
+    PF_Param_SLIDER,
+    PF_Param_FIX_SLIDER,
+    PF_Param_ANGLE,
+    PF_Param_CHECKBOX,
+    PF_Param_COLOR,
+    PF_Param_POINT,
+    PF_Param_POPUP,
+    PF_Param_CUSTOM,
+    PF_Param_NO_DATA,
+    PF_Param_FLOAT_SLIDER
+};
+
+enum {
+    PF_ValueDisplayFlag_NONE = 0,
+    PF_ValueDisplayFlag_PERCENT = 1 << 0,
+    PF_ValueDisplayFlag_PIXEL = 1 << 1,
+    PF_ValueDisplayFlag_RESERVED1 = 1 << 2,
+    PF_ValueDisplayFlag_REVERSE = 1 << 3
+};
+
+#define PF_MAX_EFFECT_PARAM_NAME_LEN    31
+#define PF_MAX_EFFECT_MSG_LEN           255
+
+typedef struct PF_LayerDef {
+    void*       reserved0;
+    void*       reserved1;
+    A_long      world_flags;
+    PF_PixelPtr data;
+    A_long      rowbytes;
+    A_long      width;
+    A_long      height;
+    PF_UnionableRect extent_hint;
+    void*       platform_ref;
+    A_long      reserved_long1;
+    void*       reserved_long4;
+    PF_RationalScale pix_aspect_ratio;
+    void*       reserved_long2;
+    A_long      origin_x;
+    A_long      origin_y;
+    A_long      reserved_long3;
+    A_long      dephault;
+} PF_LayerDef, PF_EffectWorld;
+
+typedef struct {
+    PF_ParamValue   value;
+    A_char          value_str[32];
+    A_char          value_desc[32];
+    PF_ParamValue   valid_min, valid_max;
+    PF_ParamValue   slider_min, slider_max;
+    PF_ParamValue   dephault;
+} PF_SliderDef;
+
+typedef struct {
+    PF_FpLong       value;
+    PF_FpLong       phase;
+    A_char          value_desc[32];
+    PF_FpShort      valid_min, valid_max;
+    PF_FpShort      slider_min, slider_max;
+    PF_FpShort      dephault;
+    A_short         precision;
+    A_short         display_flags;
+    A_long          fs_flags;
+    PF_FpShort      curve_tolerance;
+    A_Boolean       useExponent;
+    PF_FpShort      exponent;
+} PF_FloatSliderDef;
+
+typedef struct {
+    PF_ParamValue   value;
+    A_short         num_choices;
+    A_short         dephault;
+    union {
+        A_long      id;
+        const A_char* namesptr;
+    } u;
+} PF_PopupDef;
+
+typedef struct {
+    PF_ParamValue value;
+    PF_Boolean dephault;
+    char reserved1;
+    short reserved2;
+    union {
+        const char* nameptr;
+    } u;
+} PF_CheckBoxDef;
+
+typedef union {
+    PF_LayerDef         ld;
+    PF_SliderDef        sd;
+    PF_FloatSliderDef   fs_d;
+    PF_PopupDef         pd;
+    PF_CheckBoxDef      bd;
+} PF_ParamDefUnion;
+
+typedef struct PF_ParamDef {
+    union {
+        A_long  id;
+        A_long  change_flags;
+    } uu;
+    PF_ParamFlags   ui_flags;
+    A_short         ui_width;
+    A_short         ui_height;
+    PF_ParamType    param_type;
+    A_char          name[PF_MAX_EFFECT_PARAM_NAME_LEN + 1];
+    PF_ParamFlags   flags;
+    A_long          unused;
+    PF_ParamDefUnion u;
+} PF_ParamDef, *PF_ParamDefPtr, **PF_ParamDefH;
+typedef PF_ParamDef** PF_ParamList;
+
+#define PF_DEF_NAME name
+
+typedef struct {
+    PF_Err (*checkout_param)(PF_ProgPtr effect_ref, PF_ParamIndex index,
+        A_long what_time, A_long time_step, A_u_long time_scale, PF_ParamDef* param);
+    PF_Err (*checkin_param)(PF_ProgPtr effect_ref, PF_ParamDef* param);
+    PF_Err (*add_param)(PF_ProgPtr effect_ref, PF_ParamIndex index, PF_ParamDefPtr def);
+    PF_Err (*abort)(PF_ProgPtr effect_ref);
+    PF_Err (*progress)(PF_ProgPtr effect_ref, A_long current, A_long total);
+    PF_Err (*register_ui)(PF_ProgPtr effect_ref, void* cust_info);
+    PF_Err (*checkout_layer_audio)(void*);
+    PF_Err (*checkin_layer_audio)(void*);
+    PF_Err (*get_audio_data)(void*);
+    void*  reserved_str[3];
+    void*  reserved[10];
+} PF_InteractCallbacks;
+
+typedef PF_Err (*PF_IteratePixel8Func)(void* refconP, A_long x, A_long y, PF_Pixel* in, PF_Pixel* out);
+
+typedef struct _PF_UtilCallbacks {
+    void*       begin_sampling;
+    void*       subpixel_sample;
+    void*       area_sample;
+    void*       get_batch_func_is_deprecated;
+    void*       end_sampling;
+    void*       composite_rect;
+    void*       blend;
+    void*       convolve;
+    void*       copy;
+    void*       fill;
+    void*       gaussian_kernel;
+    PF_Err (*iterate)(void*);
+    void*       premultiply;
+    void*       premultiply_color;
+    PF_Err (*new_world)(PF_ProgPtr effect_ref, A_long width, A_long height,
+        A_long flags, PF_EffectWorld* world);
+    PF_Err (*dispose_world)(PF_ProgPtr effect_ref, PF_EffectWorld* world);
+    void*       iterate_origin;
+    void*       iterate_lut;
+    void*       transfer_rect;
+    void*       transform_world;
+    PF_Handle (*host_new_handle)(A_u_long size);
+    void* (*host_lock_handle)(PF_Handle pf_handle);
+    void (*host_unlock_handle)(PF_Handle pf_handle);
+    void (*host_dispose_handle)(PF_Handle pf_handle);
+    PF_Err (*get_callback_addr)(void*);
+    PF_Err (*app)(void*);
+    void*       ansi;
+    void*       colorCB;
+    PF_Err (*get_platform_data)(void*);
+    A_u_long (*host_get_handle_size)(PF_Handle pf_handle);
+    PF_Err (*iterate_origin_non_clip_src)(void*);
+    PF_Err (*iterate_generic)(A_long iterationsL, void* refconPV,
+        PF_Err (*fn_func)(void* refconPV, A_long thread_indexL, A_long i, A_long iterationsL));
+    PF_Err (*host_resize_handle)(A_u_long new_sizeL, PF_Handle* handlePH);
+    void*       subpixel_sample16;
+    void*       area_sample16;
+    void*       fill16;
+    void*       premultiply_color16;
+    void*       iterate16;
+    void*       iterate_origin16;
+    void*       iterate_origin_non_clip_src16;
+    PF_Err (*get_pixel_data8)(void*);
+    PF_Err (*get_pixel_data16)(void*);
+    void*       reserved[1];
+} PF_UtilCallbacks;
+
+struct SPBasicSuite;
+
+typedef struct PF_InData {
+    PF_InteractCallbacks inter;
+    struct _PF_UtilCallbacks* utils;
+    PF_ProgPtr      effect_ref;
+    PF_Quality      quality;
+    A_long          version_major_minor;
+    A_long          serial_num;
+    A_long          appl_id;
+    A_long          num_params;
+    A_long          reserved;
+    A_long          what_cpu;
+    A_long          what_fpu;
+    A_long          current_time;
+    A_long          time_step;
+    A_long          total_time;
+    A_long          local_time_step;
+    A_u_long        time_scale;
+    PF_Field        field;
+    PF_FpLong       shutter_angle;
+    A_long          width;
+    A_long          height;
+    PF_Rect         extent_hint;
+    A_long          output_origin_x;
+    A_long          output_origin_y;
+    PF_RationalScale downsample_x;
+    PF_RationalScale downsample_y;
+    PF_RationalScale pixel_aspect_ratio;
+    A_long          in_flags;
+    PF_Handle       global_data;
+    PF_Handle       sequence_data;
+    PF_Handle       frame_data;
+    A_long          start_sampL;
+    A_long          dur_sampL;
+    A_long          total_sampL;
+    void*           src_snd;
+    struct SPBasicSuite* pica_basicP;
+    A_long          pre_effect_source_origin_x;
+    A_long          pre_effect_source_origin_y;
+    PF_FpLong       shutter_phase;
+} PF_InData;
+
+typedef struct PF_OutData {
+    A_u_long        my_version;
+    A_char          name[32];
+    PF_Handle       global_data;
+    A_long          num_params;
+    PF_Handle       sequence_data;
+    A_long          flat_sdata_size;
+    PF_Handle       frame_data;
+    A_long          width;
+    A_long          height;
+    A_long          origin_x;
+    A_long          origin_y;
+    A_long          out_flags;
+    A_char          return_msg[PF_MAX_EFFECT_MSG_LEN + 1];
+    A_long          start_sampL;
+    A_long          dur_sampL;
+    A_long          dest_snd[4];
+    A_long          out_flags2;
+} PF_OutData;
+
+// SmartFX
+typedef struct {
+    PF_LRect        rect;
+    PF_Field        field;
+    PF_ChannelMask  channel_mask;
+    A_Boolean       preserve_rgb_of_zero_alpha;
+    A_u_char        unused[3];
+    A_long          reserved[4];
+} PF_RenderRequest;
+
+enum {
+    PF_ChannelMask_ALPHA = 0x1,
+    PF_ChannelMask_RED   = 0x2,
+    PF_ChannelMask_GREEN = 0x4,
+    PF_ChannelMask_BLUE  = 0x8,
+    PF_ChannelMask_ARGB  = 0xF
+};
+
+typedef struct {
+    PF_LRect        result_rect;
+    PF_LRect        max_result_rect;
+    PF_RationalScale par;
+    A_long          solid;
+    A_Boolean       reservedB[3];
+    A_long          ref_width;
+    A_long          ref_height;
+    A_long          reserved[6];
+} PF_CheckoutResult;
+
+typedef void (*PF_DeletePreRenderDataFunc)(void* pre_render_data);
+
+enum {
+    PF_RenderOutputFlag_RETURNS_EXTRA_PIXELS = 0x1,
+    PF_RenderOutputFlag_GPU_RENDER_POSSIBLE = 0x2,
+    PF_RenderOutputFlag_RESERVED1 = 0x4
+};
+
+typedef struct {
+    PF_LRect        result_rect;
+    PF_LRect        max_result_rect;
+    A_Boolean       solid;
+    A_Boolean       reserved;
+    A_short         flags;
+    void*           pre_render_data;
+    PF_DeletePreRenderDataFunc delete_pre_render_data_func;
+} PF_PreRenderOutput;
+
+typedef struct {
+    PF_RenderRequest output_request;
+    A_short         bitdepth;
+    const void*     gpu_data;
+    A_long          what_gpu;
+    A_u_long        device_index;
+} PF_PreRenderInput;
+
+typedef struct {
+    PF_Err (*checkout_layer)(PF_ProgPtr effect_ref, PF_ParamIndex index, A_long checkout_idL,
+        const PF_RenderRequest* req, A_long what_time, A_long time_step, A_u_long time_scale,
+        PF_CheckoutResult* checkout_result);
+    PF_Err (*GuidMixInPtr)(PF_ProgPtr effect_ref, A_u_long buf_sizeLu, const void* buf);
+} PF_PreRenderCallbacks;
+
+typedef struct {
+    PF_PreRenderInput*      input;
+    PF_PreRenderOutput*     output;
+    PF_PreRenderCallbacks*  cb;
+} PF_PreRenderExtra;
+
+typedef struct {
+    PF_RenderRequest output_request;
+    A_short         bitdepth;
+    void*           pre_render_data;
+    const void*     gpu_data;
+    A_long          what_gpu;
+    A_u_long        device_index;
+} PF_SmartRenderInput;
+
+typedef struct {
+    PF_Err (*checkout_layer_pixels)(PF_ProgPtr effect_ref, A_long checkout_idL, PF_EffectWorld** pixels);
+    PF_Err (*checkin_layer_pixels)(PF_ProgPtr effect_ref, A_long checkout_idL);
+    PF_Err (*checkout_output)(PF_ProgPtr effect_ref, PF_EffectWorld** output);
+} PF_SmartRenderCallbacks;
+
+typedef struct {
+    PF_SmartRenderInput*     input;
+    PF_SmartRenderCallbacks* cb;
+} PF_SmartRenderExtra;
+
+#define PF_WORLD_IS_DEEP(W)     (((W)->world_flags & 1L) != 0)
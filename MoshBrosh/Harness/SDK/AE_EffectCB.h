@@ -0,0 +1,24 @@
+// Stand-in for the SDK header of the same name, see AE_Effect.h
+#pragma once
+#include "AE_Effect.h"
+#include <cstring>
+
+#define PF_ADD_PARAM(IN_DATA, INDEX, DEF) \
+    (*(IN_DATA)->inter.add_param)((IN_DATA)->effect_ref, (INDEX), (DEF))
+#define PF_ABORT(IN_DATA) \
+    (*(IN_DATA)->inter.abort)((IN_DATA)->effect_ref)
+#define PF_PROGRESS(IN_DATA, CURR, TOTAL) \
+    (*(IN_DATA)->inter.progress)((IN_DATA)->effect_ref, (CURR), (TOTAL))
+#define PF_CHECKOUT_PARAM(IN_DATA, INDEX, TIME, STEP, SCALE, PARAM) \
+    (*(IN_DATA)->inter.checkout_param)((IN_DATA)->effect_ref, (INDEX), (TIME), (STEP), (SCALE), (PARAM))
+#define PF_CHECKIN_PARAM(IN_DATA, PARAM) \
+    (*(IN_DATA)->inter.checkin_param)((IN_DATA)->effect_ref, (PARAM))
+
+#define PF_NEW_HANDLE(SIZE)         (*in_data->utils->host_new_handle)(SIZE)
+#define PF_LOCK_HANDLE(PF_HANDLE)   (*in_data->utils->host_lock_handle)(PF_HANDLE)
+#define PF_UNLOCK_HANDLE(PF_HANDLE) (*in_data->utils->host_unlock_handle)(PF_HANDLE)
+#define PF_DISPOSE_HANDLE(PF_HANDLE) (*in_data->utils->host_dispose_handle)(PF_HANDLE)
+#define PF_GET_HANDLE_SIZE(PF_HANDLE) (*in_data->utils->host_get_handle_size)(PF_HANDLE)
+#define PF_RESIZE_HANDLE(NEW_SIZE, HANDLE_P) (*in_data->utils->host_resize_handle)((NEW_SIZE), (HANDLE_P))
+
+#define PF_STRCPY(DST, SRC) strcpy((DST), (SRC))
@@ -0,0 +1,20 @@
+// Stand-in for the SDK header of the same name, see AE_Effect.h
+#pragma once
+#include "AE_Effect.h"
+
+#define kPFWorldSuite               "PF World Suite"
+#define kPFWorldSuiteVersion2       2
+
+typedef struct PF_WorldSuite2 {
+    PF_Err (*PF_NewWorld)(PF_ProgPtr effect_ref, A_long widthL, A_long heightL,
+        PF_Boolean clear_pixB, PF_PixelFormat pixel_format, PF_EffectWorld* worldP);
+    PF_Err (*PF_DisposeWorld)(PF_ProgPtr effect_ref, PF_EffectWorld* worldP);
+    PF_Err (*PF_GetPixelFormat)(const PF_EffectWorld* worldP, PF_PixelFormat* pixel_formatP);
+} PF_WorldSuite2;
+
+#define kPFEffectSequenceDataSuite          "PF Effect Sequence Data Suite"
+#define kPFEffectSequenceDataSuiteVersion1  1
+
+typedef struct PF_EffectSequenceDataSuite1 {
+    PF_Err (*PF_GetConstSequenceData)(PF_ProgPtr effect_ref, PF_ConstHandle* sequence_data);
+} PF_EffectSequenceDataSuite1;
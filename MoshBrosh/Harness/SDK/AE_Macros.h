@@ -0,0 +1,10 @@
+// Stand-in for the SDK header of the same name, see AE_Effect.h
+#pragma once
+#include <cstring>
+#define AEFX_CLR_STRUCT(STRUCT) memset(&(STRUCT), 0, sizeof(STRUCT))
+#ifndef ERR
+#define ERR(FUNC)   do { if (!err) { err = (FUNC); } } while (0)
+#endif
+#ifndef ERR2
+#define ERR2(FUNC)  do { if (((err2 = (FUNC)) != PF_Err_NONE) && !err) err = err2; } while (0)
+#endif
@@ -0,0 +1,44 @@
+// Stand-in for the SDK header of the same name, see AE_Effect.h
+#pragma once
+#include "AE_EffectCB.h"
+#include "AE_Macros.h"
+
+#define PF_ADD_SLIDER(NAME, VALID_MIN, VALID_MAX, SLIDER_MIN, SLIDER_MAX, DFLT, ID) \
+    do { \
+        AEFX_CLR_STRUCT(def); \
+        def.param_type = PF_Param_SLIDER; \
+        PF_STRCPY(def.PF_DEF_NAME, NAME); \
+        def.u.sd.valid_min = (VALID_MIN); \
+        def.u.sd.slider_min = (SLIDER_MIN); \
+        def.u.sd.valid_max = (VALID_MAX); \
+        def.u.sd.slider_max = (SLIDER_MAX); \
+        def.u.sd.value = def.u.sd.dephault = (DFLT); \
+        def.uu.id = (ID); \
+        if ((err = PF_ADD_PARAM(in_data, -1, &def)) != PF_Err_NONE) return err; \
+    } while (0)
+
+#define PF_ADD_POPUP(NAME, CHOICES, DFLT, STRING, ID) \
+    do { \
+        AEFX_CLR_STRUCT(def); \
+        def.param_type = PF_Param_POPUP; \
+        PF_STRCPY(def.PF_DEF_NAME, NAME); \
+        def.u.pd.num_choices = (CHOICES); \
+        def.u.pd.dephault = (DFLT); \
+        def.u.pd.value = def.u.pd.dephault; \
+        def.u.pd.u.namesptr = (STRING); \
+        def.uu.id = (ID); \
+        if ((err = PF_ADD_PARAM(in_data, -1, &def)) != PF_Err_NONE) return err; \
+    } while (0)
+
+#define PF_ADD_CHECKBOX(NAME_A, NAME_B, DFLT, FLAGS, ID) \
+    do { \
+        AEFX_CLR_STRUCT(def); \
+        def.param_type = PF_Param_CHECKBOX; \
+        PF_STRCPY(def.PF_DEF_NAME, NAME_A); \
+        def.u.bd.u.nameptr = (NAME_B); \
+        def.u.bd.value = (DFLT); \
+        def.u.bd.dephault = (PF_Boolean)(def.u.bd.value); \
+        def.flags |= (FLAGS); \
+        def.uu.id = (ID); \
+        if ((err = PF_ADD_PARAM(in_data, -1, &def)) != PF_Err_NONE) return err; \
+    } while (0)
@@ -0,0 +1,22 @@
+// Stand-in for the SDK header of the same name, see AE_Effect.h
+#pragma once
+#include "AE_Effect.h"
+#include "PrSDKTypes.h"
+
+#define kPFPixelFormatSuite         "PF Pixel Format Suite"
+#define kPFPixelFormatSuiteVersion1 1
+
+typedef A_long PF_NewWorldFlags;
+
+typedef struct {
+    PF_Err (*AddSupportedPixelFormat)(PF_ProgPtr effect_ref, PrPixelFormat pixelFormat);
+    PF_Err (*ClearSupportedPixelFormats)(PF_ProgPtr effect_ref);
+    PF_Err (*NewWorldOfPixelFormat)(PF_ProgPtr effect_ref, A_u_long width, A_u_long height,
+        PF_NewWorldFlags flags, PrPixelFormat pixelFormat, PF_EffectWorld* world);
+    PF_Err (*DisposeWorld)(PF_ProgPtr effect_ref, PF_EffectWorld* world);
+    PF_Err (*GetPixelFormat)(PF_EffectWorld* inWorld, PrPixelFormat* pixelFormat);
+    PF_Err (*GetBlackForPixelFormat)(const PrPixelFormat pixelFormat, void* pixelData);
+    PF_Err (*GetWhiteForPixelFormat)(const PrPixelFormat pixelFormat, void* pixelData);
+    PF_Err (*ConvertColorToPixelFormattedData)(const PrPixelFormat pixelFormat,
+        const float alpha, const float red, const float green, const float blue, void* pixelData);
+} PF_PixelFormatSuite1;
@@ -0,0 +1,21 @@
+// Stand-in for the SDK header of the same name, see AE_Effect.h
+#pragma once
+#include <cstdint>
+
+#define MAKE_PIXEL_FORMAT_FOURCC(ch0, ch1, ch2, ch3) \
+    ((uint32_t)(uint8_t)(ch0) | ((uint32_t)(uint8_t)(ch1) << 8) | \
+     ((uint32_t)(uint8_t)(ch2) << 16) | ((uint32_t)(uint8_t)(ch3) << 24))
+
+typedef uint32_t PrPixelFormat;
+enum {
+    PrPixelFormat_BGRA_4444_8u      = MAKE_PIXEL_FORMAT_FOURCC('b', 'g', 'r', 'a'),
+    PrPixelFormat_VUYA_4444_8u      = MAKE_PIXEL_FORMAT_FOURCC('v', 'u', 'y', 'a'),
+    PrPixelFormat_VUYA_4444_8u_709  = MAKE_PIXEL_FORMAT_FOURCC('v', 'u', 'y', '7'),
+    PrPixelFormat_ARGB_4444_8u      = MAKE_PIXEL_FORMAT_FOURCC('a', 'r', 'g', 'b'),
+    PrPixelFormat_BGRX_4444_8u      = MAKE_PIXEL_FORMAT_FOURCC('b', 'g', 'r', 'x'),
+    PrPixelFormat_BGRA_4444_16u     = MAKE_PIXEL_FORMAT_FOURCC('B', 'g', 'r', 'a'),
+    PrPixelFormat_BGRA_4444_32f     = MAKE_PIXEL_FORMAT_FOURCC('B', 'G', 'r', 'a'),
+    PrPixelFormat_VUYA_4444_32f     = MAKE_PIXEL_FORMAT_FOURCC('V', 'U', 'y', 'a'),
+    PrPixelFormat_VUYA_4444_32f_709 = MAKE_PIXEL_FORMAT_FOURCC('V', 'U', 'y', '7'),
+    PrPixelFormat_Invalid           = MAKE_PIXEL_FORMAT_FOURCC('b', 'a', 'd', 'f')
+};
@@ -0,0 +1,12 @@
+// Stand-in for the SDK header of the same name, see AE_Effect.h
+#pragma once
+#include <cstdint>
+
+typedef int32_t SPErr;
+#define kSPNoError 0
+#define kSPSuiteNotFoundError 'S!Fd'
+
+typedef struct SPBasicSuite {
+    SPErr (*AcquireSuite)(const char* name, int32_t version, const void** suite);
+    SPErr (*ReleaseSuite)(const char* name, int32_t version);
+} SPBasicSuite;
@@ -0,0 +1,1089 @@
+/*
+ * MoshBrosh Harness - headless stand-in host
+ * Drives EffectMain through the stub SDK in SDK/ the way Premiere's RENDER path does: sequence
+ * setup, renders of a synthetic float BGRA clip in sequential, random and multi-threaded orders,
+ * exports from the clip's start and from inside the mosh range, renders at half and full
+ * resolution, parameter changes, flatten / reopen and setdown. Prints render latency percentiles,
+ * lock contention and analysis waits per phase, and checks every output against a
+ * single-threaded render of the same frame and params. The cyan "analysis in progress"
+ * placeholder is counted apart from wrong frames; it is only expected while renders with
+ * different params overlap.
+ *
+ * Build with:
+ *   make          (optimized, ./moshbrosh_harness)
+ *   make tsan     (ThreadSanitizer, ./moshbrosh_harness_tsan)
+ *   make exact    (MOSH_FLOW_EXACT=1, ./moshbrosh_harness_exact)
+ *
+ * make run-flow-exact analyzes the clip with the exact build's scalar double sums and checks
+ * the float SIMD build's motion fields against them.
+ */
+
+#include "MoshBrosh.h"
+#include "MoshStats.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ftw.h>
+#include <random>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <vector>
+
+#define HARNESS_TIME_STEP   100
+#define HARNESS_TIME_SCALE  2400    // 24 fps
+
+// Configuration
+struct HarnessConfig {
+    int width = 640;
+    int height = 360;
+    int frames = 48;
+    int moshFrame = 8;
+    int duration = 24;
+    int blockSize = BLOCK_SIZE_DFLT;
+    bool halfCache = false;
+    bool draft = false;         // host asks for draft quality, as during interactive playback
+    int threads = 4;            // concurrent render threads
+    int iterateThreads = 1;     // workers behind iterate_generic, 0 leaves the callback unset
+    int rounds = 2;             // passes over the clip per order
+    unsigned seed = 1;
+    bool keepHome = false;      // use the real HOME (persistent disk cache and logs)
+    std::string fieldsPath;     // write the clip's motion fields here instead of running the phases
+    std::string comparePath;    // or compare them against the ones written here
+};
+
+static HarnessConfig g_config;
+
+// ---------------------------------------------------------------------------------------------
+// Synthetic clip
+// ---------------------------------------------------------------------------------------------
+
+// A textured background panning left and a checkered square moving diagonally over it, so the
+// flow has two motions and an occlusion edge. Frames outside the clip hold the nearest frame.
+class SyntheticClip {
+public:
+    void Init(int width, int height, int frames) {
+        this->width = width;
+        this->height = height;
+        this->frames = frames;
+        panX = 2 * frames;
+        panY = frames;
+        waveX.resize(width + panX);
+        waveY.resize(height + panY);
+        for (int i = 0; i < (int)waveX.size(); ++i) {
+            waveX[i] = 0.25f * sinf((i - panX) * 0.11f);
+        }
+        for (int i = 0; i < (int)waveY.size(); ++i) {
+            waveY[i] = cosf((i - panY) * 0.07f);
+        }
+    }
+
+    int Frames() const { return frames; }
+
+    void Fill(int frame, char* data, A_long rowbytes) const {
+        frame = std::min(std::max(frame, 0), frames - 1);
+        int side = std::max(height / 4, 8);
+        int squareX = width / 8 + 3 * frame;
+        int squareY = height / 4 + frame;
+
+        for (int y = 0; y < height; ++y) {
+            float* row = (float*)(data + (size_t)y * rowbytes);
+            int sy = y - frame;
+            float wy = waveY[y - frame + panY];
+            for (int x = 0; x < width; ++x) {
+                int sx = x - 2 * frame;
+                float v = 0.5f + waveX[sx + panX] * wy;
+                if (((sx >> 4) ^ (sy >> 4)) & 1) {
+                    v += 0.2f;
+                }
+                int qx = x - squareX, qy = y - squareY;
+                if (qx >= 0 && qx < side && qy >= 0 && qy < side) {
+                    v = (((qx >> 3) ^ (qy >> 3)) & 1) ? 0.9f : 0.15f;
+                }
+                float* p = row + x * 4;
+                p[0] = v;
+                p[1] = v * 0.8f;
+                p[2] = 1.0f - v;
+                p[3] = 1.0f;
+            }
+        }
+    }
+
+private:
+    int width = 0, height = 0, frames = 0;
+    int panX = 0, panY = 0;
+    std::vector<float> waveX, waveY;
+};
+
+static SyntheticClip g_clip;
+
+// Frame `frame` at 1 / downsample of the clip's size, point sampled the way a host's draft
+// downsampling is
+static void FillLayer(int frame, int downsample, char* data, A_long rowbytes) {
+    if (downsample == 1) {
+        g_clip.Fill(frame, data, rowbytes);
+        return;
+    }
+    A_long fullRowbytes = g_config.width * (A_long)sizeof(PF_PixelFloat);
+    std::vector<char> full((size_t)fullRowbytes * g_config.height);
+    g_clip.Fill(frame, full.data(), fullRowbytes);
+    for (int y = 0; y < g_config.height / downsample; ++y) {
+        const PF_PixelFloat* src = (const PF_PixelFloat*)(full.data() + (size_t)y * downsample * fullRowbytes);
+        PF_PixelFloat* dst = (PF_PixelFloat*)(data + (size_t)y * rowbytes);
+        for (int x = 0; x < g_config.width / downsample; ++x) {
+            dst[x] = src[x * downsample];
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------------------------
+// Host callbacks
+// ---------------------------------------------------------------------------------------------
+
+// What the host knows about the EffectMain call in flight; in_data->effect_ref points here
+struct RenderContext {
+    const std::vector<PF_ParamDef>* params = nullptr;
+    PF_Handle sequenceData = nullptr;
+    bool mediaOffline = false;      // layer checkouts come back without pixels
+    int downsample = 1;             // render resolution, 1 / downsample of the clip's
+};
+
+static std::vector<PF_ParamDef> g_paramDefs;   // filled by PARAMS_SETUP, [0] is the input layer
+static std::atomic<int> g_hostCheckouts(0);
+
+// PF_Handle points at the first member, so the handle is the block itself
+struct HostHandle {
+    char* data;
+    A_u_long size;
+};
+
+static PF_Handle HostNewHandle(A_u_long size) {
+    HostHandle* handle = new HostHandle;
+    handle->data = (char*)calloc(1, size ? size : 1);
+    handle->size = size;
+    return &handle->data;
+}
+
+static void HostDisposeHandle(PF_Handle handle) {
+    if (handle) {
+        HostHandle* block = reinterpret_cast<HostHandle*>(handle);
+        free(block->data);
+        delete block;
+    }
+}
+
+static void* HostLockHandle(PF_Handle handle) { return *handle; }
+static void HostUnlockHandle(PF_Handle) {}
+
+static A_u_long HostGetHandleSize(PF_Handle handle) {
+    return handle ? reinterpret_cast<HostHandle*>(handle)->size : 0;
+}
+
+static PF_Err HostResizeHandle(A_u_long size, PF_Handle* handle) {
+    HostHandle* block = reinterpret_cast<HostHandle*>(*handle);
+    char* data = (char*)realloc(block->data, size ? size : 1);
+    if (!data) {
+        return PF_Err_OUT_OF_MEMORY;
+    }
+    block->data = data;
+    block->size = size;
+    return PF_Err_NONE;
+}
+
+static PF_Err HostAddParam(PF_ProgPtr, PF_ParamIndex, PF_ParamDefPtr def) {
+    g_paramDefs.push_back(*def);
+    return PF_Err_NONE;
+}
+
+// Other params come from the calling render's values; the layer is rendered from the clip
+static PF_Err HostCheckoutParam(PF_ProgPtr effect_ref, PF_ParamIndex index, A_long what_time,
+                                A_long time_step, A_u_long, PF_ParamDef* param) {
+    const RenderContext* context = (const RenderContext*)effect_ref;
+    if (index < 0 || index >= (PF_ParamIndex)context->params->size()) {
+        return PF_Err_INVALID_INDEX;
+    }
+    if (index != MOSH_INPUT) {
+        *param = (*context->params)[index];
+        return PF_Err_NONE;
+    }
+
+    memset(param, 0, sizeof(*param));
+    param->param_type = PF_Param_LAYER;
+    if (context->mediaOffline) {
+        return PF_Err_NONE;
+    }
+    PF_LayerDef& layer = param->u.ld;
+    layer.width = g_config.width / context->downsample;
+    layer.height = g_config.height / context->downsample;
+    layer.rowbytes = layer.width * (A_long)sizeof(PF_PixelFloat);
+    layer.extent_hint = { 0, 0, layer.width, layer.height };
+    char* data = new char[(size_t)layer.rowbytes * layer.height];
+    FillLayer(time_step ? what_time / time_step : 0, context->downsample, data, layer.rowbytes);
+    layer.data = data;
+    g_hostCheckouts.fetch_add(1, std::memory_order_relaxed);
+    return PF_Err_NONE;
+}
+
+static PF_Err HostCheckinParam(PF_ProgPtr, PF_ParamDef* param) {
+    if (param->param_type == PF_Param_LAYER) {
+        delete[] (char*)param->u.ld.data;
+        param->u.ld.data = nullptr;
+    }
+    return PF_Err_NONE;
+}
+
+static PF_Err HostAbort(PF_ProgPtr) { return PF_Err_NONE; }
+static PF_Err HostProgress(PF_ProgPtr, A_long, A_long) { return PF_Err_NONE; }
+
+// Runs the iterations on the calling thread plus iterateThreads - 1 helpers
+static PF_Err HostIterateGeneric(A_long iterations, void* refcon,
+                                 PF_Err (*fn)(void* refcon, A_long thread_index, A_long i, A_long iterations)) {
+    std::atomic<A_long> next(0);
+    std::atomic<PF_Err> err(PF_Err_NONE);
+    auto work = [&](A_long threadIndex) {
+        for (A_long i; (i = next.fetch_add(1)) < iterations && err.load() == PF_Err_NONE;) {
+            PF_Err result = fn(refcon, threadIndex, i, iterations);
+            if (result != PF_Err_NONE) {
+                err.store(result);
+            }
+        }
+    };
+
+    int helpers = std::min(g_config.iterateThreads, (int)iterations) - 1;
+    std::vector<std::thread> pool;
+    for (int t = 0; t < helpers; ++t) {
+        pool.emplace_back(work, t + 1);
+    }
+    work(0);
+    for (std::thread& thread : pool) {
+        thread.join();
+    }
+    return err.load();
+}
+
+static PF_Err HostAddSupportedPixelFormat(PF_ProgPtr, PrPixelFormat) { return PF_Err_NONE; }
+static PF_Err HostClearSupportedPixelFormats(PF_ProgPtr) { return PF_Err_NONE; }
+
+static PF_Err HostGetPixelFormat(PF_EffectWorld*, PrPixelFormat* pixelFormat) {
+    *pixelFormat = PrPixelFormat_BGRA_4444_32f;
+    return PF_Err_NONE;
+}
+
+static PF_Err HostGetConstSequenceData(PF_ProgPtr effect_ref, PF_ConstHandle* sequence_data) {
+    *sequence_data = (PF_ConstHandle)((const RenderContext*)effect_ref)->sequenceData;
+    return PF_Err_NONE;
+}
+
+static PF_PixelFormatSuite1 g_pixelFormatSuite = {
+    HostAddSupportedPixelFormat, HostClearSupportedPixelFormats, nullptr, nullptr, HostGetPixelFormat
+};
+static PF_EffectSequenceDataSuite1 g_sequenceDataSuite = { HostGetConstSequenceData };
+
+static SPErr HostAcquireSuite(const char* name, int32_t, const void** suite) {
+    if (strcmp(name, kPFPixelFormatSuite) == 0) {
+        *suite = &g_pixelFormatSuite;
+        return kSPNoError;
+    }
+    if (strcmp(name, kPFEffectSequenceDataSuite) == 0) {
+        *suite = &g_sequenceDataSuite;
+        return kSPNoError;
+    }
+    return kSPSuiteNotFoundError;
+}
+
+static SPErr HostReleaseSuite(const char*, int32_t) { return kSPNoError; }
+
+static PF_UtilCallbacks g_utils;
+static SPBasicSuite g_basicSuite = { HostAcquireSuite, HostReleaseSuite };
+static PF_InData g_inData;     // template, copied for every call
+
+static void InitHost() {
+    memset(&g_utils, 0, sizeof(g_utils));
+    g_utils.host_new_handle = HostNewHandle;
+    g_utils.host_dispose_handle = HostDisposeHandle;
+    g_utils.host_lock_handle = HostLockHandle;
+    g_utils.host_unlock_handle = HostUnlockHandle;
+    g_utils.host_get_handle_size = HostGetHandleSize;
+    g_utils.host_resize_handle = HostResizeHandle;
+    if (g_config.iterateThreads > 0) {
+        g_utils.iterate_generic = HostIterateGeneric;
+    }
+
+    memset(&g_inData, 0, sizeof(g_inData));
+    g_inData.utils = &g_utils;
+    g_inData.pica_basicP = &g_basicSuite;
+    g_inData.appl_id = 'PrMr';
+    g_inData.inter.add_param = HostAddParam;
+    g_inData.inter.checkout_param = HostCheckoutParam;
+    g_inData.inter.checkin_param = HostCheckinParam;
+    g_inData.inter.abort = HostAbort;
+    g_inData.inter.progress = HostProgress;
+    g_inData.quality = g_config.draft ? PF_Quality_LO : PF_Quality_HI;
+    g_inData.time_step = HARNESS_TIME_STEP;
+    g_inData.local_time_step = HARNESS_TIME_STEP;
+    g_inData.time_scale = HARNESS_TIME_SCALE;
+    g_inData.total_time = g_config.frames * HARNESS_TIME_STEP;
+    g_inData.width = g_config.width;
+    g_inData.height = g_config.height;
+    g_inData.extent_hint = { 0, 0, g_config.width, g_config.height };
+    g_inData.downsample_x = { 1, 1 };
+    g_inData.downsample_y = { 1, 1 };
+    g_inData.pixel_aspect_ratio = { 1, 1 };
+}
+
+// ---------------------------------------------------------------------------------------------
+// Sequence commands and renders
+// ---------------------------------------------------------------------------------------------
+
+static std::atomic<int> g_commandErrors(0);
+
+// One EffectMain call with its own in_data; returns out_data->sequence_data
+static PF_Handle SequenceCommand(PF_Cmd cmd, PF_Handle sequenceData) {
+    RenderContext context;
+    context.params = &g_paramDefs;
+    context.sequenceData = sequenceData;
+    PF_InData in_data = g_inData;
+    in_data.effect_ref = &context;
+    in_data.sequence_data = sequenceData;
+    PF_OutData out_data;
+    memset(&out_data, 0, sizeof(out_data));
+    out_data.sequence_data = sequenceData;
+
+    PF_Err err = EffectMain(cmd, &in_data, &out_data, nullptr, nullptr, nullptr);
+    if (err != PF_Err_NONE) {
+        fprintf(stderr, "EffectMain cmd %d failed: %d\n", (int)cmd, (int)err);
+        g_commandErrors.fetch_add(1);
+    }
+    return out_data.sequence_data;
+}
+
+// A render thread's copy of the instance, the way AE hands copies of sequence data to MFR threads
+static PF_Handle CopySequenceForThread(PF_Handle sequenceData) {
+    PF_Handle flat = SequenceCommand(PF_Cmd_GET_FLATTENED_SEQUENCE_DATA, sequenceData);
+    return SequenceCommand(PF_Cmd_SEQUENCE_RESETUP, flat);
+}
+
+static std::vector<PF_ParamDef> MakeParams(int moshFrame, int duration, int blockSize, bool halfCache) {
+    std::vector<PF_ParamDef> params = g_paramDefs;
+    params[MOSH_FRAME].u.sd.value = moshFrame;
+    params[MOSH_DURATION].u.sd.value = duration;
+    params[MOSH_BLOCK_SIZE].u.pd.value = blockSize;
+    params[MOSH_HALF_CACHE].u.bd.value = halfCache ? TRUE : FALSE;
+    return params;
+}
+
+static uint64_t HashWorld(const PF_LayerDef& world) {
+    uint64_t hash = 1469598103934665603ull;
+    size_t rowWords = (size_t)world.width * sizeof(PF_PixelFloat) / sizeof(uint64_t);
+    for (A_long y = 0; y < world.height; ++y) {
+        const char* row = (const char*)world.data + (size_t)y * world.rowbytes;
+        for (size_t i = 0; i < rowWords; ++i) {
+            uint64_t word;
+            memcpy(&word, row + i * sizeof(uint64_t), sizeof(word));
+            hash = (hash ^ word) * 1099511628211ull;
+        }
+    }
+    return hash;
+}
+
+// What a correct render of each frame hashes to, and what the cyan placeholder hashes to
+struct ExpectedOutput {
+    std::vector<uint64_t> hashes;
+    std::vector<uint64_t> placeholders;
+};
+
+// One render thread's host-side buffers and results
+struct RenderThread {
+    std::vector<PF_ParamDef> params;
+    std::vector<PF_ParamDef*> paramPtrs;
+    std::vector<char> input, output;
+    bool mediaOffline = false;
+    int downsample = 1;             // 2 renders at half resolution, as reduced-resolution playback does
+    std::vector<double> latenciesMs;
+    int mismatches = 0;
+    int placeholders = 0;
+
+    RenderThread() {
+        size_t bytes = (size_t)g_config.width * g_config.height * sizeof(PF_PixelFloat);
+        input.resize(bytes);
+        output.resize(bytes);
+    }
+
+    // Renders `frame` with `values` through `sequenceData`; returns the output hash and records the
+    // latency, or returns 0 on error
+    uint64_t Render(PF_Handle sequenceData, const std::vector<PF_ParamDef>& values, int frame) {
+        A_long width = g_config.width / downsample;
+        A_long height = g_config.height / downsample;
+        A_long rowbytes = width * (A_long)sizeof(PF_PixelFloat);
+        FillLayer(frame, downsample, input.data(), rowbytes);
+
+        params = values;
+        paramPtrs.clear();
+        for (PF_ParamDef& param : params) {
+            paramPtrs.push_back(&param);
+        }
+        PF_LayerDef& layer = params[MOSH_INPUT].u.ld;
+        layer.data = input.data();
+        layer.width = width;
+        layer.height = height;
+        layer.rowbytes = rowbytes;
+        layer.extent_hint = { 0, 0, width, height };
+
+        PF_LayerDef outputWorld;
+        memset(&outputWorld, 0, sizeof(outputWorld));
+        outputWorld.data = output.data();
+        outputWorld.width = width;
+        outputWorld.height = height;
+        outputWorld.rowbytes = rowbytes;
+        outputWorld.extent_hint = { 0, 0, width, height };
+
+        RenderContext context;
+        context.params = &params;
+        context.sequenceData = sequenceData;
+        context.mediaOffline = mediaOffline;
+        context.downsample = downsample;
+        PF_InData in_data = g_inData;
+        in_data.effect_ref = &context;
+        in_data.sequence_data = sequenceData;
+        in_data.current_time = frame * HARNESS_TIME_STEP;
+        in_data.downsample_x = { 1, (A_u_long)downsample };
+        in_data.downsample_y = { 1, (A_u_long)downsample };
+        in_data.extent_hint = { 0, 0, width, height };
+        PF_OutData out_data;
+        memset(&out_data, 0, sizeof(out_data));
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        PF_Err err = EffectMain(PF_Cmd_RENDER, &in_data, &out_data, paramPtrs.data(), &outputWorld, nullptr);
+        latenciesMs.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+
+        if (err != PF_Err_NONE) {
+            fprintf(stderr, "RENDER of frame %d failed: %d\n", frame, (int)err);
+            g_commandErrors.fetch_add(1);
+            return 0;
+        }
+        return HashWorld(outputWorld);
+    }
+
+    // Renders and compares against the expected output of the frame
+    void RenderAndCheck(PF_Handle sequenceData, const std::vector<PF_ParamDef>& values,
+                        const ExpectedOutput& expected, int frame) {
+        uint64_t hash = Render(sequenceData, values, frame);
+        if (hash == expected.hashes[frame]) {
+            return;
+        }
+        if (hash == expected.placeholders[frame]) {
+            ++placeholders;
+        } else {
+            ++mismatches;
+        }
+    }
+};
+
+// ---------------------------------------------------------------------------------------------
+// Phases and reporting
+// ---------------------------------------------------------------------------------------------
+
+struct StatsSample {
+    uint64_t lockContended;
+    uint64_t lockWaitNs;
+    uint64_t analysisWaits;
+    uint64_t analysisWaitNs;
+    uint64_t inputCheckouts;
+    uint64_t invalidations;
+};
+
+static StatsSample SampleStats() {
+    StatsSample sample;
+    uint64_t count, maxNs;
+    sample.lockContended = MoshStatValue(MOSH_STAT_LOCK_CONTENDED);
+    MoshStatTimerValue(MOSH_TIMER_LOCK_WAIT, &count, &sample.lockWaitNs, &maxNs);
+    MoshStatTimerValue(MOSH_TIMER_ANALYSIS_WAIT, &sample.analysisWaits, &sample.analysisWaitNs, &maxNs);
+    sample.inputCheckouts = MoshStatValue(MOSH_STAT_INPUT_CHECKOUTS);
+    sample.invalidations = MoshStatValue(MOSH_STAT_INVALIDATIONS);
+    return sample;
+}
+
+struct PhaseReport {
+    std::string name;
+    std::vector<double> latenciesMs;
+    int mismatches = 0;
+    int placeholders = 0;
+    bool placeholdersExpected = false;
+    double wallMs = 0.0;
+    StatsSample before, after;
+};
+
+static std::vector<PhaseReport> g_reports;
+
+// Runs body(thread, index) on `threadCount` render threads and records the phase
+template<typename Body>
+static void RunPhase(const char* name, int threadCount, bool placeholdersExpected, Body body) {
+    PhaseReport report;
+    report.name = name;
+    report.placeholdersExpected = placeholdersExpected;
+    std::vector<RenderThread> threads(threadCount);
+
+    report.before = SampleStats();
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    if (threadCount == 1) {
+        body(threads[0], 0);
+    } else {
+        std::vector<std::thread> pool;
+        for (int t = 0; t < threadCount; ++t) {
+            pool.emplace_back([&, t] { body(threads[t], t); });
+        }
+        for (std::thread& thread : pool) {
+            thread.join();
+        }
+    }
+    report.wallMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    report.after = SampleStats();
+
+    for (RenderThread& thread : threads) {
+        report.latenciesMs.insert(report.latenciesMs.end(), thread.latenciesMs.begin(), thread.latenciesMs.end());
+        report.mismatches += thread.mismatches;
+        report.placeholders += thread.placeholders;
+    }
+    g_reports.push_back(report);
+}
+
+// Nearest-rank percentile of sorted values
+static double Percentile(const std::vector<double>& sorted, double p) {
+    if (sorted.empty()) {
+        return 0.0;
+    }
+    size_t rank = (size_t)ceil(p * sorted.size());
+    return sorted[std::min(std::max(rank, (size_t)1), sorted.size()) - 1];
+}
+
+static void PrintReports() {
+    printf("\n%-16s %8s %10s %9s %9s %9s %9s %9s %11s %13s\n", "phase", "renders", "wall ms",
+           "mean ms", "p50 ms", "p90 ms", "p99 ms", "max ms", "mismatches", "placeholders");
+    for (PhaseReport& report : g_reports) {
+        std::vector<double> sorted = report.latenciesMs;
+        std::sort(sorted.begin(), sorted.end());
+        double total = 0.0;
+        for (double ms : sorted) {
+            total += ms;
+        }
+        printf("%-16s %8zu %10.1f %9.2f %9.2f %9.2f %9.2f %9.2f %11d %13d\n", report.name.c_str(), sorted.size(),
+               report.wallMs, sorted.empty() ? 0.0 : total / sorted.size(), Percentile(sorted, 0.50),
+               Percentile(sorted, 0.90), Percentile(sorted, 0.99), sorted.empty() ? 0.0 : sorted.back(),
+               report.mismatches, report.placeholders);
+    }
+
+    printf("\n%-16s %11s %10s %15s %12s %10s %14s\n", "phase", "lock waits", "lock ms",
+           "analysis waits", "analysis ms", "checkouts", "invalidations");
+    for (const PhaseReport& report : g_reports) {
+        const StatsSample& a = report.after;
+        const StatsSample& b = report.before;
+        printf("%-16s %11llu %10.2f %15llu %12.2f %10llu %14llu\n", report.name.c_str(),
+               (unsigned long long)(a.lockContended - b.lockContended), (a.lockWaitNs - b.lockWaitNs) / 1.0e6,
+               (unsigned long long)(a.analysisWaits - b.analysisWaits), (a.analysisWaitNs - b.analysisWaitNs) / 1.0e6,
+               (unsigned long long)(a.inputCheckouts - b.inputCheckouts),
+               (unsigned long long)(a.invalidations - b.invalidations));
+    }
+}
+
+static std::vector<int> ShuffledFrames(std::mt19937& rng) {
+    std::vector<int> frames(g_clip.Frames());
+    for (int f = 0; f < (int)frames.size(); ++f) {
+        frames[f] = f;
+    }
+    std::shuffle(frames.begin(), frames.end(), rng);
+    return frames;
+}
+
+// Output of every frame, rendered in order by one thread on a fresh instance, plus the
+// placeholders from an instance that can't check out other frames (untimed)
+static ExpectedOutput RenderReference(const char* name, const std::vector<PF_ParamDef>& values) {
+    ExpectedOutput expected;
+    expected.hashes.resize(g_clip.Frames());
+    expected.placeholders.resize(g_clip.Frames());
+
+    PF_Handle sequenceData = SequenceCommand(PF_Cmd_SEQUENCE_SETUP, nullptr);
+    RunPhase(name, 1, false, [&](RenderThread& thread, int) {
+        for (int round = 0; round < g_config.rounds; ++round) {
+            for (int f = 0; f < g_clip.Frames(); ++f) {
+                uint64_t hash = thread.Render(sequenceData, values, f);
+                if (round == 0) {
+                    expected.hashes[f] = hash;
+                } else if (hash != expected.hashes[f]) {
+                    ++thread.mismatches;
+                }
+            }
+        }
+    });
+    SequenceCommand(PF_Cmd_SEQUENCE_SETDOWN, sequenceData);
+
+    RenderThread offline;
+    offline.mediaOffline = true;
+    for (int f = 0; f < g_clip.Frames(); ++f) {
+        sequenceData = SequenceCommand(PF_Cmd_SEQUENCE_SETUP, nullptr);
+        expected.placeholders[f] = offline.Render(sequenceData, values, f);
+        SequenceCommand(PF_Cmd_SEQUENCE_SETDOWN, sequenceData);
+    }
+    return expected;
+}
+
+// ---------------------------------------------------------------------------------------------
+// Motion field comparison (make run-flow-exact)
+// ---------------------------------------------------------------------------------------------
+
+// Motion fields of the mosh range at full size, computed by rendering every frame once out of order
+// (so the range is precomputed, not streamed) on a fresh instance
+static std::vector<MotionField> AnalyzeClip(const std::vector<PF_ParamDef>& values) {
+    PF_Handle sequenceData = SequenceCommand(PF_Cmd_SEQUENCE_SETUP, nullptr);
+    RunPhase("fields", 1, false, [&](RenderThread& thread, int) {
+        std::mt19937 rng(g_config.seed);
+        for (int f : ShuffledFrames(rng)) {
+            thread.Render(sequenceData, values, f);
+        }
+    });
+
+    std::vector<MotionField> fields;
+    MoshSequenceData* seqData = ((MoshSequenceHandle*)*sequenceData)->data->get();
+    {
+        std::lock_guard<std::mutex> lock(seqData->cacheMutex);
+        const MotionFieldMap& stored = seqData->motionFields[MoshResolutionKey(g_config.width, g_config.height)];
+        for (int f = g_config.moshFrame; f < g_config.moshFrame + g_config.duration; ++f) {
+            auto it = stored.find(f);
+            if (it != stored.end()) {
+                fields.push_back(it->second);
+            }
+        }
+    }
+    SequenceCommand(PF_Cmd_SEQUENCE_SETDOWN, sequenceData);
+    return fields;
+}
+
+// One line per field: frame, size, block size and block grid, then every block's dx dy
+static bool WriteFields(const char* path, const std::vector<MotionField>& fields) {
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        perror(path);
+        return false;
+    }
+    for (const MotionField& field : fields) {
+        fprintf(file, "%d %d %d %d %d %d", field.frameIndex, field.width, field.height, field.blockSize,
+                field.blocksX, field.blocksY);
+        for (const MotionVector& mv : field.vectors) {
+            fprintf(file, " %d %d", mv.dx, mv.dy);
+        }
+        fprintf(file, "\n");
+    }
+    return fclose(file) == 0;
+}
+
+static bool ReadFields(const char* path, std::vector<MotionField>* fields) {
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        perror(path);
+        return false;
+    }
+    MotionField field;
+    while (fscanf(file, "%d %d %d %d %d %d", &field.frameIndex, &field.width, &field.height, &field.blockSize,
+                  &field.blocksX, &field.blocksY) == 6) {
+        field.Allocate(field.width, field.height, field.blockSize);
+        for (MotionVector& mv : field.vectors) {
+            int dx, dy;
+            if (fscanf(file, "%d %d", &dx, &dy) != 2) {
+                fclose(file);
+                return false;
+            }
+            mv.dx = (int16_t)dx;
+            mv.dy = (int16_t)dy;
+        }
+        fields->push_back(field);
+    }
+    fclose(file);
+    return !fields->empty();
+}
+
+// Prints how far `fields` are from the reference ones; true when they are the same vectors
+static bool CompareFields(const std::vector<MotionField>& reference, const std::vector<MotionField>& fields) {
+    if (reference.size() != fields.size()) {
+        printf("%zu motion fields, the reference has %zu\n", fields.size(), reference.size());
+        return false;
+    }
+    size_t vectors = 0, differing = 0;
+    int maxDiff = 0;
+    double totalDiff = 0.0;
+    for (size_t i = 0; i < fields.size(); ++i) {
+        const MotionField& a = reference[i];
+        const MotionField& b = fields[i];
+        if (a.frameIndex != b.frameIndex || !b.Matches(a.width, a.height, a.blockSize)) {
+            printf("motion field %zu doesn't match the reference's frame or grid\n", i);
+            return false;
+        }
+        for (size_t v = 0; v < a.vectors.size(); ++v) {
+            int diff = std::max(abs(a.vectors[v].dx - b.vectors[v].dx), abs(a.vectors[v].dy - b.vectors[v].dy));
+            differing += diff != 0;
+            maxDiff = std::max(maxDiff, diff);
+            totalDiff += diff;
+        }
+        vectors += a.vectors.size();
+    }
+    printf("%zu motion fields, %zu vectors: %zu differ (%.3f%%), max %.2f px, mean %.4f px\n", fields.size(),
+           vectors, differing, vectors ? 100.0 * differing / vectors : 0.0,
+           (double)maxDiff / MOSH_MV_UNITS_PER_PIXEL, vectors ? totalDiff / vectors / MOSH_MV_UNITS_PER_PIXEL : 0.0);
+    return differing == 0;
+}
+
+static int RemoveEntry(const char* path, const struct stat*, int, struct FTW*) {
+    return remove(path);
+}
+
+// ---------------------------------------------------------------------------------------------
+// Main
+// ---------------------------------------------------------------------------------------------
+
+static void PrintUsage(const char* program) {
+    printf("Usage: %s [options]\n"
+           "  --size WxH            frame size (default 640x360)\n"
+           "  --frames N            clip length (default 48)\n"
+           "  --mosh-frame N        Mosh Frame param (default 8)\n"
+           "  --duration N          Duration param (default 24)\n"
+           "  --block-size 8|16|32  Block Size param (default 16)\n"
+           "  --half                Half-Float cache precision\n"
+           "  --draft               render at draft quality\n"
+           "  --threads N           concurrent render threads (default 4)\n"
+           "  --iterate-threads N   iterate_generic workers, 0 = no iterate_generic (default 1)\n"
+           "  --rounds N            passes over the clip per order (default 2)\n"
+           "  --seed N              random order seed (default 1)\n"
+           "  --keep-home           keep HOME, so the disk cache and logs persist between runs\n"
+           "  --fields FILE         only analyze the clip and write its motion fields to FILE\n"
+           "  --compare-fields FILE only analyze the clip and compare its motion fields to FILE's\n",
+           program);
+}
+
+static bool ParseArgs(int argc, char** argv) {
+    HarnessConfig& c = g_config;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        bool takesValue = true;
+
+        if (arg == "--half") {
+            c.halfCache = true;
+            takesValue = false;
+        } else if (arg == "--draft") {
+            c.draft = true;
+            takesValue = false;
+        } else if (arg == "--keep-home") {
+            c.keepHome = true;
+            takesValue = false;
+        } else if (!value) {
+            return false;
+        } else if (arg == "--size") {
+            if (sscanf(value, "%dx%d", &c.width, &c.height) != 2) return false;
+        } else if (arg == "--frames") {
+            c.frames = atoi(value);
+        } else if (arg == "--mosh-frame") {
+            c.moshFrame = atoi(value);
+        } else if (arg == "--duration") {
+            c.duration = atoi(value);
+        } else if (arg == "--block-size") {
+            int size = atoi(value);
+            c.blockSize = size == 8 ? BLOCK_SIZE_8 : size == 32 ? BLOCK_SIZE_32 : BLOCK_SIZE_16;
+        } else if (arg == "--threads") {
+            c.threads = atoi(value);
+        } else if (arg == "--iterate-threads") {
+            c.iterateThreads = atoi(value);
+        } else if (arg == "--rounds") {
+            c.rounds = atoi(value);
+        } else if (arg == "--seed") {
+            c.seed = (unsigned)strtoul(value, nullptr, 10);
+        } else if (arg == "--fields") {
+            c.fieldsPath = value;
+        } else if (arg == "--compare-fields") {
+            c.comparePath = value;
+        } else {
+            return false;
+        }
+        if (takesValue) {
+            ++i;
+        }
+    }
+    return c.width >= 16 && c.height >= 16 && c.frames >= 2 && c.threads >= 1 &&
+           c.iterateThreads >= 0 && c.rounds >= 1 && c.moshFrame >= MOSH_FRAME_MIN && c.duration >= DURATION_MIN;
+}
+
+int main(int argc, char** argv) {
+    if (!ParseArgs(argc, argv)) {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+    const HarnessConfig& c = g_config;
+
+    // A scratch HOME keeps the disk cache from carrying motion fields between runs; within the
+    // run it works as on a Mac, where ~/Library/Caches always exists
+    char scratchHome[] = "/tmp/moshbrosh-harness-XXXXXX";
+    if (!c.keepHome) {
+        if (!mkdtemp(scratchHome)) {
+            perror("mkdtemp");
+            return 1;
+        }
+        setenv("HOME", scratchHome, 1);
+        std::string caches = std::string(scratchHome) + "/Library";
+        mkdir(caches.c_str(), 0755);
+        caches += "/Caches";
+        mkdir(caches.c_str(), 0755);
+    }
+    // The reports are built from the plugin's stats, which release builds leave off by default
+    setenv("MOSHBROSH_STATS", "1", 0);
+
+    g_clip.Init(c.width, c.height, c.frames);
+    InitHost();
+
+    printf("MoshBrosh harness - %dx%d float BGRA, %d frames, mosh frame %d duration %d, %s cache, %s quality\n",
+           c.width, c.height, c.frames, c.moshFrame, c.duration, c.halfCache ? "half" : "float",
+           c.draft ? "draft" : "full");
+    printf("%d render threads, iterate_generic %s%d, %d rounds, seed %u\n", c.threads,
+           c.iterateThreads ? "" : "off ", c.iterateThreads, c.rounds, c.seed);
+
+    SequenceCommand(PF_Cmd_GLOBAL_SETUP, nullptr);
+    g_paramDefs.assign(1, PF_ParamDef());
+    SequenceCommand(PF_Cmd_PARAMS_SETUP, nullptr);
+    if (g_paramDefs.size() != MOSH_NUM_PARAMS) {
+        fprintf(stderr, "PARAMS_SETUP added %zu params, expected %d\n", g_paramDefs.size() - 1, MOSH_NUM_PARAMS - 1);
+        return 1;
+    }
+
+    // The params the user switches between in the param-change phase
+    int otherBlockSize = c.blockSize == BLOCK_SIZE_16 ? BLOCK_SIZE_8 : BLOCK_SIZE_16;
+    std::vector<PF_ParamDef> values[2] = {
+        MakeParams(c.moshFrame, c.duration, c.blockSize, c.halfCache),
+        MakeParams(c.moshFrame + 3, std::max(c.duration - 6, 1), otherBlockSize, !c.halfCache)
+    };
+
+    // Flow check: the motion fields alone, written by one build and compared by another
+    if (!c.fieldsPath.empty() || !c.comparePath.empty()) {
+        std::vector<MotionField> fields = AnalyzeClip(values[0]), reference;
+        bool ok = fields.size() == (size_t)c.duration;
+        if (!ok) {
+            printf("analyzed %zu motion fields, expected %d\n", fields.size(), c.duration);
+        } else if (!c.fieldsPath.empty()) {
+            ok = WriteFields(c.fieldsPath.c_str(), fields);
+        } else {
+            ok = ReadFields(c.comparePath.c_str(), &reference) && CompareFields(reference, fields);
+        }
+        SequenceCommand(PF_Cmd_GLOBAL_SETDOWN, nullptr);
+        if (!c.keepHome) {
+            nftw(scratchHome, RemoveEntry, 16, FTW_DEPTH | FTW_PHYS);
+        }
+        ok = ok && !g_commandErrors.load();
+        printf("%s\n", ok ? "OK" : "FAILED");
+        return ok ? 0 : 1;
+    }
+
+    ExpectedOutput expected[2];
+    expected[0] = RenderReference("sequential", values[0]);
+
+    {
+        PF_Handle sequenceData = SequenceCommand(PF_Cmd_SEQUENCE_SETUP, nullptr);
+        RunPhase("random", 1, false, [&](RenderThread& thread, int) {
+            std::mt19937 rng(c.seed);
+            for (int round = 0; round < c.rounds; ++round) {
+                for (int f : ShuffledFrames(rng)) {
+                    thread.RenderAndCheck(sequenceData, values[0], expected[0], f);
+                }
+            }
+        });
+        SequenceCommand(PF_Cmd_SEQUENCE_SETDOWN, sequenceData);
+    }
+
+    expected[1] = RenderReference("sequential alt", values[1]);
+
+    // Concurrent phases share one instance; every thread renders through its own copy
+    PF_Handle sequenceData = SequenceCommand(PF_Cmd_SEQUENCE_SETUP, nullptr);
+    RunPhase("concurrent", c.threads, false, [&](RenderThread& thread, int t) {
+        PF_Handle copy = CopySequenceForThread(sequenceData);
+        std::mt19937 rng(c.seed + 1 + t);
+        for (int round = 0; round < c.rounds; ++round) {
+            for (int f : ShuffledFrames(rng)) {
+                thread.RenderAndCheck(copy, values[0], expected[0], f);
+            }
+        }
+        SequenceCommand(PF_Cmd_SEQUENCE_SETDOWN, copy);
+    });
+
+    // An export: frames handed out in order to every render thread, on an instance with nothing
+    // cached, so the mosh range is streamed
+    {
+        PF_Handle exportData = SequenceCommand(PF_Cmd_SEQUENCE_SETUP, nullptr);
+        std::atomic<int> nextFrame(0);
+        RunPhase("export", c.threads, false, [&](RenderThread& thread, int) {
+            PF_Handle copy = CopySequenceForThread(exportData);
+            for (int f = nextFrame++; f < c.frames; f = nextFrame++) {
+                thread.RenderAndCheck(copy, values[0], expected[0], f);
+            }
+            SequenceCommand(PF_Cmd_SEQUENCE_SETDOWN, copy);
+        });
+        SequenceCommand(PF_Cmd_SEQUENCE_SETDOWN, exportData);
+    }
+
+    // An export whose In point falls inside the mosh range: its first frame catches the stream up
+    // from the reference, so the range is never precomputed
+    {
+        PF_Handle exportData = SequenceCommand(PF_Cmd_SEQUENCE_SETUP, nullptr);
+        std::atomic<int> nextFrame(c.moshFrame + c.duration / 2);
+        uint64_t precomputedBefore, precomputedAfter, ns, maxNs;
+        MoshStatTimerValue(MOSH_TIMER_PRECOMPUTE, &precomputedBefore, &ns, &maxNs);
+        RunPhase("export mid-range", c.threads, false, [&](RenderThread& thread, int) {
+            PF_Handle copy = CopySequenceForThread(exportData);
+            for (int f = nextFrame++; f < c.frames; f = nextFrame++) {
+                thread.RenderAndCheck(copy, values[0], expected[0], f);
+            }
+            SequenceCommand(PF_Cmd_SEQUENCE_SETDOWN, copy);
+        });
+        MoshStatTimerValue(MOSH_TIMER_PRECOMPUTE, &precomputedAfter, &ns, &maxNs);
+        if (!c.draft && precomputedAfter != precomputedBefore) {
+            fprintf(stderr, "mid-range export precomputed the mosh range %llu times\n",
+                    (unsigned long long)(precomputedAfter - precomputedBefore));
+            g_commandErrors.fetch_add(1);
+        }
+        SequenceCommand(PF_Cmd_SEQUENCE_SETDOWN, exportData);
+    }
+
+    // Reduced-resolution playback switched to full and back: every size keeps its own motion
+    // fields, so going back to half resolution analyzes nothing and renders what it did before.
+    // A shorter Duration in between drops the warped frames past it, so they are warped again
+    // from the stored fields instead of coming straight from the cache.
+    {
+        PF_Handle resolutionData = SequenceCommand(PF_Cmd_SEQUENCE_SETUP, nullptr);
+        std::vector<uint64_t> halfHashes(c.frames);
+        RunPhase("half res", 1, false, [&](RenderThread& thread, int) {
+            std::mt19937 rng(c.seed + 201);
+            thread.downsample = 2;
+            for (int f : ShuffledFrames(rng)) {
+                halfHashes[f] = thread.Render(resolutionData, values[0], f);
+            }
+        });
+        RunPhase("full res", 1, false, [&](RenderThread& thread, int) {
+            std::mt19937 rng(c.seed + 202);
+            for (int f : ShuffledFrames(rng)) {
+                thread.RenderAndCheck(resolutionData, values[0], expected[0], f);
+            }
+        });
+        uint64_t analyzedBefore, analyzedAfter, ns, maxNs;
+        MoshStatTimerValue(MOSH_TIMER_MOTION_FIELD, &analyzedBefore, &ns, &maxNs);
+        RunPhase("half res again", 1, false, [&](RenderThread& thread, int) {
+            std::mt19937 rng(c.seed + 203);
+            thread.downsample = 2;
+            thread.Render(resolutionData, MakeParams(c.moshFrame, std::max(c.duration / 2, 1), c.blockSize,
+                                                     c.halfCache), c.moshFrame);
+            for (int f : ShuffledFrames(rng)) {
+                if (thread.Render(resolutionData, values[0], f) != halfHashes[f]) {
+                    ++thread.mismatches;
+                }
+            }
+        });
+        MoshStatTimerValue(MOSH_TIMER_MOTION_FIELD, &analyzedAfter, &ns, &maxNs);
+        if (analyzedAfter != analyzedBefore) {
+            fprintf(stderr, "half resolution analyzed %llu frame pairs again\n",
+                    (unsigned long long)(analyzedAfter - analyzedBefore));
+            g_commandErrors.fetch_add(1);
+        }
+        SequenceCommand(PF_Cmd_SEQUENCE_SETDOWN, resolutionData);
+    }
+
+    // A param scrubbed while threads are still rendering: renders alternate between the two sets.
+    // The cache holds one set at a time, so a render whose analysis another set invalidated may
+    // come back as the placeholder - but never as a frame of the other set.
+    RunPhase("param changes", c.threads, true, [&](RenderThread& thread, int t) {
+        PF_Handle copy = CopySequenceForThread(sequenceData);
+        std::mt19937 rng(c.seed + 101 + t);
+        std::vector<int> frames = ShuffledFrames(rng);
+        for (size_t k = 0; k < frames.size(); ++k) {
+            int set = (int)((k / 4 + t) % 2);
+            thread.RenderAndCheck(copy, values[set], expected[set], frames[k]);
+        }
+        SequenceCommand(PF_Cmd_SEQUENCE_SETDOWN, copy);
+    });
+
+    // Save: the live data is parked, and a RESETUP in the same session picks it back up
+    PF_Handle flat = SequenceCommand(PF_Cmd_SEQUENCE_FLATTEN, sequenceData);
+    size_t flatBytes = HostGetHandleSize(flat);
+    PF_Handle reopened = HostNewHandle((A_u_long)flatBytes);
+    memcpy(*reopened, *flat, flatBytes);
+    PF_Handle duplicate = HostNewHandle((A_u_long)flatBytes);
+    memcpy(*duplicate, *flat, flatBytes);
+    sequenceData = SequenceCommand(PF_Cmd_SEQUENCE_RESETUP, flat);
+    RunPhase("resetup", 1, false, [&](RenderThread& thread, int) {
+        for (int f = 0; f < c.frames; ++f) {
+            thread.RenderAndCheck(sequenceData, values[0], expected[0], f);
+        }
+    });
+
+    // Duplicate the effect: the same saved data, set up while the original is live, must not
+    // share (and keep clearing) the original's caches
+    duplicate = SequenceCommand(PF_Cmd_SEQUENCE_RESETUP, duplicate);
+    if (((MoshSequenceHandle*)*duplicate)->instanceId == ((MoshSequenceHandle*)*sequenceData)->instanceId) {
+        fprintf(stderr, "duplicate shares the original's instance id\n");
+        g_commandErrors.fetch_add(1);
+    }
+    RunPhase("duplicate", 2, false, [&](RenderThread& thread, int t) {
+        for (int f = 0; f < c.frames; ++f) {
+            thread.RenderAndCheck(t ? duplicate : sequenceData, values[t], expected[t], f);
+        }
+    });
+    SequenceCommand(PF_Cmd_SEQUENCE_SETDOWN, duplicate);
+
+    // Reopen in a new session: an instance id nobody knows, so only the flattened fields are left
+    if (flatBytes >= sizeof(MoshSequenceDataFlat)) {
+        ((MoshSequenceDataFlat*)*reopened)->instanceId ^= 0x5555;
+    }
+    reopened = SequenceCommand(PF_Cmd_SEQUENCE_RESETUP, reopened);
+    RunPhase("reopen", 1, false, [&](RenderThread& thread, int) {
+        for (int f = 0; f < c.frames; ++f) {
+            thread.RenderAndCheck(reopened, values[0], expected[0], f);
+        }
+    });
+
+    SequenceCommand(PF_Cmd_SEQUENCE_SETDOWN, reopened);
+    SequenceCommand(PF_Cmd_SEQUENCE_SETDOWN, sequenceData);
+    SequenceCommand(PF_Cmd_GLOBAL_SETDOWN, nullptr);
+
+    PrintReports();
+    printf("\nflattened sequence data %zu bytes, %d host layer checkouts\n", flatBytes, g_hostCheckouts.load());
+
+    uint64_t packs, packNs, unpacks, unpackNs, maxNs;
+    MoshStatTimerValue(MOSH_TIMER_PACK, &packs, &packNs, &maxNs);
+    MoshStatTimerValue(MOSH_TIMER_UNPACK, &unpacks, &unpackNs, &maxNs);
+    uint64_t packedOut = MoshStatValue(MOSH_STAT_PACK_BYTES_OUT);
+    printf("packed %llu frames %.2fx in %.2f ms, unpacked %llu in %.2f ms\n", (unsigned long long)packs,
+           packedOut ? (double)MoshStatValue(MOSH_STAT_PACK_BYTES_IN) / packedOut : 0.0, packNs / 1.0e6,
+           (unsigned long long)unpacks, unpackNs / 1.0e6);
+    printf("shared source frames: %llu hits, %llu misses\n",
+           (unsigned long long)MoshStatValue(MOSH_STAT_SHARED_HITS),
+           (unsigned long long)MoshStatValue(MOSH_STAT_SHARED_MISSES));
+    printf("streamed frames: %llu\n", (unsigned long long)MoshStatValue(MOSH_STAT_FRAMES_STREAMED));
+    printf("disk cache: %llu hits, %llu misses\n",
+           (unsigned long long)MoshStatValue(MOSH_STAT_DISK_HITS),
+           (unsigned long long)MoshStatValue(MOSH_STAT_DISK_MISSES));
+    if (c.draft) {
+        printf("draft motion fields: %llu\n", (unsigned long long)MoshStatValue(MOSH_STAT_DRAFT_FIELDS));
+    }
+
+    if (!c.keepHome) {
+        nftw(scratchHome, RemoveEntry, 16, FTW_DEPTH | FTW_PHYS);
+    }
+
+    int mismatches = 0, placeholders = 0;
+    for (const PhaseReport& report : g_reports) {
+        mismatches += report.mismatches;
+        placeholders += report.placeholdersExpected ? 0 : report.placeholders;
+    }
+    if (mismatches || placeholders || g_commandErrors.load()) {
+        printf("FAILED: %d mismatched renders, %d unexpected placeholders, %d command errors\n",
+               mismatches, placeholders, g_commandErrors.load());
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
@@ -4,359 +4,3328 @@
  */
 
 #include "MoshBrosh.h"
+#include "MoshDiskCache.h"
+#include "MoshFrameRegistry.h"
+#include "MoshHash.h"
+#include "MoshLog.h"
+#include "MoshPack.h"
+#include "MoshStats.h"
 #include <cstdio>
-#include <cstdarg>
 #include <cstdlib>
 #include <cmath>
 #include <cstring>
+#include <random>
 
-// Debug logging
-static FILE* g_debugLog = nullptr;
+#if defined(__SSE2__)
+    #include <emmintrin.h>
+#elif defined(__ARM_NEON)
+    #include <arm_neon.h>
+#endif
+#if defined(__F16C__)
+    #include <immintrin.h>
+#endif
 
-static void DebugLog(const char* fmt, ...) {
-    if (!g_debugLog) {
-        g_debugLog = fopen("/Users/mads/Desktop/moshbrosh_debug.log", "a");
-        if (g_debugLog) {
-            fprintf(g_debugLog, "\n\n=== MoshBrosh Plugin Started ===\n");
-            fflush(g_debugLog);
+//==============================================================================
+// PIXEL FORMAT HELPERS
+//==============================================================================
+
+// Per-channel conversion between host worlds and normalized float
+template<typename ChannelT> struct ChannelTraits;
+
+template<> struct ChannelTraits<PF_FpShort> {
+    static inline float ToFloat(PF_FpShort v) { return v; }
+    static inline PF_FpShort FromFloat(float v) { return v; }
+};
+
+template<> struct ChannelTraits<A_u_char> {
+    static inline float ToFloat(A_u_char v) { return v * (1.0f / PF_MAX_CHAN8); }
+    static inline A_u_char FromFloat(float v) {
+        return (A_u_char)Clamp(v * PF_MAX_CHAN8 + 0.5f, 0.0f, (float)PF_MAX_CHAN8);
+    }
+};
+
+template<> struct ChannelTraits<A_u_short> {
+    static inline float ToFloat(A_u_short v) { return v * (1.0f / PF_MAX_CHAN16); }
+    static inline A_u_short FromFloat(float v) {
+        return (A_u_short)Clamp(v * PF_MAX_CHAN16 + 0.5f, 0.0f, (float)PF_MAX_CHAN16);
+    }
+};
+
+// RGB formats: luma is weighted from R, G, B at the given channel indices
+template<typename Channel, int R, int G, int B>
+struct RgbPixelTraits {
+    typedef Channel ChannelT;
+
+    static inline float Luma(const ChannelT* px) {
+        return 0.299f * ChannelTraits<ChannelT>::ToFloat(px[R]) +
+               0.587f * ChannelTraits<ChannelT>::ToFloat(px[G]) +
+               0.114f * ChannelTraits<ChannelT>::ToFloat(px[B]);
+    }
+
+    // Cyan tint: boost G and B, reduce R, alpha unchanged
+    static inline void Cyan(const ChannelT* s, ChannelT* o) {
+        float r = ChannelTraits<ChannelT>::ToFloat(s[R]);
+        float g = ChannelTraits<ChannelT>::ToFloat(s[G]);
+        float b = ChannelTraits<ChannelT>::ToFloat(s[B]);
+        for (int c = 0; c < 4; ++c) {
+            o[c] = s[c];
         }
+        o[B] = ChannelTraits<ChannelT>::FromFloat(b * 1.0f + 0.2f);  // B boosted
+        o[G] = ChannelTraits<ChannelT>::FromFloat(g * 1.0f + 0.2f);  // G boosted
+        o[R] = ChannelTraits<ChannelT>::FromFloat(r * 0.5f);         // R reduced
+    }
+};
+
+// VUYA formats: luma is stored directly, no conversion needed
+template<typename Channel>
+struct VuyaPixelTraits {
+    typedef Channel ChannelT;
+
+    static inline float Luma(const ChannelT* px) {
+        return ChannelTraits<ChannelT>::ToFloat(px[2]);
+    }
+
+    // Cyan tint: push chroma towards blue-green (Pb up, Pr down), luma and alpha unchanged
+    static inline void Cyan(const ChannelT* s, ChannelT* o) {
+        float pr = ChannelTraits<ChannelT>::ToFloat(s[0]);
+        float pb = ChannelTraits<ChannelT>::ToFloat(s[1]);
+        o[0] = ChannelTraits<ChannelT>::FromFloat(pr - 0.15f);
+        o[1] = ChannelTraits<ChannelT>::FromFloat(pb + 0.1f);
+        o[2] = s[2];
+        o[3] = s[3];
+    }
+};
+
+template<MoshPixelFormat F> struct PixelTraits;
+template<> struct PixelTraits<MoshPixelFormat::BGRA_32f> : RgbPixelTraits<PF_FpShort, 2, 1, 0> {};
+template<> struct PixelTraits<MoshPixelFormat::BGRA_8u>  : RgbPixelTraits<A_u_char, 2, 1, 0> {};
+template<> struct PixelTraits<MoshPixelFormat::ARGB_8u>  : RgbPixelTraits<A_u_char, 1, 2, 3> {};
+template<> struct PixelTraits<MoshPixelFormat::ARGB_16u> : RgbPixelTraits<A_u_short, 1, 2, 3> {};
+template<> struct PixelTraits<MoshPixelFormat::ARGB_32f> : RgbPixelTraits<PF_FpShort, 1, 2, 3> {};
+template<> struct PixelTraits<MoshPixelFormat::VUYA_8u>  : VuyaPixelTraits<A_u_char> {};
+template<> struct PixelTraits<MoshPixelFormat::VUYA_32f> : VuyaPixelTraits<PF_FpShort> {};
+
+// Run fn(PixelTraits<format>()) - the one place a runtime format picks a template instantiation
+template<typename Fn>
+static inline void DispatchPixelFormat(MoshPixelFormat format, Fn&& fn) {
+    switch (format) {
+        case MoshPixelFormat::ARGB_8u:  fn(PixelTraits<MoshPixelFormat::ARGB_8u>());  break;
+        case MoshPixelFormat::ARGB_16u: fn(PixelTraits<MoshPixelFormat::ARGB_16u>()); break;
+        case MoshPixelFormat::ARGB_32f: fn(PixelTraits<MoshPixelFormat::ARGB_32f>()); break;
+        case MoshPixelFormat::BGRA_8u:  fn(PixelTraits<MoshPixelFormat::BGRA_8u>());  break;
+        case MoshPixelFormat::VUYA_8u:  fn(PixelTraits<MoshPixelFormat::VUYA_8u>());  break;
+        case MoshPixelFormat::VUYA_32f: fn(PixelTraits<MoshPixelFormat::VUYA_32f>()); break;
+        default:                        fn(PixelTraits<MoshPixelFormat::BGRA_32f>()); break;
+    }
+}
+
+// IEEE half <-> float for float frames cached at half precision. Rounds to nearest even like the
+// vector instructions, so every path stores the same bits; beyond +-65504 becomes infinity.
+static inline uint16_t FloatToHalf(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint32_t sign = (bits >> 16) & 0x8000u;
+    bits &= 0x7fffffffu;
+
+    if (bits >= 0x47800000u) {
+        // Past the half range: infinity, or a quiet NaN
+        return (uint16_t)(sign | (bits > 0x7f800000u ? 0x7e00u : 0x7c00u));
+    }
+    if (bits < 0x38800000u) {
+        // Subnormal or zero: adding 0.5 lines the 10 mantissa bits up at the bottom and rounds
+        float magnitude;
+        memcpy(&magnitude, &bits, sizeof(bits));
+        magnitude += 0.5f;
+        memcpy(&bits, &magnitude, sizeof(bits));
+        return (uint16_t)(sign | (bits - 0x3f000000u));
+    }
+    // Rebias the exponent and round the 13 dropped bits to nearest even
+    bits += 0xc8000fffu + ((bits >> 13) & 1u);
+    return (uint16_t)(sign | (bits >> 13));
+}
+
+static inline float HalfToFloat(uint16_t half) {
+    uint32_t bits = (uint32_t)(half & 0x7fffu) << 13;
+    uint32_t exponent = bits & 0x0f800000u;
+    bits += 0x38000000u;
+    if (exponent == 0x0f800000u) {
+        bits += 0x38000000u;        // infinity / NaN
+    } else if (exponent == 0) {
+        bits += 0x00800000u;        // zero / subnormal: renormalize
+        float value;
+        memcpy(&value, &bits, sizeof(bits));
+        value -= 6.103515625e-05f;  // 2^-14
+        memcpy(&bits, &value, sizeof(bits));
+    }
+    bits |= (uint32_t)(half & 0x8000u) << 16;
+    float value;
+    memcpy(&value, &bits, sizeof(bits));
+    return value;
+}
+
+static void FloatToHalfRow(const float* src, uint16_t* dst, int count) {
+    int i = 0;
+#if defined(__F16C__)
+    for (; i + 8 <= count; i += 8) {
+        _mm_storeu_si128((__m128i*)(dst + i), _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT));
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 4 <= count; i += 4) {
+        vst1_u16(dst + i, vreinterpret_u16_f16(vcvt_f16_f32(vld1q_f32(src + i))));
+    }
+#endif
+    for (; i < count; ++i) {
+        dst[i] = FloatToHalf(src[i]);
+    }
+}
+
+static void HalfToFloatRow(const uint16_t* src, float* dst, int count) {
+    int i = 0;
+#if defined(__F16C__)
+    for (; i + 8 <= count; i += 8) {
+        _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(src + i))));
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 4 <= count; i += 4) {
+        vst1q_f32(dst + i, vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(src + i))));
+    }
+#endif
+    for (; i < count; ++i) {
+        dst[i] = HalfToFloat(src[i]);
+    }
+}
+
+// Row y of a host world (negative rowbytes walk upwards from data)
+static inline char* WorldRow(const PF_LayerDef* world, int y) {
+    return (char*)world->data + (ptrdiff_t)y * world->rowbytes;
+}
+
+// Content hash, XXH3-style: four 64-bit lanes each add the product of the two halves of
+// (data ^ key) and the neighbouring lane's data, 32 bytes per step. No step depends on the one
+// before, so it runs at memory speed; the vector paths produce the same bits as the scalar one.
+static const uint64_t kHashKeys[4] = {
+    0xbe4ba423396cfeb8ull, 0x1cad21f72c81017cull, 0xdb979083e96dd4deull, 0x1f67b3b7a4a44072ull
+};
+
+static inline uint64_t MixHash(uint64_t hash) {
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ull;
+    return hash ^ (hash >> 33);
+}
+
+static inline void HashStripe(uint64_t lanes[4], const uint8_t* data) {
+    for (int i = 0; i < 4; ++i) {
+        uint64_t word;
+        memcpy(&word, data + i * sizeof(word), sizeof(word));
+        uint64_t keyed = word ^ kHashKeys[i];
+        lanes[i] += (keyed & 0xffffffffu) * (keyed >> 32);
+        lanes[i ^ 1] += word;
+    }
+}
+
+static uint64_t HashBytes(const uint8_t* data, size_t bytes) {
+    uint64_t lanes[4] = { kHashKeys[0], kHashKeys[1], kHashKeys[2], kHashKeys[3] };
+    size_t stripes = bytes / 32;
+#if defined(__SSE2__)
+    __m128i acc0 = _mm_loadu_si128((const __m128i*)lanes);
+    __m128i acc1 = _mm_loadu_si128((const __m128i*)(lanes + 2));
+    const __m128i key0 = _mm_loadu_si128((const __m128i*)kHashKeys);
+    const __m128i key1 = _mm_loadu_si128((const __m128i*)(kHashKeys + 2));
+    for (size_t s = 0; s < stripes; ++s) {
+        __m128i data0 = _mm_loadu_si128((const __m128i*)(data + s * 32));
+        __m128i data1 = _mm_loadu_si128((const __m128i*)(data + s * 32 + 16));
+        __m128i keyed0 = _mm_xor_si128(data0, key0);
+        __m128i keyed1 = _mm_xor_si128(data1, key1);
+        acc0 = _mm_add_epi64(acc0, _mm_mul_epu32(keyed0, _mm_srli_epi64(keyed0, 32)));
+        acc1 = _mm_add_epi64(acc1, _mm_mul_epu32(keyed1, _mm_srli_epi64(keyed1, 32)));
+        acc0 = _mm_add_epi64(acc0, _mm_shuffle_epi32(data0, _MM_SHUFFLE(1, 0, 3, 2)));
+        acc1 = _mm_add_epi64(acc1, _mm_shuffle_epi32(data1, _MM_SHUFFLE(1, 0, 3, 2)));
+    }
+    _mm_storeu_si128((__m128i*)lanes, acc0);
+    _mm_storeu_si128((__m128i*)(lanes + 2), acc1);
+#elif defined(__ARM_NEON)
+    uint64x2_t acc0 = vld1q_u64(lanes);
+    uint64x2_t acc1 = vld1q_u64(lanes + 2);
+    const uint64x2_t key0 = vld1q_u64(kHashKeys);
+    const uint64x2_t key1 = vld1q_u64(kHashKeys + 2);
+    for (size_t s = 0; s < stripes; ++s) {
+        uint64x2_t data0 = vreinterpretq_u64_u8(vld1q_u8(data + s * 32));
+        uint64x2_t data1 = vreinterpretq_u64_u8(vld1q_u8(data + s * 32 + 16));
+        uint64x2_t keyed0 = veorq_u64(data0, key0);
+        uint64x2_t keyed1 = veorq_u64(data1, key1);
+        acc0 = vaddq_u64(acc0, vmull_u32(vmovn_u64(keyed0), vshrn_n_u64(keyed0, 32)));
+        acc1 = vaddq_u64(acc1, vmull_u32(vmovn_u64(keyed1), vshrn_n_u64(keyed1, 32)));
+        acc0 = vaddq_u64(acc0, vextq_u64(data0, data0, 1));
+        acc1 = vaddq_u64(acc1, vextq_u64(data1, data1, 1));
+    }
+    vst1q_u64(lanes, acc0);
+    vst1q_u64(lanes + 2, acc1);
+#else
+    for (size_t s = 0; s < stripes; ++s) {
+        HashStripe(lanes, data + s * 32);
+    }
+#endif
+    if (bytes % 32) {
+        uint8_t tail[32] = { 0 };
+        memcpy(tail, data + stripes * 32, bytes % 32);
+        HashStripe(lanes, tail);
     }
-    if (g_debugLog) {
-        va_list args;
-        va_start(args, fmt);
-        vfprintf(g_debugLog, fmt, args);
-        va_end(args);
-        fprintf(g_debugLog, "\n");
-        fflush(g_debugLog);
+
+    uint64_t hash = MixHash(bytes * 0x9e3779b97f4a7c15ull);
+    for (int i = 0; i < 4; ++i) {
+        hash = MixHash(hash ^ lanes[i]);
+    }
+    return hash;
+}
+
+// Content hash of a host world's pixels and size, row padding excluded
+static uint64_t HashWorld(const PF_LayerDef* world, MoshPixelFormat format) {
+    MoshStatScope timer(MOSH_TIMER_HASH);
+    size_t rowBytes = (size_t)world->width * MoshBytesPerPixel(format);
+    uint64_t hash = MixHash(((uint64_t)(uint32_t)world->width << 32) | (uint32_t)world->height);
+    for (int y = 0; y < world->height; ++y) {
+        hash = MixHash(hash ^ HashBytes((const uint8_t*)WorldRow(world, y), rowBytes));
+    }
+    return hash;
+}
+
+// Run fn(i) for every i in [0, count) on the host's iterate threads - serially when there is only
+// one, or the host has no iterate_generic. Items run concurrently, so fn(i) may only write what
+// item i owns.
+static inline bool HostIterates(const PF_InData* in_data) {
+    return in_data && in_data->utils && in_data->utils->iterate_generic;
+}
+
+template<typename Fn>
+static PF_Err IterateGeneric(PF_InData* in_data, int count, Fn& fn) {
+    if (count <= 1 || !HostIterates(in_data)) {
+        for (int i = 0; i < count; ++i) {
+            fn(i);
+        }
+        return PF_Err_NONE;
     }
+
+    return in_data->utils->iterate_generic(count, &fn,
+        [](void* refcon, A_long thread_index, A_long i, A_long iterations) -> PF_Err {
+            (*(Fn*)refcon)((int)i);
+            return PF_Err_NONE;
+        });
+}
+
+// Run rowFn(y) for every y in [0, height), in bands spread across the host's iterate threads.
+// Rows are addressed through WorldRow, so negative rowbytes work unchanged.
+template<typename RowFn>
+static PF_Err IterateOutputRows(PF_InData* in_data, int height, RowFn& rowFn) {
+    static const int kBandRows = 16;
+
+    auto band = [&](int i) {
+        int yEnd = std::min((i + 1) * kBandRows, height);
+        for (int y = i * kBandRows; y < yEnd; ++y) {
+            rowFn(y);
+        }
+    };
+    return IterateGeneric(in_data, (height + kBandRows - 1) / kBandRows, band);
 }
 
 //==============================================================================
 // SEQUENCE DATA HELPERS - Uses AccumulatedFrame from header
 //==============================================================================
 
-static void CopyFrameToAccumulated(PF_LayerDef* src, AccumulatedFrame& dst) {
-    if (!src || !src->data) return;
+#define MOSH_FLOW_PYRAMID_LEVELS    4       // full resolution plus three halvings
+#define MOSH_FLOW_MIN_LEVEL_SIZE    16      // no level narrower or shorter than this
+#define MOSH_FLOW_ITERATIONS        4       // Gauss-Newton steps per level at most
+#define MOSH_FLOW_MIN_STEP          0.03f   // pixels; smaller updates end a level early
+#define MOSH_FLOW_MIN_HALF_WINDOW   4       // coarse levels keep at least a 9x9-ish window
+#define MOSH_FLOW_MAX_MOTION        64.0f   // pixels
+#define MOSH_FLOW_WARM_ITERATIONS   2       // steps refining the previous pair's vector
+#define MOSH_FLOW_WARM_ACCEPT       0.5     // warm residual must at least halve the zero-motion one
+#define MOSH_FLOW_RESIDUAL_FLOOR    1e-4    // ...unless it is below this per pixel (luma squared)
+#define MOSH_FLOW_WARM_MIN_CORNER   0.02    // det / trace^2 of the block's normal matrix, at most 0.25
+#define MOSH_FLOW_LANE_ROWS         8       // rows summed in float lanes before folding into double
+#define MOSH_FLOW_TABLE_STRIPE      128     // table columns per parallel item while building
+#define MOSH_FLOW_DRAFT_LEVEL       1       // draft renders stop the pyramid here, with blocks as much larger
+
+// Set to 1 to accumulate the Lucas-Kanade sums in double one product at a time, the reference the
+// float SIMD kernels are checked against
+#ifndef MOSH_FLOW_EXACT
+    #define MOSH_FLOW_EXACT 0
+#endif
+
+// Gradient kernel: out[i] = (next[i] - prev[i]) * 0.5 over count floats. Run along a row for Ix
+// (prev/next one pixel apart) and across rows for Iy (the rows above and below).
+static void CentralDifference(const float* prev, const float* next, float* out, int count) {
+    int i = 0;
+#if defined(__SSE2__)
+    __m128 vHalf = _mm_set1_ps(0.5f);
+    for (; i + 4 <= count; i += 4) {
+        _mm_storeu_ps(out + i, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(next + i), _mm_loadu_ps(prev + i)), vHalf));
+    }
+#elif defined(__ARM_NEON)
+    float32x4_t vHalf = vdupq_n_f32(0.5f);
+    for (; i + 4 <= count; i += 4) {
+        vst1q_f32(out + i, vmulq_f32(vsubq_f32(vld1q_f32(next + i), vld1q_f32(prev + i)), vHalf));
+    }
+#endif
+    for (; i < count; ++i) {
+        out[i] = (next[i] - prev[i]) * 0.5f;
+    }
+}
 
-    int width = src->width;
-    int height = src->height;
+// Gradient planes of a level whose luma is filled in. Edge pixels take their missing neighbour
+// from the nearest pixel, as a clamped lookup would.
+static void BuildLevelGradients(MoshFlowLevel& level) {
+    int width = level.width;
+    int height = level.height;
+    level.gradX.resize(level.luma.size());
+    level.gradY.resize(level.luma.size());
 
-    dst.Allocate(width, height);
-    dst.valid = true;
+    for (int y = 0; y < height; ++y) {
+        const float* luma = level.luma.data() + (size_t)y * width;
+        float* gradX = level.gradX.data() + (size_t)y * width;
+        gradX[0] = (luma[std::min(1, width - 1)] - luma[0]) * 0.5f;
+        CentralDifference(luma, luma + 2, gradX + 1, width - 2);
+        gradX[width - 1] = (luma[width - 1] - luma[std::max(width - 2, 0)]) * 0.5f;
+    }
 
-    // Copy pixel data row by row (handle negative rowbytes)
-    int srcAbsRowbytes = src->rowbytes < 0 ? -src->rowbytes : src->rowbytes;
     for (int y = 0; y < height; ++y) {
-        const char* srcRow = (src->rowbytes < 0)
-            ? (const char*)src->data - y * srcAbsRowbytes
-            : (const char*)src->data + y * srcAbsRowbytes;
-        float* dstRow = dst.pixelData.data() + y * width * 4;
-        memcpy(dstRow, srcRow, width * 4 * sizeof(float));
+        const float* above = level.luma.data() + (size_t)std::max(y - 1, 0) * width;
+        const float* below = level.luma.data() + (size_t)std::min(y + 1, height - 1) * width;
+        CentralDifference(above, below, level.gradY.data() + (size_t)y * width, width);
+    }
+}
+
+// Next pyramid level: 2x2 box average of the finer luma (an odd last row or column is repeated)
+static void DownsampleLevel(const MoshFlowLevel& fine, MoshFlowLevel* coarse) {
+    coarse->width = (fine.width + 1) / 2;
+    coarse->height = (fine.height + 1) / 2;
+    coarse->luma.resize((size_t)coarse->width * coarse->height);
+
+    for (int y = 0; y < coarse->height; ++y) {
+        const float* row0 = fine.luma.data() + (size_t)(2 * y) * fine.width;
+        const float* row1 = fine.luma.data() + (size_t)std::min(2 * y + 1, fine.height - 1) * fine.width;
+        float* out = coarse->luma.data() + (size_t)y * coarse->width;
+        for (int x = 0; x < coarse->width; ++x) {
+            int x0 = 2 * x;
+            int x1 = std::min(2 * x + 1, fine.width - 1);
+            out[x] = (row0[x0] + row0[x1] + row1[x0] + row1[x1]) * 0.25f;
+        }
+    }
+}
+
+// Flow pyramid of a cached source frame: luma from the host world it was copied from - at full
+// precision, whatever the cache keeps - then halvings down to MOSH_FLOW_MIN_LEVEL_SIZE, each
+// level with its gradients
+template<typename Traits>
+static void BuildFlowPyramid(const PF_LayerDef* src, AccumulatedFrame& frame) {
+    typedef typename Traits::ChannelT ChannelT;
+    std::shared_ptr<MoshFlowPyramid> pyramid = std::make_shared<MoshFlowPyramid>(1);
+    MoshFlowLevel& base = (*pyramid)[0];
+    base.width = frame.width;
+    base.height = frame.height;
+    base.luma.resize((size_t)frame.width * frame.height);
+    for (int y = 0; y < frame.height; ++y) {
+        const ChannelT* row = (const ChannelT*)WorldRow(src, y);
+        float* luma = base.luma.data() + (size_t)y * frame.width;
+        for (int x = 0; x < frame.width; ++x) {
+            luma[x] = Traits::Luma(row + x * 4);
+        }
+    }
+
+    while ((int)pyramid->size() < MOSH_FLOW_PYRAMID_LEVELS) {
+        const MoshFlowLevel& fine = pyramid->back();
+        if ((fine.width + 1) / 2 < MOSH_FLOW_MIN_LEVEL_SIZE || (fine.height + 1) / 2 < MOSH_FLOW_MIN_LEVEL_SIZE) {
+            break;
+        }
+        MoshFlowLevel coarse;
+        DownsampleLevel(fine, &coarse);
+        pyramid->push_back(std::move(coarse));
+    }
+
+    for (MoshFlowLevel& level : *pyramid) {
+        BuildLevelGradients(level);
+    }
+    frame.flowPyramid = pyramid;
+}
+
+// Cache a host world row by row in its own pixel format - float formats at half precision when
+// halfFloat is set - with its flow pyramid
+static void CopyFrameToAccumulated(const PF_LayerDef* src, AccumulatedFrame& dst,
+                                   MoshPixelFormat format = MoshPixelFormat::BGRA_32f, bool halfFloat = false) {
+    if (!src || !src->data) return;
+    MoshStatScope timer(MOSH_TIMER_COPY_FRAME);
+
+    dst.Allocate(src->width, src->height, format, halfFloat);
+    for (int y = 0; y < src->height; ++y) {
+        if (dst.halfFloat) {
+            FloatToHalfRow((const float*)WorldRow(src, y), dst.Row<uint16_t>(y), src->width * 4);
+        } else {
+            memcpy(dst.Row<uint8_t>(y), WorldRow(src, y), dst.rowBytes);
+        }
+    }
+    DispatchPixelFormat(format, [&](auto traits) {
+        BuildFlowPyramid<decltype(traits)>(src, dst);
+    });
+}
+
+// Just the flow pyramid and content hash of a host world, for streamed renders: once the flow
+// into the next frame is known, a past source frame's pixels are never read again
+static FrameSnapshot CopyFlowPyramid(const PF_LayerDef* src, int32_t frameIndex, MoshPixelFormat format) {
+    uint64_t contentHash = HashWorld(src, format);
+    MoshStatScope timer(MOSH_TIMER_COPY_FRAME);
+    std::shared_ptr<AccumulatedFrame> frame = std::make_shared<AccumulatedFrame>();
+    frame->frameIndex = frameIndex;
+    frame->contentHash = contentHash;
+    frame->width = src->width;
+    frame->height = src->height;
+    frame->format = format;
+    DispatchPixelFormat(format, [&](auto traits) {
+        BuildFlowPyramid<decltype(traits)>(src, *frame);
+    });
+    return frame;
+}
+
+// Pixels along the diagonal that stand in for a whole source frame in content checks
+#define MOSH_SOURCE_SAMPLES 16
+
+static void SamplePosition(int width, int height, int sample, int* x, int* y) {
+    *x = (width - 1) * sample / (MOSH_SOURCE_SAMPLES - 1);
+    *y = (height - 1) * sample / (MOSH_SOURCE_SAMPLES - 1);
+}
+
+// Cheap check that a full-frame source still matches what was cached for its frame number.
+// Catches upstream edits and effect copies on other layers that share this instance's cache.
+// Half-float caches compare the samples as they would have been stored.
+static bool SourceMatchesCached(const PF_LayerDef* src, MoshPixelFormat format, const AccumulatedFrame& cached) {
+    if (cached.format != format || cached.width != src->width || cached.height != src->height) {
+        return false;
+    }
+    int bytesPerPixel = MoshBytesPerPixel(format);
+    int cachedPixelBytes = cached.PixelBytes();
+    for (int i = 0; i < MOSH_SOURCE_SAMPLES; ++i) {
+        int x, y;
+        SamplePosition(src->width, src->height, i, &x, &y);
+        const uint8_t* stored = cached.IsPacked() ? cached.packedSamples.data() + (size_t)i * cachedPixelBytes
+                                                  : cached.Row<uint8_t>(y) + (size_t)x * cachedPixelBytes;
+        if (cached.halfFloat) {
+            uint16_t half[4];
+            FloatToHalfRow((const float*)WorldRow(src, y) + x * 4, half, 4);
+            if (memcmp(half, stored, sizeof(half))) {
+                return false;
+            }
+        } else if (memcmp(WorldRow(src, y) + x * bytesPerPixel, stored, bytesPerPixel)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Source frames by content, shared by every instance (created in GlobalSetup)
+static std::unique_ptr<MoshFrameRegistry> g_frameRegistry;
+
+static uint64_t RegistryKey(const AccumulatedFrame& frame) {
+    return MoshFrameRegistryKey(frame.contentHash, frame.width, frame.height, frame.format, frame.halfFloat);
+}
+
+// The cached form of a source frame: the one any instance already cached for the same content -
+// unpacked if there is one - else a new copy with its flow pyramid, registered for the next
+static FrameSnapshot CacheSourceFrame(const PF_LayerDef* src, int32_t frameIndex,
+                                      MoshPixelFormat format, bool halfFloat) {
+    uint64_t contentHash = HashWorld(src, format);
+    uint64_t key = MoshFrameRegistryKey(contentHash, src->width, src->height, format,
+                                        halfFloat && MoshIsFloatFormat(format));
+    if (g_frameRegistry) {
+        for (bool packed : { false, true }) {
+            FrameSnapshot shared = g_frameRegistry->Find(key, packed);
+            if (shared && SourceMatchesCached(src, format, *shared)) {
+                MoshStatAdd(MOSH_STAT_SHARED_HITS);
+                return shared;
+            }
+        }
+        MoshStatAdd(MOSH_STAT_SHARED_MISSES);
     }
+
+    std::shared_ptr<AccumulatedFrame> frame = std::make_shared<AccumulatedFrame>();
+    CopyFrameToAccumulated(src, *frame, format, halfFloat);
+    frame->frameIndex = frameIndex;
+    frame->contentHash = contentHash;
+    return g_frameRegistry ? g_frameRegistry->Insert(key, frame) : frame;
 }
 
 //==============================================================================
-// OPTICAL FLOW - Lucas-Kanade gradient-based
+// OPTICAL FLOW - pyramidal iterative Lucas-Kanade
 //==============================================================================
 
-static inline float GetGray(const float* data, int rowbytes, int width, int height, int x, int y) {
-    x = Clamp(x, 0, width - 1);
-    y = Clamp(y, 0, height - 1);
-    const float* row = (const float*)((const char*)data + y * rowbytes);
-    const float* px = row + x * 4;
-    return 0.299f * px[2] + 0.587f * px[1] + 0.114f * px[0];
+// Summed-area tables of the Lucas-Kanade products of one pyramid level of a frame pair (IxIx,
+// IyIy, IxIy, IxIt, IyIt, and ItIt, the zero-motion residual), built from the flow
+// planes. Entries are (width + 1) x (height + 1) with a zero first row and column, so the normal
+// equations of any window - any block size, overlapping windows, a window per pixel - cost four
+// lookups per product.
+struct StructureTensorTables {
+    enum { IXIX = 0, IYIY, IXIY, IXIT, IYIT, ITIT, PRODUCTS };
+
+    int width;
+    int height;
+    std::vector<double> sums;   // PRODUCTS interleaved per entry
+    std::vector<double> carries;    // row sums where each column stripe starts, while building
+
+    StructureTensorTables() : width(0), height(0) {}
+
+    // Rebuilding for a pair of the same size reuses the storage: only the zero border needs
+    // clearing and nothing ever writes to it. The table is filled in stripes of columns in
+    // parallel, each continuing every row's running sums from where the stripe to its left ends -
+    // found by a first parallel pass over the rows - so every entry is the same double as a
+    // single serial pass would compute. Without iterate threads that first pass would only cost
+    // time, so the whole width is one stripe.
+    PF_Err Build(PF_InData* in_data, const MoshFlowLevel& prev, const MoshFlowLevel& curr) {
+        size_t stride = (size_t)(prev.width + 1) * PRODUCTS;
+        if (prev.width != width || prev.height != height) {
+            width = prev.width;
+            height = prev.height;
+            sums.assign(stride * (height + 1), 0.0);
+        }
+
+        int stripeWidth = HostIterates(in_data) ? MOSH_FLOW_TABLE_STRIPE : std::max(width, 1);
+        int stripes = (width + stripeWidth - 1) / stripeWidth;
+        carries.resize((size_t)height * stripes * PRODUCTS);
+
+        // Sums one row's products over [x1, x2) into row[], writing row prefix + above[] to out
+        // when there is a table row to fill
+        auto sumRow = [&](int y, int x1, int x2, double row[PRODUCTS], const double* above, double* out) {
+            size_t offset = (size_t)y * width;
+            const float* gradX = prev.gradX.data() + offset;
+            const float* gradY = prev.gradY.data() + offset;
+            const float* prevLuma = prev.luma.data() + offset;
+            const float* currLuma = curr.luma.data() + offset;
+            double rowIxIx = row[IXIX], rowIyIy = row[IYIY], rowIxIy = row[IXIY];
+            double rowIxIt = row[IXIT], rowIyIt = row[IYIT], rowItIt = row[ITIT];
+            for (int x = x1; x < x2; ++x) {
+                float Ix = gradX[x];
+                float Iy = gradY[x];
+                float It = currLuma[x] - prevLuma[x];
+
+                rowIxIx += Ix * Ix;
+                rowIyIy += Iy * Iy;
+                rowIxIy += Ix * Iy;
+                rowIxIt += Ix * It;
+                rowIyIt += Iy * It;
+                rowItIt += It * It;
+
+                if (out) {
+                    out[IXIX] = above[IXIX] + rowIxIx;
+                    out[IYIY] = above[IYIY] + rowIyIy;
+                    out[IXIY] = above[IXIY] + rowIxIy;
+                    out[IXIT] = above[IXIT] + rowIxIt;
+                    out[IYIT] = above[IYIT] + rowIyIt;
+                    out[ITIT] = above[ITIT] + rowItIt;
+                    above += PRODUCTS;
+                    out += PRODUCTS;
+                }
+            }
+            row[IXIX] = rowIxIx; row[IYIY] = rowIyIy; row[IXIY] = rowIxIy;
+            row[IXIT] = rowIxIt; row[IYIT] = rowIyIt; row[ITIT] = rowItIt;
+        };
+
+        // Each row's running sums at the left edge of every stripe
+        auto rowCarries = [&](int y) {
+            double* carry = carries.data() + (size_t)y * stripes * PRODUCTS;
+            double row[PRODUCTS] = {};
+            for (int stripe = 0; stripe < stripes; ++stripe) {
+                std::copy(row, row + PRODUCTS, carry + (size_t)stripe * PRODUCTS);
+                if (stripe + 1 < stripes) {
+                    sumRow(y, stripe * stripeWidth, (stripe + 1) * stripeWidth, row, nullptr, nullptr);
+                }
+            }
+        };
+        PF_Err err = PF_Err_NONE;
+        if (stripes > 1) {
+            err = IterateOutputRows(in_data, height, rowCarries);
+        } else {
+            std::fill(carries.begin(), carries.end(), 0.0);
+        }
+        if (err) {
+            return err;
+        }
+
+        auto fillStripe = [&](int stripe) {
+            int x1 = stripe * stripeWidth;
+            int x2 = std::min(x1 + stripeWidth, width);
+            for (int y = 0; y < height; ++y) {
+                double row[PRODUCTS];
+                const double* carry = carries.data() + ((size_t)y * stripes + stripe) * PRODUCTS;
+                std::copy(carry, carry + PRODUCTS, row);
+                double* out = sums.data() + (size_t)(y + 1) * stride + (size_t)(x1 + 1) * PRODUCTS;
+                sumRow(y, x1, x2, row, out - stride, out);
+            }
+        };
+        return IterateGeneric(in_data, stripes, fillStripe);
+    }
+
+    // Sums of each product over [x1, x2) x [y1, y2)
+    void WindowSums(int x1, int y1, int x2, int y2, double out[PRODUCTS]) const {
+        size_t stride = (size_t)(width + 1) * PRODUCTS;
+        const double* topLeft = sums.data() + (size_t)y1 * stride + (size_t)x1 * PRODUCTS;
+        const double* topRight = sums.data() + (size_t)y1 * stride + (size_t)x2 * PRODUCTS;
+        const double* bottomLeft = sums.data() + (size_t)y2 * stride + (size_t)x1 * PRODUCTS;
+        const double* bottomRight = sums.data() + (size_t)y2 * stride + (size_t)x2 * PRODUCTS;
+        for (int i = 0; i < PRODUCTS; ++i) {
+            out[i] = bottomRight[i] - bottomLeft[i] - topRight[i] + topLeft[i];
+        }
+    }
+};
+
+// Lucas-Kanade sums for the row kernels below. The vector paths add into four float lanes per
+// sum, which Fold adds to the double totals - every MOSH_FLOW_LANE_ROWS rows, so float rounding
+// never spans more than a few rows of a window. Scalar pixels go straight into the totals.
+template<int N>
+struct FlowSums {
+    double total[N];
+    alignas(16) float lanes[N][4];
+
+    FlowSums() {
+        std::fill(total, total + N, 0.0);
+        std::fill(&lanes[0][0], &lanes[0][0] + N * 4, 0.0f);
+    }
+
+    void Fold() {
+        for (int k = 0; k < N; ++k) {
+            total[k] += ((double)lanes[k][0] + lanes[k][1]) + ((double)lanes[k][2] + lanes[k][3]);
+            lanes[k][0] = lanes[k][1] = lanes[k][2] = lanes[k][3] = 0.0f;
+        }
+    }
+};
+
+// sums[IXIX..ITIT] += the six products over count pixels of a row
+static void AccumulateProductsRow(const float* gradX, const float* gradY, const float* prevLuma,
+                                  const float* currLuma, int count,
+                                  FlowSums<StructureTensorTables::PRODUCTS>& sums) {
+    int i = 0;
+#if !MOSH_FLOW_EXACT && defined(__SSE2__)
+    float (*lanes)[4] = sums.lanes;
+    __m128 xx = _mm_load_ps(lanes[StructureTensorTables::IXIX]);
+    __m128 yy = _mm_load_ps(lanes[StructureTensorTables::IYIY]);
+    __m128 xy = _mm_load_ps(lanes[StructureTensorTables::IXIY]);
+    __m128 xt = _mm_load_ps(lanes[StructureTensorTables::IXIT]);
+    __m128 yt = _mm_load_ps(lanes[StructureTensorTables::IYIT]);
+    __m128 tt = _mm_load_ps(lanes[StructureTensorTables::ITIT]);
+    for (; i + 4 <= count; i += 4) {
+        __m128 Ix = _mm_loadu_ps(gradX + i);
+        __m128 Iy = _mm_loadu_ps(gradY + i);
+        __m128 It = _mm_sub_ps(_mm_loadu_ps(currLuma + i), _mm_loadu_ps(prevLuma + i));
+        xx = _mm_add_ps(xx, _mm_mul_ps(Ix, Ix));
+        yy = _mm_add_ps(yy, _mm_mul_ps(Iy, Iy));
+        xy = _mm_add_ps(xy, _mm_mul_ps(Ix, Iy));
+        xt = _mm_add_ps(xt, _mm_mul_ps(Ix, It));
+        yt = _mm_add_ps(yt, _mm_mul_ps(Iy, It));
+        tt = _mm_add_ps(tt, _mm_mul_ps(It, It));
+    }
+    _mm_store_ps(lanes[StructureTensorTables::IXIX], xx);
+    _mm_store_ps(lanes[StructureTensorTables::IYIY], yy);
+    _mm_store_ps(lanes[StructureTensorTables::IXIY], xy);
+    _mm_store_ps(lanes[StructureTensorTables::IXIT], xt);
+    _mm_store_ps(lanes[StructureTensorTables::IYIT], yt);
+    _mm_store_ps(lanes[StructureTensorTables::ITIT], tt);
+#elif !MOSH_FLOW_EXACT && defined(__ARM_NEON)
+    float (*lanes)[4] = sums.lanes;
+    float32x4_t xx = vld1q_f32(lanes[StructureTensorTables::IXIX]);
+    float32x4_t yy = vld1q_f32(lanes[StructureTensorTables::IYIY]);
+    float32x4_t xy = vld1q_f32(lanes[StructureTensorTables::IXIY]);
+    float32x4_t xt = vld1q_f32(lanes[StructureTensorTables::IXIT]);
+    float32x4_t yt = vld1q_f32(lanes[StructureTensorTables::IYIT]);
+    float32x4_t tt = vld1q_f32(lanes[StructureTensorTables::ITIT]);
+    for (; i + 4 <= count; i += 4) {
+        float32x4_t Ix = vld1q_f32(gradX + i);
+        float32x4_t Iy = vld1q_f32(gradY + i);
+        float32x4_t It = vsubq_f32(vld1q_f32(currLuma + i), vld1q_f32(prevLuma + i));
+        xx = vmlaq_f32(xx, Ix, Ix);
+        yy = vmlaq_f32(yy, Iy, Iy);
+        xy = vmlaq_f32(xy, Ix, Iy);
+        xt = vmlaq_f32(xt, Ix, It);
+        yt = vmlaq_f32(yt, Iy, It);
+        tt = vmlaq_f32(tt, It, It);
+    }
+    vst1q_f32(lanes[StructureTensorTables::IXIX], xx);
+    vst1q_f32(lanes[StructureTensorTables::IYIY], yy);
+    vst1q_f32(lanes[StructureTensorTables::IXIY], xy);
+    vst1q_f32(lanes[StructureTensorTables::IXIT], xt);
+    vst1q_f32(lanes[StructureTensorTables::IYIT], yt);
+    vst1q_f32(lanes[StructureTensorTables::ITIT], tt);
+#endif
+    double* total = sums.total;
+    for (; i < count; ++i) {
+        float Ix = gradX[i];
+        float Iy = gradY[i];
+        float It = currLuma[i] - prevLuma[i];
+        total[StructureTensorTables::IXIX] += Ix * Ix;
+        total[StructureTensorTables::IYIY] += Iy * Iy;
+        total[StructureTensorTables::IXIY] += Ix * Iy;
+        total[StructureTensorTables::IXIT] += Ix * It;
+        total[StructureTensorTables::IYIT] += Iy * It;
+        total[StructureTensorTables::ITIT] += It * It;
+    }
+}
+
+// sums += (Ix*It, Iy*It, It*It) over count pixels of a row, It sampling the rows curr0 and curr1
+// bilinearly at (fx, fy); both rows are read up to curr[count]
+static void AccumulateMismatchRow(const float* gradX, const float* gradY, const float* prevLuma,
+                                  const float* curr0, const float* curr1, int count,
+                                  float fx, float fy, FlowSums<3>& sums) {
+    int i = 0;
+#if !MOSH_FLOW_EXACT && defined(__SSE2__)
+    __m128 vfx = _mm_set1_ps(fx), vfy = _mm_set1_ps(fy);
+    __m128 xt = _mm_load_ps(sums.lanes[0]);
+    __m128 yt = _mm_load_ps(sums.lanes[1]);
+    __m128 tt = _mm_load_ps(sums.lanes[2]);
+    for (; i + 4 <= count; i += 4) {
+        __m128 a0 = _mm_loadu_ps(curr0 + i), a1 = _mm_loadu_ps(curr0 + i + 1);
+        __m128 b0 = _mm_loadu_ps(curr1 + i), b1 = _mm_loadu_ps(curr1 + i + 1);
+        __m128 top = _mm_add_ps(a0, _mm_mul_ps(_mm_sub_ps(a1, a0), vfx));
+        __m128 bottom = _mm_add_ps(b0, _mm_mul_ps(_mm_sub_ps(b1, b0), vfx));
+        __m128 It = _mm_sub_ps(_mm_add_ps(top, _mm_mul_ps(_mm_sub_ps(bottom, top), vfy)), _mm_loadu_ps(prevLuma + i));
+        xt = _mm_add_ps(xt, _mm_mul_ps(_mm_loadu_ps(gradX + i), It));
+        yt = _mm_add_ps(yt, _mm_mul_ps(_mm_loadu_ps(gradY + i), It));
+        tt = _mm_add_ps(tt, _mm_mul_ps(It, It));
+    }
+    _mm_store_ps(sums.lanes[0], xt);
+    _mm_store_ps(sums.lanes[1], yt);
+    _mm_store_ps(sums.lanes[2], tt);
+#elif !MOSH_FLOW_EXACT && defined(__ARM_NEON)
+    float32x4_t xt = vld1q_f32(sums.lanes[0]);
+    float32x4_t yt = vld1q_f32(sums.lanes[1]);
+    float32x4_t tt = vld1q_f32(sums.lanes[2]);
+    for (; i + 4 <= count; i += 4) {
+        float32x4_t a0 = vld1q_f32(curr0 + i), a1 = vld1q_f32(curr0 + i + 1);
+        float32x4_t b0 = vld1q_f32(curr1 + i), b1 = vld1q_f32(curr1 + i + 1);
+        float32x4_t top = vmlaq_n_f32(a0, vsubq_f32(a1, a0), fx);
+        float32x4_t bottom = vmlaq_n_f32(b0, vsubq_f32(b1, b0), fx);
+        float32x4_t It = vsubq_f32(vmlaq_n_f32(top, vsubq_f32(bottom, top), fy), vld1q_f32(prevLuma + i));
+        xt = vmlaq_f32(xt, vld1q_f32(gradX + i), It);
+        yt = vmlaq_f32(yt, vld1q_f32(gradY + i), It);
+        tt = vmlaq_f32(tt, It, It);
+    }
+    vst1q_f32(sums.lanes[0], xt);
+    vst1q_f32(sums.lanes[1], yt);
+    vst1q_f32(sums.lanes[2], tt);
+#endif
+    for (; i < count; ++i) {
+        float top = curr0[i] + (curr0[i + 1] - curr0[i]) * fx;
+        float bottom = curr1[i] + (curr1[i + 1] - curr1[i]) * fx;
+        float It = top + (bottom - top) * fy - prevLuma[i];
+        sums.total[0] += gradX[i] * It;
+        sums.total[1] += gradY[i] * It;
+        sums.total[2] += It * It;
+    }
+}
+
+// The same sums as StructureTensorTables::WindowSums, straight from the flow planes - cheaper when
+// only a few windows of a level are ever asked for
+static void WindowProducts(const MoshFlowLevel& prev, const MoshFlowLevel& curr,
+                           int x1, int y1, int x2, int y2, double out[StructureTensorTables::PRODUCTS]) {
+    FlowSums<StructureTensorTables::PRODUCTS> sums;
+    for (int y = y1; y < y2; ++y) {
+        size_t row = (size_t)y * prev.width + x1;
+        AccumulateProductsRow(prev.gradX.data() + row, prev.gradY.data() + row, prev.luma.data() + row,
+                              curr.luma.data() + row, x2 - x1, sums);
+        if ((y - y1) % MOSH_FLOW_LANE_ROWS == MOSH_FLOW_LANE_ROWS - 1) {
+            sums.Fold();
+        }
+    }
+    sums.Fold();
+    std::copy(sums.total, sums.total + StructureTensorTables::PRODUCTS, out);
+}
+
+// Mismatch vector (sum Ix*It, sum Iy*It) and residual (sum It*It) of window [x1, x2) x [y1, y2)
+// of prev against curr displaced by (dx, dy). The fraction is the same for every pixel, so the
+// bilinear weights are too; columns whose taps fall outside curr are clamped one by one.
+static void DisplacedMismatch(const MoshFlowLevel& prev, const MoshFlowLevel& curr,
+                              int x1, int y1, int x2, int y2, float dx, float dy,
+                              double* sumIxIt, double* sumIyIt, double* sumItIt) {
+    int ix = (int)floorf(dx);
+    int iy = (int)floorf(dy);
+    float fx = dx - ix;
+    float fy = dy - iy;
+    int width = curr.width;
+    int height = curr.height;
+    int inner1 = Clamp(-ix, x1, x2);
+    int inner2 = Clamp(width - 1 - ix, inner1, x2);
+
+    FlowSums<3> sums;
+    double* mismatch = sums.total;
+    for (int y = y1; y < y2; ++y) {
+        size_t row = (size_t)y * width;
+        const float* gradX = prev.gradX.data() + row;
+        const float* gradY = prev.gradY.data() + row;
+        const float* prevLuma = prev.luma.data() + row;
+        const float* curr0 = curr.luma.data() + (size_t)Clamp(y + iy, 0, height - 1) * width;
+        const float* curr1 = curr.luma.data() + (size_t)Clamp(y + iy + 1, 0, height - 1) * width;
+        auto clampedPixel = [&](int x) {
+            int sx0 = Clamp(x + ix, 0, width - 1);
+            int sx1 = Clamp(x + ix + 1, 0, width - 1);
+            float top = curr0[sx0] + (curr0[sx1] - curr0[sx0]) * fx;
+            float bottom = curr1[sx0] + (curr1[sx1] - curr1[sx0]) * fx;
+            float It = top + (bottom - top) * fy - prevLuma[x];
+            mismatch[0] += gradX[x] * It;
+            mismatch[1] += gradY[x] * It;
+            mismatch[2] += It * It;
+        };
+
+        for (int x = x1; x < inner1; ++x) {
+            clampedPixel(x);
+        }
+        if (inner2 > inner1) {
+            AccumulateMismatchRow(gradX + inner1, gradY + inner1, prevLuma + inner1,
+                                  curr0 + inner1 + ix, curr1 + inner1 + ix, inner2 - inner1, fx, fy, sums);
+        }
+        for (int x = inner2; x < x2; ++x) {
+            clampedPixel(x);
+        }
+        if ((y - y1) % MOSH_FLOW_LANE_ROWS == MOSH_FLOW_LANE_ROWS - 1) {
+            sums.Fold();
+        }
+    }
+    sums.Fold();
+    *sumIxIt = mismatch[0];
+    *sumIyIt = mismatch[1];
+    *sumItIt = mismatch[2];
+}
+
+// Up to iterations Gauss-Newton steps refining (dx, dy) for window [x1, x2) x [y1, y2) of one
+// level, sums being the window's products. The normal matrix depends on prev only, so it comes
+// from the sums; so does the mismatch while the guess is still zero. Returns the squared length
+// of the last step, residual receiving the sum of It*It that step saw; both are zero when the
+// window is textureless and the guess was left alone.
+static double RefineBlockFlow(const MoshFlowLevel& prevLevel, const MoshFlowLevel& currLevel,
+                              int x1, int y1, int x2, int y2,
+                              const double sums[StructureTensorTables::PRODUCTS],
+                              int iterations, float maxMotion, float* dx, float* dy, double* residual) {
+    double sumIxIx = sums[StructureTensorTables::IXIX];
+    double sumIyIy = sums[StructureTensorTables::IYIY];
+    double sumIxIy = sums[StructureTensorTables::IXIY];
+    double det = sumIxIx * sumIyIy - sumIxIy * sumIxIy;
+    *residual = 0;
+    if (fabs(det) < 1e-6) {
+        return 0;
+    }
+
+    double step = 0;
+    for (int iteration = 0; iteration < iterations; ++iteration) {
+        double sumIxIt, sumIyIt;
+        if (*dx == 0 && *dy == 0) {
+            sumIxIt = sums[StructureTensorTables::IXIT];
+            sumIyIt = sums[StructureTensorTables::IYIT];
+            *residual = sums[StructureTensorTables::ITIT];
+        } else {
+            DisplacedMismatch(prevLevel, currLevel, x1, y1, x2, y2, *dx, *dy, &sumIxIt, &sumIyIt, residual);
+        }
+
+        double u = (-sumIxIt * sumIyIy + sumIyIt * sumIxIy) / det;
+        double v = (-sumIyIt * sumIxIx + sumIxIt * sumIxIy) / det;
+        *dx = Clamp(*dx + (float)u, -maxMotion, maxMotion);
+        *dy = Clamp(*dy + (float)v, -maxMotion, maxMotion);
+        step = u * u + v * v;
+        if (step < MOSH_FLOW_MIN_STEP * MOSH_FLOW_MIN_STEP) {
+            break;
+        }
+    }
+    return step;
 }
 
-// Compute optical flow for a block using Lucas-Kanade
+// Lucas-Kanade for the block [x1, x2) x [y1, y2), coarse to fine: at each pyramid level the guess
+// from the level above (doubled) is refined by a few steps comparing the block's window in prev
+// with curr sampled at the displaced window. Coarse levels widen the window to
+// MOSH_FLOW_MIN_HALF_WINDOW so small blocks stay solvable. The pyramid stops at lastLevel (0 for
+// full resolution), where the estimate is scaled back up; only the tables from there up are read.
 static void ComputeBlockFlow(
-    const float* prev, int prevRowbytes,
-    const float* curr, int currRowbytes,
-    int width, int height,
-    int blockX, int blockY, int blockSize,
+    const std::vector<StructureTensorTables>& tables,
+    int lastLevel,
+    const AccumulatedFrame& prev,
+    const AccumulatedFrame& curr,
+    int x1, int y1, int x2, int y2,
     float* outMvX, float* outMvY)
 {
-    double sumIxIx = 0, sumIyIy = 0, sumIxIy = 0;
-    double sumIxIt = 0, sumIyIt = 0;
+    float dx = 0, dy = 0;
+    for (int l = (int)tables.size() - 1; l >= lastLevel; --l) {
+        const MoshFlowLevel& prevLevel = prev.FlowLevel(l);
+        if (l + 1 < (int)tables.size()) {
+            dx *= 2;
+            dy *= 2;
+        }
 
-    int y1 = blockY;
-    int y2 = (blockY + blockSize < height) ? blockY + blockSize : height;
-    int x1 = blockX;
-    int x2 = (blockX + blockSize < width) ? blockX + blockSize : width;
+        // The block itself at full resolution, a window around its centre further up
+        int wx1 = x1, wy1 = y1, wx2 = x2, wy2 = y2;
+        if (l > 0) {
+            float scale = 1.0f / (1 << l);
+            float cx = (x1 + x2) * 0.5f * scale;
+            float cy = (y1 + y2) * 0.5f * scale;
+            float halfX = std::max((x2 - x1) * 0.5f * scale, (float)MOSH_FLOW_MIN_HALF_WINDOW);
+            float halfY = std::max((y2 - y1) * 0.5f * scale, (float)MOSH_FLOW_MIN_HALF_WINDOW);
+            wx1 = Clamp((int)floorf(cx - halfX), 0, prevLevel.width - 1);
+            wy1 = Clamp((int)floorf(cy - halfY), 0, prevLevel.height - 1);
+            wx2 = Clamp((int)ceilf(cx + halfX), wx1 + 1, prevLevel.width);
+            wy2 = Clamp((int)ceilf(cy + halfY), wy1 + 1, prevLevel.height);
+        }
 
-    for (int y = y1; y < y2; ++y) {
-        for (int x = x1; x < x2; ++x) {
-            float Ix = (GetGray(prev, prevRowbytes, width, height, x+1, y) -
-                        GetGray(prev, prevRowbytes, width, height, x-1, y)) * 0.5f;
-            float Iy = (GetGray(prev, prevRowbytes, width, height, x, y+1) -
-                        GetGray(prev, prevRowbytes, width, height, x, y-1)) * 0.5f;
-            float It = GetGray(curr, currRowbytes, width, height, x, y) -
-                       GetGray(prev, prevRowbytes, width, height, x, y);
+        // A textureless window keeps the coarser estimate
+        double sums[StructureTensorTables::PRODUCTS];
+        double residual;
+        tables[l].WindowSums(wx1, wy1, wx2, wy2, sums);
+        RefineBlockFlow(prevLevel, curr.FlowLevel(l), wx1, wy1, wx2, wy2, sums,
+                        MOSH_FLOW_ITERATIONS, MOSH_FLOW_MAX_MOTION / (1 << l), &dx, &dy, &residual);
+    }
+
+    *outMvX = dx * (1 << lastLevel);
+    *outMvY = dy * (1 << lastLevel);
+}
+
+// Lucas-Kanade for the block warm-started from the previous pair's vector (in pixels): motion
+// changes little from one pair to the next, so a couple of full-resolution steps replace the
+// pyramid. False when the prediction failed - the steps did not settle, or the residual did not
+// clearly beat no motion at all - and the block needs ComputeBlockFlow. So is a block with the
+// aperture problem (texture in one direction only), which fits any motion along its edges and
+// only the pyramid's wider windows pin down. Draft renders take the steps on pyramid level
+// `level` instead of full resolution; the guess and the result stay in full-resolution pixels.
+static bool WarmBlockFlow(
+    const AccumulatedFrame& prev,
+    const AccumulatedFrame& curr,
+    int level,
+    int x1, int y1, int x2, int y2,
+    float guessX, float guessY,
+    float* outMvX, float* outMvY)
+{
+    const MoshFlowLevel& prevLevel = prev.FlowLevel(level);
+    const MoshFlowLevel& currLevel = curr.FlowLevel(level);
+    int scale = 1 << level;
+    if (level > 0) {
+        // Levels round their size up, so the rounded-up block end stays inside
+        x1 >>= level;
+        y1 >>= level;
+        x2 = (x2 + scale - 1) >> level;
+        y2 = (y2 + scale - 1) >> level;
+    }
+
+    double sums[StructureTensorTables::PRODUCTS];
+    WindowProducts(prevLevel, currLevel, x1, y1, x2, y2, sums);
+    double trace = sums[StructureTensorTables::IXIX] + sums[StructureTensorTables::IYIY];
+    double det = sums[StructureTensorTables::IXIX] * sums[StructureTensorTables::IYIY] -
+                 sums[StructureTensorTables::IXIY] * sums[StructureTensorTables::IXIY];
+    if (det < MOSH_FLOW_WARM_MIN_CORNER * trace * trace || det < 1e-6) {
+        return false;
+    }
+
+    float dx = guessX / scale, dy = guessY / scale;
+    double residual;
+    double step = RefineBlockFlow(prevLevel, currLevel, x1, y1, x2, y2, sums,
+                                  MOSH_FLOW_WARM_ITERATIONS, MOSH_FLOW_MAX_MOTION / scale, &dx, &dy, &residual);
+    double floor = MOSH_FLOW_RESIDUAL_FLOOR * (x2 - x1) * (y2 - y1);
+    if (step >= MOSH_FLOW_MIN_STEP * MOSH_FLOW_MIN_STEP ||
+        residual > std::max(sums[StructureTensorTables::ITIT] * MOSH_FLOW_WARM_ACCEPT, floor)) {
+        return false;
+    }
+
+    *outMvX = dx * scale;
+    *outMvY = dy * scale;
+    return true;
+}
+
+// Flow for every block of a frame pair (prev -> curr); both need their flow pyramids. predicted,
+// the field of the pair before when it is known at this size, warm-starts each block, and the
+// tables are only built if some block falls back to the pyramid. Block rows run in parallel, so
+// the field is the same whatever the thread count. tables is scratch space, rebuilt for this
+// pair - pass the same one for every pair of a range. lastLevel is the finest pyramid level the
+// flow reads: 0 at full quality, MOSH_FLOW_DRAFT_LEVEL for draft renders.
+static PF_Err ComputeMotionField(
+    PF_InData* in_data,
+    const AccumulatedFrame& prev,
+    const AccumulatedFrame& curr,
+    int blockSize,
+    int lastLevel,
+    const MotionField* predicted,
+    std::vector<StructureTensorTables>* tables,
+    MotionField* field)
+{
+    MoshStatScope timer(MOSH_TIMER_MOTION_FIELD);
+    field->Allocate(prev.width, prev.height, blockSize);
+    field->frameIndex = curr.frameIndex;
+
+    if (predicted && !predicted->Matches(prev.width, prev.height, blockSize)) {
+        predicted = nullptr;
+    }
+    size_t levels = std::min(prev.FlowLevels(), curr.FlowLevels());
+    lastLevel = std::min(lastLevel, (int)levels - 1);
+
+    auto blockRect = [&](int32_t bx, int32_t by, int* x1, int* y1, int* x2, int* y2) {
+        *x1 = bx * blockSize;
+        *y1 = by * blockSize;
+        *x2 = std::min(*x1 + blockSize, (int)prev.width);
+        *y2 = std::min(*y1 + blockSize, (int)prev.height);
+    };
+    auto store = [&](size_t index, float mvX, float mvY) {
+        MotionVector& mv = field->vectors[index];
+        mv.dx = (int16_t)lroundf(mvX * MOSH_MV_UNITS_PER_PIXEL);
+        mv.dy = (int16_t)lroundf(mvY * MOSH_MV_UNITS_PER_PIXEL);
+    };
+
+    // Warm pass; the blocks it could not settle stay pending for the pyramid
+    PF_Err err = PF_Err_NONE;
+    std::vector<uint8_t> pending(field->vectors.size(), predicted ? 0 : 1);
+    if (predicted) {
+        auto warmRow = [&](int by) {
+            for (int32_t bx = 0; bx < field->blocksX; ++bx) {
+                int x1, y1, x2, y2;
+                blockRect(bx, by, &x1, &y1, &x2, &y2);
+                size_t index = field->GetVectorIndex(bx, by);
+                const MotionVector& guess = predicted->vectors[index];
+                float mvX, mvY;
+                if (WarmBlockFlow(prev, curr, lastLevel, x1, y1, x2, y2,
+                                  (float)guess.dx / MOSH_MV_UNITS_PER_PIXEL,
+                                  (float)guess.dy / MOSH_MV_UNITS_PER_PIXEL, &mvX, &mvY)) {
+                    store(index, mvX, mvY);
+                } else {
+                    pending[index] = 1;
+                }
+            }
+        };
+        err = IterateGeneric(in_data, field->blocksY, warmRow);
+    }
+
+    size_t coldBlocks = std::count(pending.begin(), pending.end(), 1);
+    if (predicted) {
+        MoshStatAdd(MOSH_STAT_FLOW_WARM_BLOCKS, pending.size() - coldBlocks);
+        MoshStatAdd(MOSH_STAT_FLOW_COLD_FALLBACKS, coldBlocks);
+    }
+    if (err || coldBlocks == 0) {
+        return err;
+    }
+
+    tables->resize(levels);
+    for (size_t l = lastLevel; l < levels && !err; ++l) {
+        err = (*tables)[l].Build(in_data, prev.FlowLevel(l), curr.FlowLevel(l));
+    }
+    if (err) {
+        return err;
+    }
+
+    auto coldRow = [&](int by) {
+        for (int32_t bx = 0; bx < field->blocksX; ++bx) {
+            size_t index = field->GetVectorIndex(bx, by);
+            if (pending[index]) {
+                int x1, y1, x2, y2;
+                blockRect(bx, by, &x1, &y1, &x2, &y2);
+                float mvX, mvY;
+                ComputeBlockFlow(*tables, lastLevel, prev, curr, x1, y1, x2, y2, &mvX, &mvY);
+                store(index, mvX, mvY);
+            }
+        }
+    };
+    return IterateGeneric(in_data, field->blocksY, coldRow);
+}
+
+// Warp src by a motion field into dst (exact Python port), block rows in parallel - each row of
+// blocks writes only its own rows of dst. Blocks move by their vectors rounded to whole pixels,
+// so the warp is a pure copy at any cached depth and 8-bit caches lose nothing. Neighbouring
+// blocks moving alike (still backgrounds, draft fields) are copied as one span while no clamping
+// sets them apart. dst gets src's pixels only.
+static PF_Err ApplyMotionField(PF_InData* in_data, const AccumulatedFrame& src, const MotionField& field,
+                               AccumulatedFrame* dst) {
+    MoshStatScope timer(MOSH_TIMER_WARP);
+    int width = src.width;
+    int height = src.height;
+    int blockSize = field.blockSize;
+    size_t pixelBytes = src.PixelBytes();
+
+    dst->width = width;
+    dst->height = height;
+    dst->rowBytes = src.rowBytes;
+    dst->format = src.format;
+    dst->halfFloat = src.halfFloat;
+    dst->valid = src.valid;
+    dst->pixelData.resize(src.pixelData.size());
+
+    auto warpRow = [&](int by) {
+        int y1 = by * blockSize;
+        int y2 = std::min(y1 + blockSize, height);
+        int blockH = y2 - y1;
+        for (int32_t bx = 0; bx < field.blocksX;) {
+            const MotionVector& mv = field.vectors[field.GetVectorIndex(bx, by)];
+            int dx = mv.PixelDx();
+
+            // Extend the span while the next block has the same vector and its source is in frame
+            int x1 = bx * blockSize;
+            int x2 = std::min(x1 + blockSize, width);
+            for (++bx; bx < field.blocksX && x1 + dx >= 0 && x2 + dx <= width; ++bx) {
+                const MotionVector& next = field.vectors[field.GetVectorIndex(bx, by)];
+                int nextX2 = std::min(x2 + blockSize, width);
+                if (next.dx != mv.dx || next.dy != mv.dy || nextX2 + dx > width) {
+                    break;
+                }
+                x2 = nextX2;
+            }
+            int spanW = x2 - x1;
+
+            // Source position in src (clamped), to the nearest whole pixel
+            int sy1 = Clamp(y1 + mv.PixelDy(), 0, height - blockH);
+            int sx1 = Clamp(x1 + dx, 0, width - spanW);
+
+            for (int py = 0; py < blockH; ++py) {
+                memcpy(dst->Row<uint8_t>(y1 + py) + x1 * pixelBytes,
+                       src.Row<uint8_t>(sy1 + py) + sx1 * pixelBytes, spanW * pixelBytes);
+            }
+        }
+    };
+    return IterateGeneric(in_data, field.blocksY, warpRow);
+}
+
+// Resample a motion field to another render resolution: each block takes the vector of the
+// source block under its centre, scaled by the size ratio
+static void ScaleMotionField(const MotionField& src, int width, int height, int blockSize, MotionField* dst) {
+    if (src.Matches(width, height, blockSize)) {
+        *dst = src;
+        return;
+    }
+
+    dst->Allocate(width, height, blockSize);
+    dst->frameIndex = src.frameIndex;
+    float scaleX = (float)width / src.width;
+    float scaleY = (float)height / src.height;
+
+    for (int32_t by = 0; by < dst->blocksY; ++by) {
+        int32_t srcBy = Clamp((int32_t)((by + 0.5f) * blockSize / scaleY) / src.blockSize, 0, src.blocksY - 1);
+        for (int32_t bx = 0; bx < dst->blocksX; ++bx) {
+            int32_t srcBx = Clamp((int32_t)((bx + 0.5f) * blockSize / scaleX) / src.blockSize, 0, src.blocksX - 1);
+            const MotionVector& from = src.vectors[src.GetVectorIndex(srcBx, srcBy)];
+            MotionVector& mv = dst->vectors[dst->GetVectorIndex(bx, by)];
+            mv.dx = (int16_t)lroundf(from.dx * scaleX);
+            mv.dy = (int16_t)lroundf(from.dy * scaleY);
+        }
+    }
+}
+
+// Scale fields saved at another resolution in place (see ScaleMotionField)
+static void ScaleMotionFields(std::vector<MotionField>& fields, int width, int height, int blockSize) {
+    for (MotionField& field : fields) {
+        MotionField scaled;
+        ScaleMotionField(field, width, height, blockSize, &scaled);
+        field = std::move(scaled);
+    }
+}
+
+// Pixel rectangle [left, right) x [top, bottom)
+struct MoshRect {
+    int left, top, right, bottom;
+
+    bool IsEmpty() const { return left >= right || top >= bottom; }
+
+    void Include(int x1, int y1, int x2, int y2) {
+        if (IsEmpty()) {
+            *this = { x1, y1, x2, y2 };
+        } else {
+            left = std::min(left, x1);
+            top = std::min(top, y1);
+            right = std::max(right, x2);
+            bottom = std::max(bottom, y2);
+        }
+    }
+};
+
+// Calls fn(x1, y1, x2, y2, sx1, sy1) for every block of field that intersects rect: the block's
+// destination pixels and the top-left of the pixels ApplyMotionField copies into it
+template<typename Fn>
+static void ForEachBlockIn(const MotionField& field, const MoshRect& rect, Fn&& fn) {
+    int bs = field.blockSize;
+    int bx1 = std::max(rect.left / bs, 0), bx2 = std::min((rect.right + bs - 1) / bs, (int)field.blocksX);
+    int by1 = std::max(rect.top / bs, 0), by2 = std::min((rect.bottom + bs - 1) / bs, (int)field.blocksY);
+    for (int by = by1; by < by2; ++by) {
+        for (int bx = bx1; bx < bx2; ++bx) {
+            int x1 = bx * bs, y1 = by * bs;
+            int x2 = std::min(x1 + bs, (int)field.width), y2 = std::min(y1 + bs, (int)field.height);
+            const MotionVector& mv = field.vectors[field.GetVectorIndex(bx, by)];
+            fn(x1, y1, x2, y2,
+               Clamp(x1 + mv.PixelDx(), 0, (int)field.width - (x2 - x1)),
+               Clamp(y1 + mv.PixelDy(), 0, (int)field.height - (y2 - y1)));
+        }
+    }
+}
+
+// The pixels of roi in the last frame of the fields' warp chain, without warping whole frames:
+// walk the fields backwards to find the region of each earlier frame that feeds roi, then warp
+// forwards copying only the blocks in those regions. out receives just roi.
+static void WarpRegion(const AccumulatedFrame& reference, const std::vector<MotionField>& fields,
+                       const MoshRect& roi, AccumulatedFrame* out) {
+    MoshStatScope timer(MOSH_TIMER_REGION_WARP);
+    size_t pixelBytes = reference.PixelBytes();
+    int32_t count = (int32_t)fields.size();
+
+    // needed[i] is the region of the frame after fields[i - 1] that the rest of the chain reads;
+    // bounds covers those plus the whole blocks written into them
+    std::vector<MoshRect> needed(count + 1);
+    needed[count] = roi;
+    MoshRect bounds = roi;
+    for (int32_t i = count - 1; i >= 0; --i) {
+        MoshRect source = { 0, 0, 0, 0 };
+        ForEachBlockIn(fields[i], needed[i + 1], [&](int x1, int y1, int x2, int y2, int sx1, int sy1) {
+            source.Include(sx1, sy1, sx1 + (x2 - x1), sy1 + (y2 - y1));
+            bounds.Include(x1, y1, x2, y2);
+        });
+        needed[i] = source;
+        if (!source.IsEmpty()) {
+            bounds.Include(source.left, source.top, source.right, source.bottom);
+        }
+    }
+
+    // Ping-pong between two buffers the size of bounds; only the needed regions are ever written
+    // or read
+    size_t rowBytes = (size_t)(bounds.right - bounds.left) * pixelBytes;
+    size_t bufferBytes = rowBytes * (bounds.bottom - bounds.top);
+    std::unique_ptr<uint8_t[]> front(new uint8_t[bufferBytes]);
+    std::unique_ptr<uint8_t[]> back(new uint8_t[bufferBytes]);
+    auto at = [&](uint8_t* buffer, int x, int y) {
+        return buffer + (size_t)(y - bounds.top) * rowBytes + (x - bounds.left) * pixelBytes;
+    };
+    const MoshRect& first = needed[0];
+    for (int y = first.top; y < first.bottom; ++y) {
+        memcpy(at(front.get(), first.left, y),
+               reference.Row<uint8_t>(y) + first.left * pixelBytes, (first.right - first.left) * pixelBytes);
+    }
+    for (int32_t i = 0; i < count; ++i) {
+        ForEachBlockIn(fields[i], needed[i + 1], [&](int x1, int y1, int x2, int y2, int sx1, int sy1) {
+            for (int py = 0; py < y2 - y1; ++py) {
+                memcpy(at(back.get(), x1, y1 + py), at(front.get(), sx1, sy1 + py), (x2 - x1) * pixelBytes);
+            }
+        });
+        std::swap(front, back);
+    }
+
+    out->Allocate(roi.right - roi.left, roi.bottom - roi.top, reference.format, reference.halfFloat);
+    for (int y = 0; y < out->height; ++y) {
+        memcpy(out->Row<uint8_t>(y), at(front.get(), roi.left, roi.top + y), out->rowBytes);
+    }
+}
+
+//==============================================================================
+// MOTION FIELD SERIALIZATION - see MoshSequenceDataFlat
+//==============================================================================
+
+static inline void PutVarint(std::vector<uint8_t>& out, uint32_t v) {
+    while (v >= 0x80) {
+        out.push_back((uint8_t)(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back((uint8_t)v);
+}
+
+static inline void PutZigzag(std::vector<uint8_t>& out, int32_t v) {
+    PutVarint(out, ((uint32_t)v << 1) ^ (uint32_t)(v >> 31));
+}
+
+static inline bool GetVarint(const uint8_t*& p, const uint8_t* end, uint32_t* v) {
+    *v = 0;
+    for (int shift = 0; shift < 35 && p < end; shift += 7) {
+        uint8_t b = *p++;
+        *v |= (uint32_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static inline bool GetZigzag(const uint8_t*& p, const uint8_t* end, int32_t* v) {
+    uint32_t u;
+    if (!GetVarint(p, end, &u)) {
+        return false;
+    }
+    *v = (int32_t)(u >> 1) ^ -(int32_t)(u & 1);
+    return true;
+}
+
+static void EncodeMotionField(const MotionField& field, std::vector<uint8_t>& out) {
+    PutZigzag(out, field.frameIndex);
+    PutVarint(out, (uint32_t)field.width);
+    PutVarint(out, (uint32_t)field.height);
+    PutVarint(out, (uint32_t)field.blockSize);
+
+    int32_t prevDx = 0, prevDy = 0;
+    for (const MotionVector& mv : field.vectors) {
+        PutZigzag(out, mv.dx - prevDx);
+        PutZigzag(out, mv.dy - prevDy);
+        prevDx = mv.dx;
+        prevDy = mv.dy;
+    }
+}
+
+// Returns false on truncated or implausible data
+static bool DecodeMotionField(const uint8_t*& p, const uint8_t* end, MotionField* field) {
+    int32_t frameIndex;
+    uint32_t width, height, blockSize;
+    if (!GetZigzag(p, end, &frameIndex) || !GetVarint(p, end, &width) ||
+        !GetVarint(p, end, &height) || !GetVarint(p, end, &blockSize)) {
+        return false;
+    }
+    if (width == 0 || height == 0 || width > 65536 || height > 65536 ||
+        blockSize == 0 || blockSize > 256) {
+        return false;
+    }
+
+    field->Allocate((int32_t)width, (int32_t)height, (int32_t)blockSize);
+    field->frameIndex = frameIndex;
+
+    // Every vector takes at least two bytes - reject counts the payload can't hold
+    if ((size_t)(end - p) < field->vectors.size() * 2) {
+        return false;
+    }
+
+    int32_t dx = 0, dy = 0;
+    for (MotionVector& mv : field->vectors) {
+        int32_t ddx, ddy;
+        if (!GetZigzag(p, end, &ddx) || !GetZigzag(p, end, &ddy) ||
+            ddx < -UINT16_MAX || ddx > UINT16_MAX || ddy < -UINT16_MAX || ddy > UINT16_MAX) {
+            return false;
+        }
+        dx += ddx;
+        dy += ddy;
+        if (dx < INT16_MIN || dx > INT16_MAX || dy < INT16_MIN || dy > INT16_MAX) {
+            return false;
+        }
+        mv.dx = (int16_t)dx;
+        mv.dy = (int16_t)dy;
+    }
+    return true;
+}
+
+//==============================================================================
+// EFFECT CALLBACKS
+//==============================================================================
+
+static PF_Err About(PF_InData* in_data, PF_OutData* out_data, PF_ParamDef* params[], PF_LayerDef* output) {
+    snprintf(out_data->return_msg, sizeof(out_data->return_msg),
+        "%s v%d.%d\r%s", PLUGIN_NAME, PLUGIN_MAJOR_VERSION, PLUGIN_MINOR_VERSION, PLUGIN_DESCRIPTION);
+    return PF_Err_NONE;
+}
+
+// Motion fields from earlier sessions, shared by all instances (created in GlobalSetup)
+static std::unique_ptr<MoshDiskCache> g_diskCache;
+
+static PF_Err GlobalSetup(PF_InData* in_data, PF_OutData* out_data, PF_ParamDef* params[], PF_LayerDef* output) {
+    MoshLogStart();
+    MoshStatsStart();
+    MoshPackStart();
+    MOSH_LOG_INFO("GlobalSetup called");
+
+    if (!g_diskCache) {
+        g_diskCache.reset(new MoshDiskCache(MoshDiskCache::DefaultDirectory(), MOSH_DISK_CACHE_MAX_BYTES));
+    }
+    if (!g_frameRegistry) {
+        g_frameRegistry.reset(new MoshFrameRegistry(MOSH_FRAME_REGISTRY_RETAIN_BYTES));
+    }
+
+    out_data->my_version = PF_VERSION(PLUGIN_MAJOR_VERSION, PLUGIN_MINOR_VERSION,
+        PLUGIN_BUG_VERSION, PLUGIN_STAGE_VERSION, PLUGIN_BUILD_VERSION);
+
+    // WIDE_TIME_INPUT: we check out the source layer at other times to build the mosh range
+    out_data->out_flags = PF_OutFlag_WIDE_TIME_INPUT |
+                          PF_OutFlag_SEQUENCE_DATA_NEEDS_FLATTENING |
+                          PF_OutFlag_PIX_INDEPENDENT |
+                          PF_OutFlag_USE_OUTPUT_EXTENT |
+                          PF_OutFlag_DEEP_COLOR_AWARE;
+
+    // After Effects renders through SMART_PRE_RENDER/SMART_RENDER, Premiere through RENDER.
+    // Render threads share one MoshSequenceData per instance, so multi-frame rendering is safe.
+    out_data->out_flags2 = PF_OutFlag2_FLOAT_COLOR_AWARE |
+                           PF_OutFlag2_SUPPORTS_SMART_RENDER |
+                           PF_OutFlag2_DOESNT_NEED_EMPTY_PIXELS |
+                           PF_OutFlag2_SUPPORTS_THREADED_RENDERING |
+                           PF_OutFlag2_SUPPORTS_GET_FLATTENED_SEQUENCE_DATA;
+
+    if (in_data->appl_id == 'PrMr') {
+        AEFX_SuiteScoper<PF_PixelFormatSuite1, true> pixelFormatSuite(
+            in_data, kPFPixelFormatSuite, kPFPixelFormatSuiteVersion1, out_data);
+        if (pixelFormatSuite.get()) {
+            // In order of preference: native 8-bit YUV and RGB first so Premiere doesn't convert
+            // 8-bit sources to float for us, float formats for high bit depth renders
+            (*pixelFormatSuite->ClearSupportedPixelFormats)(in_data->effect_ref);
+            (*pixelFormatSuite->AddSupportedPixelFormat)(in_data->effect_ref, PrPixelFormat_VUYA_4444_8u);
+            (*pixelFormatSuite->AddSupportedPixelFormat)(in_data->effect_ref, PrPixelFormat_BGRA_4444_8u);
+            (*pixelFormatSuite->AddSupportedPixelFormat)(in_data->effect_ref, PrPixelFormat_VUYA_4444_32f);
+            (*pixelFormatSuite->AddSupportedPixelFormat)(in_data->effect_ref, PrPixelFormat_BGRA_4444_32f);
+        }
+    }
+
+    MOSH_LOG_INFO("GlobalSetup complete");
+    return PF_Err_NONE;
+}
+
+// Global mutex to protect sequence handles and the instance registry across all threads
+// Must be static/global because it needs to outlive individual seqData instances
+static std::mutex g_seqDataMutex;
+
+// Sequence data by instance id. Render-thread copies of an effect instance find and share
+// the live data here; SEQUENCE_FLATTEN parks its reference until RESETUP or SETDOWN claims it.
+static std::unordered_map<uint64_t, std::weak_ptr<MoshSequenceData>> g_liveSequenceData;
+static std::unordered_map<uint64_t, std::shared_ptr<MoshSequenceData>> g_parkedSequenceData;
+
+static PF_Err GlobalSetdown(PF_InData* in_data, PF_OutData* out_data, PF_ParamDef* params[], PF_LayerDef* output) {
+    MOSH_LOG_INFO("GlobalSetdown called");
+    {
+        std::lock_guard<std::mutex> lock(g_seqDataMutex);
+        g_parkedSequenceData.clear();
+        g_liveSequenceData.clear();
+    }
+    MoshPackStop();
+    g_diskCache.reset();
+    g_frameRegistry.reset();
+    MoshStatsStop();
+    MoshLogStop();
+    return PF_Err_NONE;
+}
+
+// Caller holds g_seqDataMutex
+static uint64_t NewInstanceId() {
+    static std::mt19937_64 rng(std::random_device{}());
+    uint64_t id = 0;
+    while (id == 0 || g_liveSequenceData.count(id) || g_parkedSequenceData.count(id)) {
+        id = rng();
+    }
+    return id;
+}
+
+// Caller holds g_seqDataMutex
+static PF_Handle NewLiveSequenceHandle(PF_InData* in_data, uint64_t instanceId,
+                                       const std::shared_ptr<MoshSequenceData>& seqData) {
+    PF_Handle handle = PF_NEW_HANDLE(sizeof(MoshSequenceHandle));
+    if (handle) {
+        MoshSequenceHandle* live = (MoshSequenceHandle*)*handle;
+        live->tag = MOSH_SEQUENCE_LIVE_TAG;
+        live->instanceId = instanceId;
+        live->data = new std::shared_ptr<MoshSequenceData>(seqData);
+        g_liveSequenceData[instanceId] = seqData;
+    }
+    return handle;
+}
+
+static const MoshSequenceHandle* AsLiveHandle(PF_InData* in_data, PF_Handle handle) {
+    if (handle && *handle && PF_GET_HANDLE_SIZE(handle) >= sizeof(MoshSequenceHandle)) {
+        const MoshSequenceHandle* live = (const MoshSequenceHandle*)*handle;
+        if (live->tag == MOSH_SEQUENCE_LIVE_TAG && live->data) {
+            return live;
+        }
+    }
+    return nullptr;
+}
+
+static const MoshSequenceDataFlat* AsFlatHandle(PF_InData* in_data, PF_Handle handle) {
+    if (handle && *handle && PF_GET_HANDLE_SIZE(handle) >= sizeof(MoshSequenceDataFlat)) {
+        const MoshSequenceDataFlat* flat = (const MoshSequenceDataFlat*)*handle;
+        if (flat->version == MOSH_SEQUENCE_DATA_VERSION &&
+            PF_GET_HANDLE_SIZE(handle) >= sizeof(MoshSequenceDataFlat) + flat->motionFieldBytes) {
+            return flat;
+        }
+    }
+    return nullptr;
+}
+
+// Caller holds g_seqDataMutex
+static PF_Handle NewFlatSequenceHandle(PF_InData* in_data, const MoshSequenceHandle* live, uint32_t flags) {
+    MoshSequenceData* seqData = live->data->get();
+    std::lock_guard<std::mutex> cacheLock(seqData->cacheMutex);
+
+    // Only full-quality fields for the current mosh range, at the working resolution, are worth
+    // saving - smaller sizes scale them down
+    std::vector<uint8_t> encoded;
+    uint32_t fieldCount = 0;
+    int32_t savedDuration = seqData->analyzedDraft ? 0 : seqData->analyzedDuration;
+    auto working = seqData->motionFields.find(MoshResolutionKey(seqData->analyzedWidth, seqData->analyzedHeight));
+    for (int32_t f = seqData->analyzedMoshFrame;
+         working != seqData->motionFields.end() && f < seqData->analyzedMoshFrame + savedDuration; ++f) {
+        auto it = working->second.find(f);
+        if (it != working->second.end()) {
+            EncodeMotionField(it->second, encoded);
+            ++fieldCount;
+        }
+    }
+
+    PF_Handle handle = PF_NEW_HANDLE(sizeof(MoshSequenceDataFlat) + encoded.size());
+    if (handle) {
+        MoshSequenceDataFlat* flat = (MoshSequenceDataFlat*)*handle;
+        flat->version = MOSH_SEQUENCE_DATA_VERSION;
+        flat->analysisState = (int32_t)AnalysisState::NotStarted;  // pixel caches aren't saved
+        flat->analyzedMoshFrame = seqData->analyzedMoshFrame;
+        flat->analyzedDuration = seqData->analyzedDuration;
+        flat->analyzedBlockSize = seqData->analyzedBlockSize;
+        flat->analyzedSearchRange = seqData->analyzedSearchRange;
+        flat->analyzedWidth = seqData->analyzedWidth;
+        flat->analyzedHeight = seqData->analyzedHeight;
+        flat->instanceId = live->instanceId;
+        flat->flags = flags;
+        flat->motionFieldCount = fieldCount;
+        flat->motionFieldBytes = (uint32_t)encoded.size();
+        if (!encoded.empty()) {
+            memcpy(flat + 1, encoded.data(), encoded.size());
+        }
+    }
+    return handle;
+}
+
+// Restore the motion fields saved by NewFlatSequenceHandle; a damaged payload restores none
+static void ReadFlatMotionFields(const MoshSequenceDataFlat* flat, MoshSequenceData* seqData) {
+    const uint8_t* p = (const uint8_t*)(flat + 1);
+    const uint8_t* end = p + flat->motionFieldBytes;
+
+    MotionFieldMap fields;
+    for (uint32_t i = 0; i < flat->motionFieldCount; ++i) {
+        MotionField field;
+        if (!DecodeMotionField(p, end, &field) ||
+            field.width != flat->analyzedWidth || field.height != flat->analyzedHeight) {
+            MOSH_LOG_WARN("Discarding damaged motion fields in sequence data");
+            return;
+        }
+        int32_t frameIndex = field.frameIndex;
+        fields[frameIndex] = std::move(field);
+    }
+    if (!fields.empty()) {
+        seqData->FieldsAt(flat->analyzedWidth, flat->analyzedHeight) = std::move(fields);
+    }
+    MOSH_LOG_DEBUG("Restored %u motion fields", flat->motionFieldCount);
+}
+
+static PF_Err SequenceSetup(PF_InData* in_data, PF_OutData* out_data) {
+    MOSH_LOG_DEBUG("SequenceSetup called");
+
+    std::lock_guard<std::mutex> lock(g_seqDataMutex);
+    out_data->sequence_data = NewLiveSequenceHandle(in_data, NewInstanceId(), std::make_shared<MoshSequenceData>());
+
+    MOSH_LOG_DEBUG("SequenceSetup complete");
+    return out_data->sequence_data ? PF_Err_NONE : PF_Err_OUT_OF_MEMORY;
+}
+
+// Called for flat data loaded with the project and for the copies the host makes for render
+// threads. Render-thread copies share the live sequence data instead of starting over; the
+// instance that was flattened claims its parked data back. Saved data whose instance is still
+// live is a duplicated or pasted effect, which starts from the saved fields under a new id so
+// the two never clear each other's caches.
+static PF_Err SequenceResetup(PF_InData* in_data, PF_OutData* out_data) {
+    MOSH_LOG_DEBUG("SequenceResetup called");
+
+    std::lock_guard<std::mutex> lock(g_seqDataMutex);
+
+    if (AsLiveHandle(in_data, in_data->sequence_data)) {
+        return PF_Err_NONE;
+    }
+
+    const MoshSequenceDataFlat* flat = AsFlatHandle(in_data, in_data->sequence_data);
+    uint64_t instanceId = flat ? flat->instanceId : 0;
+    std::shared_ptr<MoshSequenceData> seqData;
+
+    if (instanceId) {
+        auto live = g_liveSequenceData.find(instanceId);
+        auto parked = g_parkedSequenceData.find(instanceId);
+        if (flat->flags & MOSH_FLAT_RENDER_COPY) {
+            if (live != g_liveSequenceData.end()) {
+                seqData = live->second.lock();
+            }
+            if (!seqData && parked != g_parkedSequenceData.end()) {
+                seqData = parked->second;
+            }
+        } else if (parked != g_parkedSequenceData.end()) {
+            seqData = parked->second;
+            g_parkedSequenceData.erase(parked);
+        } else if (live != g_liveSequenceData.end() && !live->second.expired()) {
+            instanceId = 0;
+        }
+    }
+
+    if (!seqData) {
+        seqData = std::make_shared<MoshSequenceData>();
+        if (flat) {
+            seqData->analyzedMoshFrame = flat->analyzedMoshFrame;
+            seqData->analyzedDuration = flat->analyzedDuration;
+            seqData->analyzedBlockSize = flat->analyzedBlockSize;
+            seqData->analyzedSearchRange = flat->analyzedSearchRange;
+            seqData->analyzedWidth = flat->analyzedWidth;
+            seqData->analyzedHeight = flat->analyzedHeight;
+            ReadFlatMotionFields(flat, seqData.get());
+        } else {
+            // Unknown or pre-versioned data - start fresh under a new identity
+            instanceId = 0;
+        }
+    }
+    if (!instanceId) {
+        instanceId = NewInstanceId();
+    }
+
+    PF_Handle handle = NewLiveSequenceHandle(in_data, instanceId, seqData);
+    if (!handle) {
+        return PF_Err_OUT_OF_MEMORY;
+    }
+    if (in_data->sequence_data) {
+        PF_DISPOSE_HANDLE(in_data->sequence_data);
+    }
+    out_data->sequence_data = handle;
+    return PF_Err_NONE;
+}
+
+static PF_Err SequenceSetdown(PF_InData* in_data, PF_OutData* out_data) {
+    MOSH_LOG_DEBUG("SequenceSetdown called");
+
+    if (in_data->sequence_data) {
+        // Render threads hold their own references, so nothing is freed out from under them
+        std::lock_guard<std::mutex> lock(g_seqDataMutex);
+
+        const MoshSequenceHandle* live = AsLiveHandle(in_data, in_data->sequence_data);
+        const MoshSequenceDataFlat* flat = AsFlatHandle(in_data, in_data->sequence_data);
+        if (live) {
+            uint64_t instanceId = live->instanceId;
+            delete live->data;
+            auto it = g_liveSequenceData.find(instanceId);
+            if (it != g_liveSequenceData.end() && it->second.expired()) {
+                g_liveSequenceData.erase(it);
+            }
+        } else if (flat && !(flat->flags & MOSH_FLAT_RENDER_COPY)) {
+            g_parkedSequenceData.erase(flat->instanceId);
+        }
+        PF_DISPOSE_HANDLE(in_data->sequence_data);
+        out_data->sequence_data = nullptr;
+    }
+
+    return PF_Err_NONE;
+}
+
+static PF_Err SequenceFlatten(PF_InData* in_data, PF_OutData* out_data) {
+    // Only motion fields are serialized; the live data is parked so a following RESETUP keeps its pixel caches
+    MOSH_LOG_DEBUG("SequenceFlatten called");
+
+    if (in_data->sequence_data) {
+        std::lock_guard<std::mutex> lock(g_seqDataMutex);
+
+        const MoshSequenceHandle* live = AsLiveHandle(in_data, in_data->sequence_data);
+        if (live) {
+            PF_Handle flatHandle = NewFlatSequenceHandle(in_data, live, 0);
+            if (!flatHandle) {
+                return PF_Err_OUT_OF_MEMORY;
+            }
+            g_parkedSequenceData[live->instanceId] = *live->data;
+            delete live->data;
+            PF_DISPOSE_HANDLE(in_data->sequence_data);
+            out_data->sequence_data = flatHandle;
+        }
+    }
+
+    return PF_Err_NONE;
+}
+
+// Flat copy for the host (multi-frame rendering) - the live handle stays untouched
+static PF_Err GetFlattenedSequenceData(PF_InData* in_data, PF_OutData* out_data) {
+    std::lock_guard<std::mutex> lock(g_seqDataMutex);
+
+    const MoshSequenceHandle* live = AsLiveHandle(in_data, in_data->sequence_data);
+    if (!live) {
+        return PF_Err_INTERNAL_STRUCT_DAMAGED;
+    }
+    out_data->sequence_data = NewFlatSequenceHandle(in_data, live, MOSH_FLAT_RENDER_COPY);
+    return out_data->sequence_data ? PF_Err_NONE : PF_Err_OUT_OF_MEMORY;
+}
+
+static PF_Err ParamsSetup(PF_InData* in_data, PF_OutData* out_data, PF_ParamDef* params[], PF_LayerDef* output) {
+    PF_Err err = PF_Err_NONE;
+    PF_ParamDef def;
+
+    AEFX_CLR_STRUCT(def);
+    PF_ADD_SLIDER("Mosh Frame", MOSH_FRAME_MIN, MOSH_FRAME_MAX, MOSH_FRAME_MIN, MOSH_FRAME_MAX, MOSH_FRAME_DFLT, DISK_ID_MOSH_FRAME);
+
+    AEFX_CLR_STRUCT(def);
+    PF_ADD_SLIDER("Duration", DURATION_MIN, DURATION_MAX, DURATION_MIN, DURATION_MAX, DURATION_DFLT, DISK_ID_DURATION);
+
+    AEFX_CLR_STRUCT(def);
+    PF_ADD_POPUP("Block Size", 3, BLOCK_SIZE_DFLT, "8|16|32", DISK_ID_BLOCK_SIZE);
+
+    AEFX_CLR_STRUCT(def);
+    PF_ADD_SLIDER("Search Range", SEARCH_RANGE_MIN, SEARCH_RANGE_MAX, SEARCH_RANGE_MIN, SEARCH_RANGE_MAX, SEARCH_RANGE_DFLT, DISK_ID_SEARCH_RANGE);
+
+    AEFX_CLR_STRUCT(def);
+    def.param_type = PF_Param_FLOAT_SLIDER;
+    PF_STRCPY(def.PF_DEF_NAME, "Blend");
+    def.u.fs_d.valid_min = BLEND_MIN;
+    def.u.fs_d.valid_max = BLEND_MAX;
+    def.u.fs_d.slider_min = BLEND_MIN;
+    def.u.fs_d.slider_max = BLEND_MAX;
+    def.u.fs_d.value = BLEND_DFLT;
+    def.u.fs_d.dephault = BLEND_DFLT;
+    def.u.fs_d.precision = 1;
+    def.u.fs_d.display_flags = PF_ValueDisplayFlag_PERCENT;
+    def.uu.id = DISK_ID_BLEND;
+    PF_ADD_PARAM(in_data, -1, &def);
+
+    AEFX_CLR_STRUCT(def);
+    PF_ADD_CHECKBOX("Cache Precision", "Half-Float", HALF_CACHE_DFLT, 0, DISK_ID_HALF_CACHE);
+
+    out_data->num_params = MOSH_NUM_PARAMS;
+    return err;
+}
+
+// Flow prev -> curr into field at blockSize, for a render whose flow stops at pyramid level
+// lastLevel. A draft render (lastLevel > 0) computes it for blocks as many times larger, so each
+// still spans the same luma samples, and spreads every vector over the blocks it covers - the
+// warp keeps the block grid of a full-quality render. flow holds the previous pair's flow as it
+// was computed, the warm start, and receives this pair's: at full quality the field itself,
+// for draft renders the coarser field.
+static PF_Err ComputePairField(
+    PF_InData* in_data,
+    const AccumulatedFrame& prev,
+    const AccumulatedFrame& curr,
+    int32_t blockSize,
+    int lastLevel,
+    MotionField* flow,
+    std::vector<StructureTensorTables>* tables,
+    MotionField* field)
+{
+    if (lastLevel == 0) {
+        PF_Err err = ComputeMotionField(in_data, prev, curr, blockSize, 0, flow, tables, field);
+        *flow = *field;
+        return err;
+    }
+
+    MotionField draftFlow;
+    PF_Err err = ComputeMotionField(in_data, prev, curr, blockSize << lastLevel, lastLevel, flow, tables, &draftFlow);
+    ScaleMotionField(draftFlow, prev.width, prev.height, blockSize, field);
+    *flow = std::move(draftFlow);
+    MoshStatAdd(MOSH_STAT_DRAFT_FIELDS);
+    return err;
+}
+
+// Pre-compute the warped frames of the mosh range from immutable snapshots, without touching
+// the sequence data, starting at moshFrame + firstIndex from `start` (the reference frame, or the
+// warped frame before firstIndex). fields[i] is the motion into frame moshFrame + i; fields that
+// don't match the frame size and block size are computed from inputs[i] -> inputs[i + 1], where
+// inputs[i] holds frame moshFrame - 1 + i, at the quality lastLevel asks for (see
+// ComputePairField). warped[i] receives frame moshFrame + firstIndex + i.
+static PF_Err PrecomputeWarpedFrames(
+    PF_InData* in_data,
+    const FrameSnapshot& start,
+    const std::vector<FrameSnapshot>& inputs,
+    std::vector<MotionField>& fields,
+    int32_t moshFrame,
+    int32_t firstIndex,
+    int32_t blockSize,
+    int lastLevel,
+    std::vector<FrameSnapshot>* warped)
+{
+    MoshStatScope timer(MOSH_TIMER_PRECOMPUTE);
+    int32_t duration = (int32_t)fields.size();
+    MOSH_LOG_DEBUG("Pre-computing warped frames [%d, %d)", moshFrame + firstIndex, moshFrame + duration);
+
+    // Optical flow between prev and current for every pair not saved with the project, each
+    // starting from the previous pair's field
+    PF_Err err = PF_Err_NONE;
+    std::vector<StructureTensorTables> tables;
+    MotionField flow;
+    if (firstIndex > 0 && lastLevel == 0) {
+        flow = fields[firstIndex - 1];
+    }
+    for (int32_t i = firstIndex; i < duration && !err; ++i) {
+        if (fields[i].Matches(start->width, start->height, blockSize)) {
+            flow = lastLevel == 0 ? fields[i] : MotionField();
+            continue;
+        }
+        err = ComputePairField(in_data, *inputs[i], *inputs[i + 1], blockSize, lastLevel, &flow, &tables, &fields[i]);
+        fields[i].frameIndex = moshFrame + i;
+    }
+    if (err) {
+        return err;
+    }
+
+    // Then warp frame by frame, each straight from the one before into its own cache entry -
+    // starting with the reference (or last cached warped) frame, of which only the pixels are read
+    warped->clear();
+    warped->reserve(duration - firstIndex);
+    const AccumulatedFrame* previous = start.get();
+    for (int32_t i = firstIndex; i < duration; ++i) {
+        std::shared_ptr<AccumulatedFrame> warpedResult = std::make_shared<AccumulatedFrame>();
+        err = ApplyMotionField(in_data, *previous, fields[i], warpedResult.get());
+        if (err) {
+            return err;
+        }
+        warpedResult->frameIndex = moshFrame + i;
+        warped->push_back(warpedResult);
+        previous = warpedResult.get();
+
+        MOSH_LOG_DEBUG("Pre-computed warped frame %d", moshFrame + i);
+    }
+
+    MOSH_LOG_DEBUG("Pre-computation complete for %d frames", duration - firstIndex);
+    return PF_Err_NONE;
+}
+
+// Check out the source layer at another time and cache it (used for frames the host hasn't
+// rendered), or copy just its flow pyramid for a stream catching up
+static PF_Err CheckoutInputFrame(
+    PF_InData* in_data,
+    int32_t frameNum,
+    int width, int height,
+    MoshPixelFormat format,
+    bool halfFloat,
+    bool pyramidOnly,
+    FrameSnapshot* outFrame)
+{
+    PF_Err err = PF_Err_NONE;
+    PF_ParamDef checkout;
+    AEFX_CLR_STRUCT(checkout);
+
+    outFrame->reset();
+
+    MoshStatAdd(MOSH_STAT_INPUT_CHECKOUTS);
+    err = PF_CHECKOUT_PARAM(in_data, MOSH_INPUT,
+        frameNum * in_data->time_step, in_data->time_step, in_data->time_scale, &checkout);
+    if (err) {
+        return err;
+    }
+
+    // Frames outside the clip (or at a different size) can't feed the flow - leave them uncached
+    PF_LayerDef* layer = &checkout.u.ld;
+    if (layer->data && layer->width == width && layer->height == height) {
+        *outFrame = pyramidOnly ? CopyFlowPyramid(layer, frameNum, format)
+                                : CacheSourceFrame(layer, frameNum, format, halfFloat);
+    }
+
+    PF_Err err2 = PF_CHECKIN_PARAM(in_data, &checkout);
+    return err ? err : err2;
+}
+
+// Fetch every input frame in [firstFrame, endFrame) that isn't cached yet, so any frame in the
+// mosh range can render on first request instead of after a full scrub.
+// The cache lock is only taken to find the gaps and to publish each frame; frames fetched
+// after the cache was invalidated (generation changed) are dropped.
+static PF_Err FetchMissingInputFrames(
+    PF_InData* in_data,
+    MoshSequenceData* seqData,
+    uint32_t generation,
+    int32_t firstFrame,
+    int32_t endFrame,
+    int width, int height,
+    MoshPixelFormat format,
+    bool halfFloat)
+{
+    PF_Err err = PF_Err_NONE;
+    int32_t fetched = 0;
+
+    std::vector<int32_t> missing;
+    {
+        std::lock_guard<std::mutex> lock(seqData->cacheMutex);
+        const MoshFrameCache& frames = seqData->FramesAt(width, height);
+        for (int32_t f = firstFrame; f < endFrame; ++f) {
+            if (frames.inputFrames.find(f) == frames.inputFrames.end()) {
+                missing.push_back(f);
+            }
+        }
+    }
+
+    for (size_t i = 0; i < missing.size() && !err; ++i) {
+        err = PF_ABORT(in_data);
+        if (err) {
+            break;
+        }
+
+        FrameSnapshot fetchedFrame;
+        err = CheckoutInputFrame(in_data, missing[i], width, height, format, halfFloat, false, &fetchedFrame);
+        if (!err && fetchedFrame) {
+            std::lock_guard<std::mutex> lock(seqData->cacheMutex);
+            if (seqData->generation != generation) {
+                break;
+            }
+            if (seqData->FramesAt(width, height).inputFrames.emplace(missing[i], fetchedFrame).second) {
+                MoshStatAdd(MOSH_STAT_BYTES_CACHED, fetchedFrame->CachedBytes());
+                ++fetched;
+            }
+        } else if (!err) {
+            MOSH_LOG_WARN("Checkout of input frame %d returned no usable pixels", missing[i]);
+        }
+    }
+
+    if (fetched > 0) {
+        MOSH_LOG_DEBUG("Checked out %d input frames", fetched);
+    }
+    return err;
+}
+
+//==============================================================================
+// RENDER
+//==============================================================================
+
+// Parameter values a render depends on (read from params[] or checked out for SmartFX)
+struct MoshRenderParams {
+    int32_t moshFrame;
+    int32_t duration;
+    int32_t blockSize;
+    float blend;
+    float scale;        // host downsample factor, 1 at full resolution
+    bool halfCache;     // keep float frames at half precision
+    bool draft;         // host asked for draft quality (PF_Quality_LO)
+};
+
+// A host world plus where its top-left pixel sits in full-frame (cache) coordinates
+struct MoshWorldView {
+    const PF_LayerDef* world;
+    int originX;
+    int originY;
+};
+
+// Source frames the host checked out for a streamed render to catch up through, by frame number
+typedef std::unordered_map<int32_t, const PF_LayerDef*> MoshHostFrames;
+
+// Downsample factor of this render (Premiere's 1/2 and 1/4 playback, AE's draft resolutions).
+// Both axes are reduced alike, so the horizontal factor stands for both.
+static inline float DownsampleScale(const PF_InData* in_data) {
+    const PF_RationalScale& ds = in_data->downsample_x;
+    return (ds.num > 0 && ds.den > 0) ? (float)ds.num / (float)ds.den : 1.0f;
+}
+
+static void ReadMoshParams(PF_InData* in_data, PF_ParamDef* params[], MoshRenderParams* p) {
+    p->moshFrame = params[MOSH_FRAME]->u.sd.value;
+    p->duration = params[MOSH_DURATION]->u.sd.value;
+    p->blockSize = BlockSizeFromIndex(params[MOSH_BLOCK_SIZE]->u.pd.value);
+    p->blend = (float)params[MOSH_BLEND]->u.fs_d.value / 100.0f;
+    p->scale = DownsampleScale(in_data);
+    p->halfCache = params[MOSH_HALF_CACHE]->u.bd.value != 0;
+    p->draft = in_data->quality == PF_Quality_LO;
+}
+
+// Whether this render's frames are cached at half precision - float formats only, the others are
+// no larger than half floats already
+static inline bool CachesHalfFloat(const MoshRenderParams& p, MoshPixelFormat format) {
+    return p.halfCache && MoshIsFloatFormat(format);
+}
+
+// Block size in render pixels - the block grid is the same at every resolution
+static inline int32_t BlockSizeAt(const MoshRenderParams& p) {
+    return std::max(2, (int32_t)lroundf(p.blockSize * p.scale));
+}
+
+// Finest flow pyramid level this render computes motion on: interactive (draft quality) renders
+// trade flow detail for speed, final renders use full resolution
+static inline int FlowLevelAt(const MoshRenderParams& p) {
+    return p.draft ? MOSH_FLOW_DRAFT_LEVEL : 0;
+}
+
+static inline int32_t CurrentFrameNumber(const PF_InData* in_data) {
+    return (in_data->time_step > 0) ? (int32_t)(in_data->current_time / in_data->time_step) : 0;
+}
+
+// Copy the source rows covering the output world straight through
+static PF_Err PassthroughToOutput(PF_InData* in_data, const MoshWorldView& src, const MoshWorldView& output,
+                                  MoshPixelFormat format) {
+    int bytesPerPixel = MoshBytesPerPixel(format);
+    int srcX = output.originX - src.originX;
+    int srcY = output.originY - src.originY;
+
+    auto copyRow = [&](int y) {
+        const char* srcRow = WorldRow(src.world, srcY + y) + srcX * bytesPerPixel;
+        memcpy(WorldRow(output.world, y), srcRow, output.world->width * bytesPerPixel);
+    };
+    return IterateOutputRows(in_data, output.world->height, copyRow);
+}
+
+// Blend kernels: out = src * (1 - blend) + acc * blend over count channels
+static void BlendRow(const PF_FpShort* src, const PF_FpShort* acc, PF_FpShort* out, int count, float blend) {
+    float inv = 1.0f - blend;
+    int i = 0;
+#if defined(__SSE2__)
+    __m128 vBlend = _mm_set1_ps(blend);
+    __m128 vInv = _mm_set1_ps(inv);
+    for (; i + 4 <= count; i += 4) {
+        __m128 s = _mm_mul_ps(_mm_loadu_ps(src + i), vInv);
+        __m128 a = _mm_mul_ps(_mm_loadu_ps(acc + i), vBlend);
+        _mm_storeu_ps(out + i, _mm_add_ps(s, a));
+    }
+#elif defined(__ARM_NEON)
+    float32x4_t vBlend = vdupq_n_f32(blend);
+    float32x4_t vInv = vdupq_n_f32(inv);
+    for (; i + 4 <= count; i += 4) {
+        float32x4_t s = vmulq_f32(vld1q_f32(src + i), vInv);
+        float32x4_t a = vmulq_f32(vld1q_f32(acc + i), vBlend);
+        vst1q_f32(out + i, vaddq_f32(s, a));
+    }
+#endif
+    for (; i < count; ++i) {
+        out[i] = src[i] * inv + acc[i] * blend;
+    }
+}
+
+// 8-bit: blend weight in 1/256 steps, 16-bit sums fit the vector lanes the compiler picks
+static void BlendRow(const A_u_char* src, const A_u_char* acc, A_u_char* out, int count, float blend) {
+    uint16_t w = (uint16_t)(blend * 256.0f + 0.5f);
+    uint16_t inv = (uint16_t)(256 - w);
+    for (int i = 0; i < count; ++i) {
+        out[i] = (A_u_char)((src[i] * inv + acc[i] * w + 128) >> 8);
+    }
+}
+
+// 16-bit (0..PF_MAX_CHAN16): blend weight in 1/65536 steps, sums fit 32 bits
+static void BlendRow(const A_u_short* src, const A_u_short* acc, A_u_short* out, int count, float blend) {
+    uint32_t w = (uint32_t)(blend * 65536.0f + 0.5f);
+    uint32_t inv = 65536u - w;
+    for (int i = 0; i < count; ++i) {
+        out[i] = (A_u_short)((src[i] * inv + acc[i] * w + 32768u) >> 16);
+    }
+}
+
+// output = src * (1 - blend) + warped * blend, pixel format is shared by src, cache and output.
+// Blend 0% is a passthrough and 100% a straight copy of the warped rows. Half-float caches are
+// widened into the output row first and blended there.
+static PF_Err BlendWarpedToOutput(PF_InData* in_data, const MoshWorldView& src, const AccumulatedFrame& warped,
+                                  const MoshWorldView& output, float blend, MoshPixelFormat format) {
+    if (blend <= 0.0f) {
+        return PassthroughToOutput(in_data, src, output, format);
+    }
+
+    if (warped.halfFloat) {
+        int srcX = output.originX - src.originX;
+        int srcY = output.originY - src.originY;
+        int count = output.world->width * 4;
+
+        auto widenRow = [&](int y) {
+            PF_FpShort* outRow = (PF_FpShort*)WorldRow(output.world, y);
+            HalfToFloatRow(warped.Row<uint16_t>(output.originY + y) + output.originX * 4, outRow, count);
+            if (blend < 1.0f) {
+                BlendRow((const PF_FpShort*)WorldRow(src.world, srcY + y) + srcX * 4, outRow, outRow, count, blend);
+            }
+        };
+        return IterateOutputRows(in_data, output.world->height, widenRow);
+    }
+
+    int bytesPerPixel = MoshBytesPerPixel(format);
+    if (blend >= 1.0f) {
+        auto copyRow = [&](int y) {
+            memcpy(WorldRow(output.world, y),
+                   warped.Row<uint8_t>(output.originY + y) + output.originX * bytesPerPixel,
+                   output.world->width * bytesPerPixel);
+        };
+        return IterateOutputRows(in_data, output.world->height, copyRow);
+    }
+
+    PF_Err err = PF_Err_NONE;
+    DispatchPixelFormat(format, [&](auto traits) {
+        typedef typename decltype(traits)::ChannelT ChannelT;
+        int srcX = output.originX - src.originX;
+        int srcY = output.originY - src.originY;
+
+        auto blendRow = [&](int y) {
+            BlendRow((const ChannelT*)WorldRow(src.world, srcY + y) + srcX * 4,
+                     warped.Row<ChannelT>(output.originY + y) + output.originX * 4,
+                     (ChannelT*)WorldRow(output.world, y),
+                     output.world->width * 4, blend);
+        };
+        err = IterateOutputRows(in_data, output.world->height, blendRow);
+    });
+    return err;
+}
+
+static PF_Err CyanTintToOutput(PF_InData* in_data, const MoshWorldView& src, const MoshWorldView& output,
+                               MoshPixelFormat format) {
+    PF_Err err = PF_Err_NONE;
+    DispatchPixelFormat(format, [&](auto traits) {
+        typedef decltype(traits) Traits;
+        typedef typename Traits::ChannelT ChannelT;
+        int srcX = output.originX - src.originX;
+        int srcY = output.originY - src.originY;
+
+        auto cyanRow = [&](int y) {
+            const ChannelT* srcRow = (const ChannelT*)WorldRow(src.world, srcY + y) + srcX * 4;
+            ChannelT* outRow = (ChannelT*)WorldRow(output.world, y);
+            for (int x = 0; x < output.world->width; ++x) {
+                Traits::Cyan(srcRow + x * 4, outRow + x * 4);
+            }
+        };
+        err = IterateOutputRows(in_data, output.world->height, cyanRow);
+    });
+    return err;
+}
+
+// Caller holds seqData->cacheMutex
+static void StoreReferenceFrame(MoshFrameCache& frames, int32_t moshFrame) {
+    auto it = frames.inputFrames.find(moshFrame - 1);
+    if (it != frames.inputFrames.end()) {
+        frames.referenceFrame = it->second;
+        MOSH_LOG_DEBUG("Stored reference frame %d", moshFrame - 1);
+    }
+}
+
+// Drop the cached state that depends on a changed parameter, or everything pixel-based when the
+// host starts handing us a different pixel format. Source frames depend on no parameter; the
+// per-pair flow depends on the block size only; warped frames depend on the block size and the
+// reference (Mosh Frame), and a new Duration only adds or removes frames at the end. Draft
+// renders take whatever is cached, but a full-quality render never uses draft results.
+// Caller holds seqData->cacheMutex.
+static void InvalidateForParams(MoshSequenceData* seqData, const MoshRenderParams& p, MoshPixelFormat format) {
+    bool halfFloat = CachesHalfFloat(p, format);
+    if (seqData->analyzedBlockSize != p.blockSize) {
+        MOSH_LOG_DEBUG("Block size changed, clearing motion fields and warped frames");
+        MoshStatAdd(MOSH_STAT_INVALIDATIONS);
+        seqData->ClearWarped();
+        seqData->ClearMotionFields();
+        seqData->analyzedDraft = false;
+        seqData->analyzedMoshFrame = p.moshFrame;
+        seqData->analyzedDuration = p.duration;
+        seqData->analyzedBlockSize = p.blockSize;
+    } else if (seqData->analyzedMoshFrame != p.moshFrame) {
+        MOSH_LOG_DEBUG("Mosh frame changed, clearing warped frames");
+        MoshStatAdd(MOSH_STAT_INVALIDATIONS);
+        seqData->ClearWarped();
+        seqData->analyzedMoshFrame = p.moshFrame;
+        seqData->analyzedDuration = p.duration;
+    } else if (seqData->analyzedDuration != p.duration) {
+        MOSH_LOG_DEBUG("Duration changed, keeping warped frames before %d", p.moshFrame + p.duration);
+        MoshStatAdd(MOSH_STAT_INVALIDATIONS);
+        seqData->TrimWarped(p.moshFrame + p.duration);
+        seqData->analyzedDuration = p.duration;
+    }
+    if (seqData->analyzedDraft && !p.draft) {
+        MOSH_LOG_DEBUG("Full-quality render, clearing draft motion fields and warped frames");
+        MoshStatAdd(MOSH_STAT_INVALIDATIONS);
+        seqData->ClearWarped();
+        seqData->ClearMotionFields();
+        seqData->analyzedDraft = false;
+    }
+    if (seqData->analyzedFormat != format || seqData->analyzedHalfFloat != halfFloat) {
+        // Motion doesn't depend on the pixel format or precision - only the cached pixels go
+        MOSH_LOG_DEBUG("Pixel format or cache precision changed, clearing cached frames");
+        MoshStatAdd(MOSH_STAT_INVALIDATIONS);
+        seqData->ClearFrames();
+        seqData->analyzedFormat = format;
+        seqData->analyzedHalfFloat = halfFloat;
+    }
+}
+
+// The fields of the size closest to this render resolution, at it or finer, that has a motion
+// field for every frame of the mosh range (e.g. restored by SequenceResetup), so the warp only
+// needs the reference frame; null when there is none. Fields from a coarser preview aren't good
+// enough for a larger render. Caller holds seqData->cacheMutex.
+static const MotionFieldMap* CompleteMotionFields(const MoshSequenceData* seqData, const MoshRenderParams& p,
+                                                  int width, int height) {
+    const MotionFieldMap* closest = nullptr;
+    int64_t closestArea = 0;
+    for (const auto& entry : seqData->motionFields) {
+        const MotionFieldMap& fields = entry.second;
+        auto first = fields.find(p.moshFrame);
+        if (first == fields.end() || first->second.width < width || first->second.height < height) {
+            continue;
+        }
+        int64_t area = (int64_t)first->second.width * first->second.height;
+        if (closest && area >= closestArea) {
+            continue;
+        }
+        bool complete = true;
+        for (int32_t f = p.moshFrame; complete && f < p.moshFrame + p.duration; ++f) {
+            auto it = fields.find(f);
+            complete = it != fields.end() && !it->second.vectors.empty();
+        }
+        if (complete) {
+            closest = &fields;
+            closestArea = area;
+        }
+    }
+    return closest;
+}
+
+static bool HasAllMotionFields(const MoshSequenceData* seqData, const MoshRenderParams& p, int width, int height) {
+    return CompleteMotionFields(seqData, p, width, height) != nullptr;
+}
+
+// The stored flow into `frame` if an analysis at this size can reuse it: from completeFields
+// when the whole range is known at this size or finer (see CompleteMotionFields - it gets
+// scaled), otherwise only one computed at exactly this size, next to which new flow is
+// computed. Caller holds seqData->cacheMutex.
+static const MotionField* ReusableMotionField(const MoshSequenceData* seqData, const MoshRenderParams& p,
+                                              int32_t frame, int width, int height,
+                                              const MotionFieldMap* completeFields) {
+    if (completeFields) {
+        auto it = completeFields->find(frame);
+        return it != completeFields->end() ? &it->second : nullptr;
+    }
+    auto fields = seqData->motionFields.find(MoshResolutionKey(width, height));
+    if (fields == seqData->motionFields.end()) {
+        return nullptr;
+    }
+    auto it = fields->second.find(frame);
+    return it != fields->second.end() && it->second.Matches(width, height, BlockSizeAt(p)) ? &it->second : nullptr;
+}
+
+// Number of leading frames of the mosh range already warped at this size. They stay valid when
+// only Duration changes, so the analysis resumes after them. Caller holds seqData->cacheMutex.
+static int32_t WarpedPrefix(const MoshSequenceData* seqData, const MoshRenderParams& p, int width, int height) {
+    if (seqData->analyzedMoshFrame != p.moshFrame || seqData->analyzedBlockSize != p.blockSize) {
+        return 0;
+    }
+    auto cache = seqData->frameCaches.find(MoshResolutionKey(width, height));
+    if (cache == seqData->frameCaches.end()) {
+        return 0;
+    }
+    int32_t count = 0;
+    while (count < p.duration && cache->second.warpedFrames.count(p.moshFrame + count)) {
+        ++count;
+    }
+    return count;
+}
+
+// Input frames [*firstFrame, *endFrame) feeding the pairs from moshFrame + firstIndex on whose
+// flow still has to be computed at this size; false when every field can be reused.
+// Caller holds seqData->cacheMutex.
+static bool MissingFlowRange(const MoshSequenceData* seqData, const MoshRenderParams& p, int width, int height,
+                             int32_t firstIndex, int32_t* firstFrame, int32_t* endFrame) {
+    const MotionFieldMap* completeFields = CompleteMotionFields(seqData, p, width, height);
+    int32_t first = p.moshFrame + p.duration;
+    int32_t end = p.moshFrame;
+    for (int32_t f = p.moshFrame + firstIndex; f < p.moshFrame + p.duration; ++f) {
+        if (!ReusableMotionField(seqData, p, f, width, height, completeFields)) {
+            first = std::min(first, f - 1);
+            end = std::max(end, f + 1);
+        }
+    }
+    *firstFrame = first;
+    *endFrame = end;
+    return first < end;
+}
+
+// Content hashes of every frame the range's flow reads, reference to last; false while one of
+// them isn't cached. Caller holds seqData->cacheMutex.
+static bool RangeContentHashes(const MoshFrameCache& frames, const MoshRenderParams& p,
+                               std::vector<uint64_t>* hashes) {
+    hashes->clear();
+    for (int32_t f = p.moshFrame - 1; f < p.moshFrame + p.duration; ++f) {
+        auto it = frames.inputFrames.find(f);
+        if (it == frames.inputFrames.end()) {
+            return false;
+        }
+        hashes->push_back(it->second->contentHash);
+    }
+    return true;
+}
+
+// Disk cache key: the source is identified by the content of every frame the flow reads, so
+// the same clip moved along the timeline still hits but two clips that only share their end
+// frames (fades, slates) don't
+static uint64_t DiskCacheKey(const std::vector<uint64_t>& rangeHashes, const AccumulatedFrame& reference,
+                             const MoshRenderParams& p) {
+    uint64_t parts[] = {
+        (uint64_t)reference.width, (uint64_t)reference.height, (uint64_t)reference.format,
+        (uint64_t)p.duration, (uint64_t)p.blockSize
+    };
+    uint64_t hash = MoshHashBytes(parts, sizeof(parts));
+    return MoshHashBytes(rangeHashes.data(), rangeHashes.size() * sizeof(uint64_t), hash);
+}
+
+// Fill the motion fields at this size for the range from the disk cache. Needs every frame of the range cached;
+// returns true when every field was restored.
+static bool LoadMotionFieldsFromDisk(MoshSequenceData* seqData, const MoshRenderParams& p,
+                                     uint32_t generation, int width, int height) {
+    FrameSnapshot first;
+    std::vector<uint64_t> rangeHashes;
+    {
+        std::lock_guard<std::mutex> lock(seqData->cacheMutex);
+        const MoshFrameCache& frames = seqData->FramesAt(width, height);
+        if (!RangeContentHashes(frames, p, &rangeHashes)) {
+            return false;
+        }
+        first = frames.inputFrames.find(p.moshFrame - 1)->second;
+    }
+
+    std::vector<MotionField> fields(p.duration);
+    bool loaded = g_diskCache->Load(DiskCacheKey(rangeHashes, *first, p),
+        [&](const uint8_t* payload, size_t bytes, uint32_t recordCount) {
+            if (recordCount != (uint32_t)p.duration) {
+                return false;
+            }
+            const uint8_t* ptr = payload;
+            for (MotionField& field : fields) {
+                if (!DecodeMotionField(ptr, payload + bytes, &field) || !field.Matches(width, height, BlockSizeAt(p))) {
+                    return false;
+                }
+            }
+            return true;
+        });
+    MoshStatAdd(loaded ? MOSH_STAT_DISK_HITS : MOSH_STAT_DISK_MISSES);
+    if (!loaded) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(seqData->cacheMutex);
+    if (seqData->generation != generation) {
+        return false;
+    }
+    MotionFieldMap& stored = seqData->FieldsAt(width, height);
+    for (int32_t i = 0; i < p.duration; ++i) {
+        fields[i].frameIndex = p.moshFrame + i;  // entries are position independent
+        stored[p.moshFrame + i] = std::move(fields[i]);
+    }
+    MOSH_LOG_DEBUG("Loaded %d motion fields from disk cache", p.duration);
+    return true;
+}
+
+static void StoreMotionFieldsToDisk(const std::vector<MotionField>& fields, uint64_t key) {
+    std::vector<uint8_t> encoded;
+    for (const MotionField& field : fields) {
+        EncodeMotionField(field, encoded);
+    }
+    if (!g_diskCache->Store(key, encoded, (uint32_t)fields.size())) {
+        MOSH_LOG_WARN("Could not write motion fields to disk cache");
+    }
+}
+
+// Packed copy of a cached source frame: same frame and flow pyramid, pixels compressed
+static FrameSnapshot PackFrame(const AccumulatedFrame& frame) {
+    MoshStatScope timer(MOSH_TIMER_PACK);
+    std::shared_ptr<AccumulatedFrame> packed = std::make_shared<AccumulatedFrame>();
+    packed->frameIndex = frame.frameIndex;
+    packed->width = frame.width;
+    packed->height = frame.height;
+    packed->rowBytes = frame.rowBytes;
+    packed->format = frame.format;
+    packed->halfFloat = frame.halfFloat;
+    packed->valid = frame.valid;
+    packed->flowPyramid = frame.flowPyramid;
+
+    int pixelBytes = frame.PixelBytes();
+    packed->packedSamples.resize((size_t)MOSH_SOURCE_SAMPLES * pixelBytes);
+    for (int i = 0; i < MOSH_SOURCE_SAMPLES; ++i) {
+        int x, y;
+        SamplePosition(frame.width, frame.height, i, &x, &y);
+        memcpy(packed->packedSamples.data() + (size_t)i * pixelBytes,
+               frame.Row<uint8_t>(y) + (size_t)x * pixelBytes, pixelBytes);
+    }
+    packed->contentHash = frame.contentHash;
+    MoshPackPixels(frame.pixelData.data(), frame.pixelData.size(), pixelBytes, &packed->packedPixels);
+
+    MoshStatAdd(MOSH_STAT_FRAMES_PACKED);
+    MoshStatAdd(MOSH_STAT_PACK_BYTES_IN, frame.pixelData.size());
+    MoshStatAdd(MOSH_STAT_PACK_BYTES_OUT, packed->packedPixels.size());
+    return packed;
+}
+
+// Once an analysis has read the source frames at a resolution, only the reference frame's
+// pixels are read again - the flow uses the pyramids, renders the warped frames - so the others
+// are swapped for packed copies. Runs on the packing thread; an entry replaced or dropped while
+// its copy was being packed is left alone.
+static void PackColdInputFrames(const std::weak_ptr<MoshSequenceData>& weakData, int width, int height) {
+    std::shared_ptr<MoshSequenceData> seqData = weakData.lock();
+    if (!seqData) {
+        return;
+    }
+
+    std::vector<std::pair<int32_t, FrameSnapshot>> cold;
+    {
+        std::lock_guard<std::mutex> lock(seqData->cacheMutex);
+        auto cache = seqData->frameCaches.find(MoshResolutionKey(width, height));
+        if (cache == seqData->frameCaches.end()) {
+            return;
+        }
+        for (const auto& entry : cache->second.inputFrames) {
+            const FrameSnapshot& frame = entry.second;
+            if (!frame->IsPacked() && !frame->pixelData.empty() && frame != cache->second.referenceFrame &&
+                entry.first != seqData->analyzedMoshFrame - 1) {
+                cold.push_back(std::make_pair(entry.first, frame));
+            }
+        }
+    }
+
+    for (const auto& entry : cold) {
+        // Another instance may have packed the same frame already
+        const FrameSnapshot& frame = entry.second;
+        FrameSnapshot packed = g_frameRegistry ? g_frameRegistry->Find(RegistryKey(*frame), true) : nullptr;
+        if (!packed) {
+            packed = PackFrame(*frame);
+            if (g_frameRegistry) {
+                packed = g_frameRegistry->Insert(RegistryKey(*frame), packed);
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(seqData->cacheMutex);
+        auto cache = seqData->frameCaches.find(MoshResolutionKey(width, height));
+        if (cache == seqData->frameCaches.end()) {
+            return;
+        }
+        auto it = cache->second.inputFrames.find(entry.first);
+        if (it != cache->second.inputFrames.end() && it->second == frame && frame != cache->second.referenceFrame) {
+            it->second = packed;
+        }
+    }
+    MOSH_LOG_DEBUG("Packed %zu cached input frames at %dx%d", cold.size(), width, height);
+}
+
+// Unpacked copy of the packed source frame cached for frameNumber - one that became the reference
+// after Mosh Frame moved - published in its place for the next reader. Another instance's
+// unpacked copy is used when there is one. Null, with the entry dropped to be fetched again, if
+// the packed pixels don't decode. Caller doesn't hold seqData->cacheMutex.
+static FrameSnapshot UnpackFrame(MoshSequenceData* seqData, const FrameSnapshot& packed, int32_t frameNumber,
+                                 int width, int height) {
+    FrameSnapshot published = g_frameRegistry ? g_frameRegistry->Find(RegistryKey(*packed), false) : nullptr;
+    if (!published) {
+        std::shared_ptr<AccumulatedFrame> frame = std::make_shared<AccumulatedFrame>();
+        bool unpacked;
+        {
+            MoshStatScope timer(MOSH_TIMER_UNPACK);
+            frame->frameIndex = packed->frameIndex;
+            frame->width = packed->width;
+            frame->height = packed->height;
+            frame->rowBytes = packed->rowBytes;
+            frame->format = packed->format;
+            frame->halfFloat = packed->halfFloat;
+            frame->valid = packed->valid;
+            frame->flowPyramid = packed->flowPyramid;
+            frame->contentHash = packed->contentHash;
+            frame->pixelData.resize((size_t)packed->rowBytes * packed->height);
+            unpacked = MoshUnpackPixels(packed->packedPixels.data(), packed->packedPixels.size(),
+                                        packed->PixelBytes(), frame->pixelData.data(), frame->pixelData.size());
+        }
+        MoshStatAdd(MOSH_STAT_FRAMES_UNPACKED);
+        if (unpacked) {
+            published = g_frameRegistry ? g_frameRegistry->Insert(RegistryKey(*frame), frame) : frame;
+        } else {
+            MOSH_LOG_ERROR("Packed input frame %d does not decode, dropping it", frameNumber);
+        }
+    }
+
+    std::unique_lock<std::mutex> lock(seqData->cacheMutex, std::defer_lock);
+    MoshStatLock(lock);
+    auto cache = seqData->frameCaches.find(MoshResolutionKey(width, height));
+    if (cache != seqData->frameCaches.end()) {
+        if (cache->second.referenceFrame == packed) {
+            cache->second.referenceFrame = published;
+        }
+        auto it = cache->second.inputFrames.find(frameNumber);
+        if (it != cache->second.inputFrames.end() && it->second == packed) {
+            if (published) {
+                it->second = published;
+            } else {
+                cache->second.inputFrames.erase(it);
+            }
+        }
+    }
+    return published;
+}
+
+// Run the mosh-range analysis for `generation` and publish the motion fields and warped frames.
+// Called by the one render thread that moved the state to InProgress; the cache lock is not
+// held on entry. *currentWarped receives the warped currentFrame even when another render's
+// params invalidated the cache meanwhile and nothing is published.
+static PF_Err AnalyzeMoshRange(
+    PF_InData* in_data,
+    MoshSequenceData* seqData,
+    const MoshRenderParams& p,
+    uint32_t generation,
+    MoshPixelFormat format,
+    int width, int height,
+    bool canCheckoutInputs,
+    int32_t currentFrame,
+    FrameSnapshot* currentWarped)
+{
+    PF_Err err = PF_Err_NONE;
+    bool haveFields;
+    {
+        std::lock_guard<std::mutex> lock(seqData->cacheMutex);
+        haveFields = HasAllMotionFields(seqData, p, width, height);
+    }
+
+    // An earlier session may have analyzed the same source; its key needs every frame of the
+    // range, which a miss checks out for the flow anyway
+    if (!haveFields && g_diskCache) {
+        if (canCheckoutInputs) {
+            err = FetchMissingInputFrames(in_data, seqData, generation, p.moshFrame - 1, p.moshFrame + p.duration,
+                                          width, height, format, CachesHalfFloat(p, format));
+            if (err) {
+                return err;
+            }
+        }
+        haveFields = LoadMotionFieldsFromDisk(seqData, p, generation, width, height);
+    }
+
+    // Check out whatever the host hasn't rendered for us yet: the reference frame, plus the pairs
+    // whose flow isn't known past the warped prefix - after a range change usually just the
+    // frames it gained
+    if (canCheckoutInputs) {
+        int32_t firstFrame = 0, endFrame = 0;
+        bool missingFlow;
+        {
+            std::lock_guard<std::mutex> lock(seqData->cacheMutex);
+            missingFlow = MissingFlowRange(seqData, p, width, height, WarpedPrefix(seqData, p, width, height),
+                                           &firstFrame, &endFrame);
+        }
+        err = FetchMissingInputFrames(in_data, seqData, generation, p.moshFrame - 1, p.moshFrame,
+                                      width, height, format, CachesHalfFloat(p, format));
+        if (!err && missingFlow) {
+            err = FetchMissingInputFrames(in_data, seqData, generation, firstFrame, endFrame,
+                                          width, height, format, CachesHalfFloat(p, format));
+        }
+        if (err) {
+            return err;
+        }
+    }
+
+    // Snapshot the inputs - they stay valid after the lock is released, even across a Clear()
+    FrameSnapshot reference, start;
+    std::vector<uint64_t> rangeHashes;
+    bool hashesKnown;
+    std::vector<FrameSnapshot> inputs(p.duration + 1);
+    std::vector<MotionField> fields(p.duration);
+    std::vector<bool> computed(p.duration, false);
+    bool computesFlow = false;
+    bool allFields = true;
+    bool scalesFields;
+    int32_t firstIndex;
+    {
+        std::lock_guard<std::mutex> lock(seqData->cacheMutex);
+        if (seqData->generation != generation) {
+            return PF_Err_NONE;
+        }
+        MoshFrameCache& frames = seqData->FramesAt(width, height);
+        if (!frames.referenceFrame) {
+            StoreReferenceFrame(frames, p.moshFrame);
+        }
+        reference = frames.referenceFrame;
+        if (!reference) {
+            MOSH_LOG_DEBUG("Missing reference frame %d for pre-computation", p.moshFrame - 1);
+            return PF_Err_NONE;
+        }
+        hashesKnown = RangeContentHashes(frames, p, &rangeHashes);
+
+        // Resume after the frames already warped (Duration grew); only their flow is carried
+        // along, for the disk cache
+        firstIndex = WarpedPrefix(seqData, p, width, height);
+        start = firstIndex > 0 ? frames.warpedFrames[p.moshFrame + firstIndex - 1] : reference;
+        auto currentIt = frames.warpedFrames.find(currentFrame);
+        if (currentIt != frames.warpedFrames.end()) {
+            *currentWarped = currentIt->second;
+        }
+
+        // A range analyzed at this resolution or finer is scaled to it; otherwise the pairs not
+        // yet known at this resolution are computed here from their input frames
+        const MotionFieldMap* completeFields = CompleteMotionFields(seqData, p, width, height);
+        scalesFields = completeFields != nullptr;
+        for (int32_t i = 0; i < p.duration; ++i) {
+            const MotionField* known = ReusableMotionField(seqData, p, p.moshFrame + i, width, height, completeFields);
+            if (known) {
+                fields[i] = *known;
+                continue;
+            }
+            if (i < firstIndex) {
+                allFields = false;
+                continue;
+            }
+            computesFlow = true;
+            computed[i] = true;
+            for (int32_t f = p.moshFrame - 1 + i; f <= p.moshFrame + i; ++f) {
+                auto it = frames.inputFrames.find(f);
+                if (it == frames.inputFrames.end()) {
+                    MOSH_LOG_DEBUG("Missing input frame %d for pre-computation", f);
+                    return PF_Err_NONE;
+                }
+                inputs[f - (p.moshFrame - 1)] = it->second;
+            }
+        }
+    }
 
-            sumIxIx += Ix * Ix;
-            sumIyIy += Iy * Iy;
-            sumIxIy += Ix * Iy;
-            sumIxIt += Ix * It;
-            sumIyIt += Iy * It;
+    // The warp reads the reference's pixels
+    if (reference->IsPacked()) {
+        reference = UnpackFrame(seqData, reference, p.moshFrame - 1, width, height);
+        if (!reference) {
+            return PF_Err_NONE;
+        }
+        if (firstIndex == 0) {
+            start = reference;
         }
     }
 
-    double det = sumIxIx * sumIyIy - sumIxIy * sumIxIy;
-
-    if (fabs(det) < 1e-6) {
-        *outMvX = 0;
-        *outMvY = 0;
-        return;
+    int32_t blockSize = BlockSizeAt(p);
+    if (scalesFields) {
+        ScaleMotionFields(fields, width, height, blockSize);
     }
 
-    double u = (-sumIxIt * sumIyIy + sumIyIt * sumIxIy) / det;
-    double v = (-sumIyIt * sumIxIx + sumIxIt * sumIxIy) / det;
+    std::vector<FrameSnapshot> warped;
+    err = PrecomputeWarpedFrames(in_data, start, inputs, fields, p.moshFrame, firstIndex, blockSize,
+                                 FlowLevelAt(p), &warped);
+    if (err) {
+        return err;
+    }
+    int32_t currentIndex = currentFrame - p.moshFrame - firstIndex;
+    if (currentIndex >= 0 && currentIndex < (int32_t)warped.size()) {
+        *currentWarped = warped[currentIndex];
+    }
 
-    *outMvX = (float)Clamp((int)round(u), -32, 32);
-    *outMvY = (float)Clamp((int)round(v), -32, 32);
-}
+    // New flow is worth keeping for the next session; every field is at this size now. Draft
+    // flow is only good until a full-quality render.
+    if (computesFlow && allFields && !p.draft && g_diskCache && hashesKnown) {
+        StoreMotionFieldsToDisk(fields, DiskCacheKey(rangeHashes, *reference, p));
+    }
 
-// Warp accumulated frame using optical flow (exact Python port)
-static void WarpAccumulated(
-    AccumulatedFrame& accumulated,
-    const float* prev, int prevRowbytes,
-    const float* curr, int currRowbytes,
-    int width, int height, int blockSize)
-{
-    // Create temp buffer for output
-    std::vector<float> temp(width * height * 4, 0.0f);
-
-    for (int by = 0; by < height; by += blockSize) {
-        for (int bx = 0; bx < width; bx += blockSize) {
-            int y1 = by;
-            int y2 = (by + blockSize < height) ? by + blockSize : height;
-            int x1 = bx;
-            int x2 = (bx + blockSize < width) ? bx + blockSize : width;
-            int blockH = y2 - y1;
-            int blockW = x2 - x1;
-
-            // Compute flow for this block
-            float mvX, mvY;
-            ComputeBlockFlow(prev, prevRowbytes, curr, currRowbytes,
-                             width, height, bx, by, blockSize, &mvX, &mvY);
-
-            int imvX = (int)round(mvX);
-            int imvY = (int)round(mvY);
-
-            // Source position in accumulated (clamped)
-            int sy1 = Clamp(y1 + imvY, 0, height - blockH);
-            int sx1 = Clamp(x1 + imvX, 0, width - blockW);
-
-            // Copy block from accumulated at offset to temp
-            for (int py = 0; py < blockH; ++py) {
-                const float* srcRow = accumulated.pixelData.data() + (sy1 + py) * width * 4;
-                float* dstRow = temp.data() + (y1 + py) * width * 4;
-
-                for (int px = 0; px < blockW; ++px) {
-                    const float* srcPx = srcRow + (sx1 + px) * 4;
-                    float* dstPx = dstRow + (x1 + px) * 4;
-                    dstPx[0] = srcPx[0];
-                    dstPx[1] = srcPx[1];
-                    dstPx[2] = srcPx[2];
-                    dstPx[3] = srcPx[3];
-                }
+    std::lock_guard<std::mutex> lock(seqData->cacheMutex);
+    if (seqData->generation != generation) {
+        MOSH_LOG_DEBUG("Discarding pre-computation for stale parameters");
+        return PF_Err_NONE;
+    }
+    MoshFrameCache& frames = seqData->FramesAt(width, height);
+    for (size_t i = 0; i < warped.size(); ++i) {
+        frames.warpedFrames[p.moshFrame + firstIndex + (int32_t)i] = warped[i];
+        MoshStatAdd(MOSH_STAT_BYTES_CACHED, warped[i]->CachedBytes());
+    }
+    // Fresh flow joins the fields at this size, next to those of every other size; scaled copies
+    // are never stored back
+    if (computesFlow) {
+        MotionFieldMap& stored = seqData->FieldsAt(width, height);
+        for (size_t i = 0; i < fields.size(); ++i) {
+            if (computed[i]) {
+                stored[p.moshFrame + (int32_t)i] = std::move(fields[i]);
             }
         }
+        seqData->analyzedDraft = seqData->analyzedDraft || p.draft;
     }
+    seqData->analysisState = AnalysisState::Complete;
 
-    // Copy temp back to accumulated
-    accumulated.pixelData = std::move(temp);
-}
-
-//==============================================================================
-// EFFECT CALLBACKS
-//==============================================================================
-
-static PF_Err About(PF_InData* in_data, PF_OutData* out_data, PF_ParamDef* params[], PF_LayerDef* output) {
-    snprintf(out_data->return_msg, sizeof(out_data->return_msg),
-        "%s v%d.%d\r%s", PLUGIN_NAME, PLUGIN_MAJOR_VERSION, PLUGIN_MINOR_VERSION, PLUGIN_DESCRIPTION);
+    if (MoshPackEnabled()) {
+        std::weak_ptr<MoshSequenceData> weakData = seqData->shared_from_this();
+        MoshPackPost([weakData, width, height] { PackColdInputFrames(weakData, width, height); });
+    }
     return PF_Err_NONE;
 }
 
-static PF_Err GlobalSetup(PF_InData* in_data, PF_OutData* out_data, PF_ParamDef* params[], PF_LayerDef* output) {
-    DebugLog("GlobalSetup called");
+// Disk cache key of streamed flow: each pair's flow starts from the last one's, so the flow into a
+// frame depends on every source frame the stream read since the reference. The chain starts from
+// the reference and takes in each frame's content hash.
+static uint64_t StreamChainSeed(const AccumulatedFrame& reference, const MoshRenderParams& p) {
+    if (!reference.contentHash) {
+        return 0;
+    }
+    uint64_t parts[] = {
+        (uint64_t)'strm', (uint64_t)reference.width, (uint64_t)reference.height, (uint64_t)reference.format,
+        (uint64_t)BlockSizeAt(p), reference.contentHash
+    };
+    return MoshHashBytes(parts, sizeof(parts));
+}
 
-    out_data->my_version = PF_VERSION(PLUGIN_MAJOR_VERSION, PLUGIN_MINOR_VERSION,
-        PLUGIN_BUG_VERSION, PLUGIN_STAGE_VERSION, PLUGIN_BUILD_VERSION);
+// The streamed flow under key, if the disk cache has it at this size
+static bool LoadStreamedField(uint64_t key, const MoshRenderParams& p, int width, int height, MotionField* field) {
+    bool loaded = g_diskCache->Load(key, [&](const uint8_t* payload, size_t bytes, uint32_t recordCount) {
+        const uint8_t* ptr = payload;
+        return recordCount == 1 && DecodeMotionField(ptr, payload + bytes, field) &&
+               field->Matches(width, height, BlockSizeAt(p));
+    });
+    MoshStatAdd(loaded ? MOSH_STAT_DISK_HITS : MOSH_STAT_DISK_MISSES);
+    return loaded;
+}
 
-    out_data->out_flags = PF_OutFlag_SEQUENCE_DATA_NEEDS_FLATTENING |
-                          PF_OutFlag_PIX_INDEPENDENT |
-                          PF_OutFlag_USE_OUTPUT_EXTENT;
+// Streamed flow is written behind the render, on the packing thread when it runs
+static void StoreStreamedField(const MotionField& field, uint64_t key) {
+    std::vector<uint8_t> encoded;
+    EncodeMotionField(field, encoded);
+    auto store = [key, encoded] {
+        if (g_diskCache && !g_diskCache->Store(key, encoded, 1)) {
+            MOSH_LOG_WARN("Could not write streamed motion field to disk cache");
+        }
+    };
+    if (MoshPackEnabled()) {
+        MoshPackPost(store);
+    } else {
+        store();
+    }
+}
 
-    out_data->out_flags2 = PF_OutFlag2_FLOAT_COLOR_AWARE |
-                           PF_OutFlag2_DOESNT_NEED_EMPTY_PIXELS;
+#define MOSH_STREAM_KEPT_FRAMES     8       // warped frames a stream keeps behind its last one
 
-    if (in_data->appl_id == 'PrMr') {
-        AEFX_SuiteScoper<PF_PixelFormatSuite1, true> pixelFormatSuite(
-            in_data, kPFPixelFormatSuite, kPFPixelFormatSuiteVersion1, out_data);
-        if (pixelFormatSuite.get()) {
-            (*pixelFormatSuite->ClearSupportedPixelFormats)(in_data->effect_ref);
-            (*pixelFormatSuite->AddSupportedPixelFormat)(in_data->effect_ref, PrPixelFormat_BGRA_4444_32f);
+// The stream's warped result for frame, if it is the last one or among those kept behind it
+static FrameSnapshot StreamWarped(const MoshStream& stream, int32_t frame) {
+    if (stream.warped && stream.frame == frame) {
+        return stream.warped;
+    }
+    for (const FrameSnapshot& warped : stream.recent) {
+        if (warped->frameIndex == frame) {
+            return warped;
         }
     }
+    return nullptr;
+}
 
-    DebugLog("GlobalSetup complete");
-    return PF_Err_NONE;
+// True when the stream was built for the current parameters at this size and holds a frame, or
+// is working towards one
+static bool StreamLive(const MoshSequenceData* seqData, int width, int height) {
+    const MoshStream& stream = seqData->stream;
+    return stream.generation == seqData->generation && stream.width == width && stream.height == height &&
+           (stream.warped || stream.pendingFrame != MOSH_STREAM_IDLE);
 }
 
-static PF_Err GlobalSetdown(PF_InData* in_data, PF_OutData* out_data, PF_ParamDef* params[], PF_LayerDef* output) {
-    DebugLog("GlobalSetdown called");
-    if (g_debugLog) {
-        fclose(g_debugLog);
-        g_debugLog = nullptr;
+// The nearest warped frame a stream reaching currentFrame can start from: the stream's own last
+// frame, a frame the precompute left warped, or else the reference (moshFrame - 1). Caller holds
+// seqData->cacheMutex.
+static int32_t StreamStartFrame(const MoshSequenceData* seqData, const MoshRenderParams& p, int32_t currentFrame,
+                                int width, int height) {
+    const MoshStream& stream = seqData->stream;
+    int32_t start = p.moshFrame - 1;
+    if (StreamLive(seqData, width, height) && stream.warped && stream.frame < currentFrame) {
+        start = stream.frame;
     }
-    return PF_Err_NONE;
+    auto cache = seqData->frameCaches.find(MoshResolutionKey(width, height));
+    if (cache != seqData->frameCaches.end()) {
+        for (int32_t f = currentFrame - 1; f > start; --f) {
+            if (cache->second.warpedFrames.count(f)) {
+                return f;
+            }
+        }
+    }
+    return start;
 }
 
-static PF_Err SequenceSetup(PF_InData* in_data, PF_OutData* out_data) {
-    DebugLog("SequenceSetup called");
-
-    // Allocate and initialize sequence data using header's struct
-    MoshSequenceData* seqData = new MoshSequenceData();
-    // Constructor already initializes all fields properly
-
-    out_data->sequence_data = PF_NEW_HANDLE(sizeof(MoshSequenceData*));
-    if (out_data->sequence_data) {
-        *((MoshSequenceData**)(*out_data->sequence_data)) = seqData;
+// Whether currentFrame is streamed (see RenderStreamed) instead of precomputing the mosh range:
+// nothing is streaming yet (an export or playback starting here, wherever its first frame falls in
+// the range), the stream holds currentFrame or is about to, currentFrame lies ahead of it, or
+// currentFrame directly follows a warped frame to restart from (a loop back to the range's
+// start). Renders that jump back behind the stream are scrubbing, which a precomputed range
+// serves better. Full-quality renders only - draft renders keep precomputing the range, which
+// scrubbing and looped playback get more out of. Frames already warped are served from the
+// cache either way. Caller holds seqData->cacheMutex.
+static bool StreamsFrame(const MoshSequenceData* seqData, const MoshRenderParams& p, int32_t currentFrame,
+                         int width, int height) {
+    if (p.draft || currentFrame < p.moshFrame || currentFrame >= p.moshFrame + p.duration) {
+        return false;
     }
-
-    DebugLog("SequenceSetup complete");
-    return PF_Err_NONE;
+    auto cache = seqData->frameCaches.find(MoshResolutionKey(width, height));
+    if (cache != seqData->frameCaches.end() && cache->second.warpedFrames.count(currentFrame)) {
+        return false;
+    }
+    const MoshStream& stream = seqData->stream;
+    if (!StreamLive(seqData, width, height) || StreamWarped(stream, currentFrame)) {
+        return true;
+    }
+    // A render thread that finished behind one catching up gets its frame from the kept results
+    int32_t newest = stream.pendingFrame != MOSH_STREAM_IDLE ? stream.pendingFrame : stream.frame;
+    if (currentFrame > newest ||
+        (stream.pendingFrame != MOSH_STREAM_IDLE && currentFrame > newest - MOSH_STREAM_KEPT_FRAMES)) {
+        return true;
+    }
+    return StreamStartFrame(seqData, p, currentFrame, width, height) == currentFrame - 1;
 }
 
-// Global mutex to protect sequence data access across all threads
-// Must be static/global because it needs to outlive individual seqData instances
-static std::mutex g_seqDataMutex;
+// Source frames in the range a stream catching up to currentFrame reads that aren't cached: both
+// ends of every pair whose flow isn't known. The stream's own last frame comes with it, and
+// currentFrame is the render's own source. Caller holds seqData->cacheMutex.
+static void StreamMissingInputs(const MoshSequenceData* seqData, const MoshRenderParams& p, int32_t currentFrame,
+                                int width, int height, std::vector<int32_t>* missing) {
+    const MoshStream& stream = seqData->stream;
+    bool live = StreamLive(seqData, width, height);
+    int32_t start = StreamStartFrame(seqData, p, currentFrame, width, height);
+    bool continues = live && stream.warped && stream.frame == start;
+
+    // A catch-up under way leaves its frame as the stream's last, or currentFrame among the kept
+    if (live && stream.pendingFrame != MOSH_STREAM_IDLE && stream.pendingFrame >= start) {
+        if (stream.pendingFrame >= currentFrame) {
+            return;
+        }
+        start = stream.pendingFrame;
+        continues = true;
+    }
+    const MotionFieldMap* completeFields = CompleteMotionFields(seqData, p, width, height);
+    auto cache = seqData->frameCaches.find(MoshResolutionKey(width, height));
+    for (int32_t f = std::max(start, p.moshFrame); f < currentFrame; ++f) {
+        bool read = !ReusableMotionField(seqData, p, f + 1, width, height, completeFields) ||
+            (f > start && !ReusableMotionField(seqData, p, f, width, height, completeFields));
+        bool cached = (continues && f == start) ||
+            (cache != seqData->frameCaches.end() && cache->second.inputFrames.count(f));
+        if (read && !cached) {
+            missing->push_back(f);
+        }
+    }
+}
 
-static PF_Err SequenceSetdown(PF_InData* in_data, PF_OutData* out_data) {
-    DebugLog("SequenceSetdown called");
+// Render currentFrame from the stream: hosts exporting or playing the mosh range ask for it in
+// order, so each frame is one flow from the source frame before it and one warp of that frame's
+// result. A stream that isn't on the frame before currentFrame catches up to it from the nearest
+// warped frame (see StreamStartFrame), reading source frames from the cache, from hostFrames (what
+// SmartFX checked out for it, see StreamMissingInputs) or checked out here. The stream keeps only
+// the last frame's result and flow pyramid, plus the last MOSH_STREAM_KEPT_FRAMES results and any
+// a waiting render asks for, for render threads that finish out of order. Nothing waits on the
+// whole range, so the placeholder never shows. Fresh flow goes to the disk cache rather than motionFields, which would
+// grow with the range, so the next pass over the range reads it back instead of computing it
+// again. A render of a frame the stream is still working towards waits for it. The lock is held
+// on entry and on return, unless *rendered is set; a frame the stream can't serve is left to the
+// precompute.
+static PF_Err RenderStreamed(
+    PF_InData* in_data,
+    MoshSequenceData* seqData,
+    const MoshRenderParams& p,
+    int32_t currentFrame,
+    MoshPixelFormat format,
+    const MoshWorldView& src,
+    const MoshWorldView& output,
+    int width, int height,
+    const MoshHostFrames& hostFrames,
+    bool canCheckoutInputs,
+    std::unique_lock<std::mutex>& lock,
+    bool* rendered)
+{
+    *rendered = false;
+    MoshStream& stream = seqData->stream;
+    int32_t blockSize = BlockSizeAt(p);
+    int32_t start = 0;
+    FrameSnapshot previousWarped;
+    std::vector<FrameSnapshot> inputs;      // source frame start + i, where at hand
+    std::vector<MotionField> knownFields;   // flow into start + i, where known
+    std::vector<FrameSnapshot> recent;
+    MotionField flow;
+    uint64_t chainKey = 0;
+    bool fetchedReference = false;
+    for (;;) {
+        if (!StreamsFrame(seqData, p, currentFrame, width, height)) {
+            return PF_Err_NONE;
+        }
+        bool live = StreamLive(seqData, width, height);
+        if (live && stream.pendingFrame != MOSH_STREAM_IDLE) {
+            uint32_t generation = seqData->generation;
+            MoshStatScope wait(MOSH_TIMER_ANALYSIS_WAIT);
+            seqData->streamWaiters.push_back(currentFrame);
+            seqData->analysisDone.wait(lock, [seqData, generation] {
+                return seqData->stream.pendingFrame == MOSH_STREAM_IDLE || seqData->generation != generation;
+            });
+            seqData->streamWaiters.erase(std::find(seqData->streamWaiters.begin(), seqData->streamWaiters.end(),
+                                                   currentFrame));
+            InvalidateForParams(seqData, p, format);
+            continue;
+        }
 
-    if (in_data->sequence_data) {
-        // Lock global mutex to ensure no Render threads are accessing seqData
-        std::lock_guard<std::mutex> lock(g_seqDataMutex);
+        // Rendered again, or after the stream moved on - the result is still at hand
+        FrameSnapshot kept = live ? StreamWarped(stream, currentFrame) : nullptr;
+        if (kept) {
+            lock.unlock();
+            MoshStatAdd(MOSH_STAT_FRAMES_STREAMED);
+            BlendWarpedToOutput(in_data, src, *kept, output, p.blend, format);
+            *rendered = true;
+            return PF_Err_NONE;
+        }
 
-        MoshSequenceData* seqData = *((MoshSequenceData**)(*in_data->sequence_data));
-        if (seqData) {
-            seqData->Clear();
-            delete seqData;
+        start = StreamStartFrame(seqData, p, currentFrame, width, height);
+        MoshFrameCache& frames = seqData->FramesAt(width, height);
+        inputs.assign(currentFrame - start, nullptr);
+        recent.clear();
+        if (live && stream.warped && stream.frame == start) {
+            // On from the stream's last frame
+            previousWarped = stream.warped;
+            inputs[0] = stream.input;
+            flow = stream.flow;
+            chainKey = stream.chainKey;
+            recent = stream.recent;
+            recent.push_back(stream.warped);
+        } else if (start >= p.moshFrame) {
+            // On from a frame the precompute left warped, with the flow into it as the warm start,
+            // like the precompute resuming after a warped prefix
+            const MotionField* before = ReusableMotionField(seqData, p, start, width, height,
+                                                            CompleteMotionFields(seqData, p, width, height));
+            previousWarped = frames.warpedFrames[start];
+            flow = MotionField();
+            if (before) {
+                ScaleMotionField(*before, width, height, blockSize, &flow);
+            }
+            stream = MoshStream();
+            chainKey = 0;
+        } else {
+            // From the reference, which feeds the first frame of the range alone
+            if (!frames.referenceFrame) {
+                StoreReferenceFrame(frames, p.moshFrame);
+            }
+            if (!frames.referenceFrame) {
+                if (fetchedReference || !canCheckoutInputs) {
+                    return PF_Err_NONE;
+                }
+                uint32_t generation = seqData->generation;
+                lock.unlock();
+                PF_Err err = FetchMissingInputFrames(in_data, seqData, generation, p.moshFrame - 1, p.moshFrame,
+                                                     width, height, format, CachesHalfFloat(p, format));
+                MoshStatLock(lock);
+                if (err) {
+                    return err;
+                }
+                InvalidateForParams(seqData, p, format);
+                fetchedReference = true;
+                continue;
+            }
+            stream = MoshStream();
+            previousWarped = inputs[0] = frames.referenceFrame;
+            flow = MotionField();
+            chainKey = g_diskCache ? StreamChainSeed(*frames.referenceFrame, p) : 0;
         }
-        PF_DISPOSE_HANDLE(in_data->sequence_data);
+        break;
     }
 
-    return PF_Err_NONE;
-}
-
-static PF_Err SequenceFlatten(PF_InData* in_data, PF_OutData* out_data) {
-    // For flattening, we just clear the cache (can't serialize pixel data easily)
-    DebugLog("SequenceFlatten called");
+    // Cached source frames along the way, and known flow (restored with the project, or a
+    // previous analysis), reused like the precompute does so both paths render the same frames
+    MoshFrameCache& frames = seqData->FramesAt(width, height);
+    const MotionFieldMap* completeFields = CompleteMotionFields(seqData, p, width, height);
+    knownFields.assign(currentFrame - start, MotionField());
+    for (int32_t f = start; f < currentFrame; ++f) {
+        auto input = frames.inputFrames.find(f);
+        if (!inputs[f - start] && input != frames.inputFrames.end()) {
+            inputs[f - start] = input->second;
+        }
+        const MotionField* known = ReusableMotionField(seqData, p, f + 1, width, height, completeFields);
+        if (known) {
+            ScaleMotionField(*known, width, height, blockSize, &knownFields[f - start]);
+        }
+    }
 
-    if (in_data->sequence_data) {
-        std::lock_guard<std::mutex> lock(g_seqDataMutex);
+    uint32_t generation = seqData->generation;
+    stream.generation = generation;
+    stream.width = width;
+    stream.height = height;
+    stream.pendingFrame = currentFrame;
+    lock.unlock();
+
+    // Only the reference can be packed; the stream's own frames never are
+    if (previousWarped->IsPacked()) {
+        previousWarped = UnpackFrame(seqData, previousWarped, p.moshFrame - 1, width, height);
+        inputs[0] = previousWarped;
+    }
 
-        MoshSequenceData* seqData = *((MoshSequenceData**)(*in_data->sequence_data));
-        if (seqData) {
-            seqData->accumulatedFrames.clear();
-            seqData->referenceFrame.Clear();
+    // Source frame f's flow pyramid, from wherever it is at hand
+    PF_Err err = PF_Err_NONE;
+    auto inputAt = [&](int32_t f) -> FrameSnapshot {
+        FrameSnapshot& input = inputs[f - start];
+        if (input || err) {
+            return input;
         }
+        auto host = hostFrames.find(f);
+        if (host != hostFrames.end()) {
+            input = CopyFlowPyramid(host->second, f, format);
+        } else if (canCheckoutInputs) {
+            err = CheckoutInputFrame(in_data, f, width, height, format, false, true, &input);
+        }
+        return input;
+    };
+
+    FrameSnapshot currentInput = CopyFlowPyramid(src.world, currentFrame, format);
+    std::shared_ptr<AccumulatedFrame> warped;
+    for (int32_t f = start + 1; f <= currentFrame && previousWarped && !err; ++f) {
+        if (f < currentFrame) {
+            err = PF_ABORT(in_data);
+            if (err) {
+                break;
+            }
+        }
+        MotionField field = std::move(knownFields[f - 1 - start]);
+        bool reusesField = field.Matches(width, height, blockSize);
+        FrameSnapshot input = f == currentFrame ? currentInput : reusesField ? inputs[f - start] : inputAt(f);
+        chainKey = chainKey && input ? MoshHashBytes(&input->contentHash, sizeof(uint64_t), chainKey) : 0;
+        if (!reusesField && chainKey) {
+            reusesField = LoadStreamedField(chainKey, p, width, height, &field);
+        }
+        if (reusesField) {
+            flow = field;
+        } else {
+            FrameSnapshot previousInput = inputAt(f - 1);
+            if (!previousInput || !input) {
+                MOSH_LOG_WARN("Stream has no source for frames %d-%d", f - 1, f);
+                previousWarped = nullptr;
+                break;
+            }
+            std::vector<StructureTensorTables> tables;
+            err = ComputePairField(in_data, *previousInput, *input, blockSize, FlowLevelAt(p), &flow, &tables, &field);
+            if (!err && chainKey) {
+                StoreStreamedField(field, chainKey);
+            }
+        }
+        inputs[f - 1 - start].reset();
+        if (!err) {
+            warped = std::make_shared<AccumulatedFrame>();
+            err = ApplyMotionField(in_data, *previousWarped, field, warped.get());
+            warped->frameIndex = f;
+            if (f < currentFrame) {
+                recent.push_back(warped);
+            }
+            previousWarped = warped;
+        }
+    }
+
+    MoshStatLock(lock);
+    bool ours = stream.pendingFrame == currentFrame && stream.generation == generation;
+    if (ours) {
+        stream.pendingFrame = MOSH_STREAM_IDLE;
+    }
+    if (ours && previousWarped && !err && seqData->generation == generation) {
+        // Render threads that fell behind while waiting may still want older results
+        const std::vector<int32_t>& waiters = seqData->streamWaiters;
+        auto keptFrom = recent.end() - std::min(recent.size(), (size_t)MOSH_STREAM_KEPT_FRAMES);
+        recent.erase(std::remove_if(recent.begin(), keptFrom, [&waiters](const FrameSnapshot& frame) {
+            return std::find(waiters.begin(), waiters.end(), frame->frameIndex) == waiters.end();
+        }), keptFrom);
+        stream.frame = currentFrame;
+        stream.input = currentInput;
+        stream.warped = warped;
+        stream.flow = std::move(flow);
+        stream.recent = std::move(recent);
+        stream.chainKey = chainKey;
     }
+    seqData->analysisDone.notify_all();
+    if (err || !previousWarped) {
+        // Reference lost to a damaged pack, or a source frame out of reach - the precompute deals
+        // with it
+        return err;
+    }
+    lock.unlock();
 
+    MoshStatAdd(MOSH_STAT_FRAMES_STREAMED);
+    BlendWarpedToOutput(in_data, src, *warped, output, p.blend, format);
+    MOSH_LOG_DEBUG("Render frame %d streamed from %d", currentFrame, start);
+    *rendered = true;
     return PF_Err_NONE;
 }
 
-static PF_Err ParamsSetup(PF_InData* in_data, PF_OutData* out_data, PF_ParamDef* params[], PF_LayerDef* output) {
-    PF_Err err = PF_Err_NONE;
-    PF_ParamDef def;
-
-    AEFX_CLR_STRUCT(def);
-    PF_ADD_SLIDER("Mosh Frame", MOSH_FRAME_MIN, MOSH_FRAME_MAX, MOSH_FRAME_MIN, MOSH_FRAME_MAX, MOSH_FRAME_DFLT, DISK_ID_MOSH_FRAME);
+// Shared by PF_Cmd_RENDER and PF_Cmd_SMART_RENDER, safe to call from concurrent render threads.
+// width/height are the full-frame (cache) dimensions; src must cover the output world.
+// srcIsFullFrame allows caching the current frame from src; canCheckoutInputs allows
+// PF_CHECKOUT_PARAM for missing inputs (SmartFX declares its checkouts in pre-render instead).
+// Only one thread analyzes the mosh range at a time; the others wait for its result. Full-quality
+// renders in frame order skip the analysis and are streamed (see RenderStreamed), reading the
+// source frames they catch up through from hostFrames when the host checked them out.
+static PF_Err RenderMoshFrame(
+    PF_InData* in_data,
+    MoshSequenceData* seqData,
+    const MoshRenderParams& p,
+    int32_t currentFrame,
+    MoshPixelFormat format,
+    const MoshWorldView& src,
+    const MoshWorldView& output,
+    int width, int height,
+    bool srcIsFullFrame,
+    bool canCheckoutInputs,
+    const MoshHostFrames& hostFrames)
+{
+    std::unique_lock<std::mutex> lock(seqData->cacheMutex, std::defer_lock);
+    MoshStatLock(lock);
+    InvalidateForParams(seqData, p, format);
+
+    // The warped frames cover the cached full frame; anything else can only pass through
+    bool outputInFrame = output.originX >= 0 && output.originY >= 0 &&
+                         output.originX + output.world->width <= width &&
+                         output.originY + output.world->height <= height;
+
+    // Renders walking the mosh range in order are streamed
+    if (srcIsFullFrame && outputInFrame) {
+        bool streamed = false;
+        PF_Err err = RenderStreamed(in_data, seqData, p, currentFrame, format, src, output, width, height,
+                                    hostFrames, canCheckoutInputs, lock, &streamed);
+        if (err || streamed) {
+            return err;
+        }
+    }
 
-    AEFX_CLR_STRUCT(def);
-    PF_ADD_SLIDER("Duration", DURATION_MIN, DURATION_MAX, DURATION_MIN, DURATION_MAX, DURATION_DFLT, DISK_ID_DURATION);
+    // Cache current input frame (use frame number as key) - only frames that feed the mosh range,
+    // everything else is fetched on demand
+    bool feedsMoshRange = currentFrame >= p.moshFrame - 1 && currentFrame < p.moshFrame + p.duration;
+    if (srcIsFullFrame && feedsMoshRange) {
+        MoshFrameCache* frames = &seqData->FramesAt(width, height);
+        auto it = frames->inputFrames.find(currentFrame);
+        if (it != frames->inputFrames.end() && !SourceMatchesCached(src.world, format, *it->second)) {
+            MOSH_LOG_DEBUG("Input frame %d changed, clearing cache", currentFrame);
+            MoshStatAdd(MOSH_STAT_INVALIDATIONS);
+            seqData->Clear();
+            frames = &seqData->FramesAt(width, height);
+            it = frames->inputFrames.end();
+        }
+        MoshStatAdd(it == frames->inputFrames.end() ? MOSH_STAT_INPUT_MISSES : MOSH_STAT_INPUT_HITS);
+        if (it == frames->inputFrames.end()) {
+            // Copy outside the lock; publish only if nothing was invalidated meanwhile
+            uint32_t generation = seqData->generation;
+            lock.unlock();
+            FrameSnapshot cached = CacheSourceFrame(src.world, currentFrame, format, CachesHalfFloat(p, format));
+            MoshStatLock(lock);
+            InvalidateForParams(seqData, p, format);
+            MoshFrameCache& published = seqData->FramesAt(width, height);
+            if (seqData->generation == generation &&
+                published.inputFrames.emplace(currentFrame, cached).second) {
+                MoshStatAdd(MOSH_STAT_BYTES_CACHED, cached->CachedBytes());
+                MOSH_LOG_DEBUG("Cached input frame %d at %dx%d (total cached: %zu)", currentFrame, width, height,
+                               published.inputFrames.size());
+            }
+        }
+    }
 
-    AEFX_CLR_STRUCT(def);
-    PF_ADD_POPUP("Block Size", 3, BLOCK_SIZE_DFLT, "8|16|32", DISK_ID_BLOCK_SIZE);
+    // Store reference frame (frame before mosh starts) - it may have been rendered or checked out
+    MoshFrameCache& reference = seqData->FramesAt(width, height);
+    if (!reference.referenceFrame) {
+        StoreReferenceFrame(reference, p.moshFrame);
+    }
 
-    AEFX_CLR_STRUCT(def);
-    PF_ADD_SLIDER("Search Range", SEARCH_RANGE_MIN, SEARCH_RANGE_MAX, SEARCH_RANGE_MIN, SEARCH_RANGE_MAX, SEARCH_RANGE_DFLT, DISK_ID_SEARCH_RANGE);
+    // Not in mosh range - passthrough
+    if (currentFrame < p.moshFrame || currentFrame >= p.moshFrame + p.duration) {
+        lock.unlock();
+        MoshStatAdd(MOSH_STAT_FRAMES_PASSTHROUGH);
+        PassthroughToOutput(in_data, src, output, format);
+        return PF_Err_NONE;
+    }
 
-    AEFX_CLR_STRUCT(def);
-    def.param_type = PF_Param_FLOAT_SLIDER;
-    PF_STRCPY(def.PF_DEF_NAME, "Blend");
-    def.u.fs_d.valid_min = BLEND_MIN;
-    def.u.fs_d.valid_max = BLEND_MAX;
-    def.u.fs_d.slider_min = BLEND_MIN;
-    def.u.fs_d.slider_max = BLEND_MAX;
-    def.u.fs_d.value = BLEND_DFLT;
-    def.u.fs_d.dephault = BLEND_DFLT;
-    def.u.fs_d.precision = 1;
-    def.u.fs_d.display_flags = PF_ValueDisplayFlag_PERCENT;
-    def.uu.id = DISK_ID_BLEND;
-    PF_ADD_PARAM(in_data, -1, &def);
+    if (!outputInFrame) {
+        lock.unlock();
+        MoshStatAdd(MOSH_STAT_FRAMES_PASSTHROUGH);
+        PassthroughToOutput(in_data, src, output, format);
+        return PF_Err_NONE;
+    }
 
-    out_data->num_params = MOSH_NUM_PARAMS;
-    return err;
-}
+    bool analyzed = false;
+    bool fetchedReference = false;
+    bool firstLookup = true;
+    for (;;) {
+        // In mosh range - check if pre-computation is done
+        const MoshFrameCache& frames = seqData->FramesAt(width, height);
+        auto warpedIt = frames.warpedFrames.find(currentFrame);
+        if (firstLookup) {
+            MoshStatAdd(warpedIt != frames.warpedFrames.end() ? MOSH_STAT_WARPED_HITS : MOSH_STAT_WARPED_MISSES);
+            firstLookup = false;
+        }
+        if (warpedIt != frames.warpedFrames.end()) {
+            // Use pre-computed result; the snapshot outlives any invalidation during the blend
+            FrameSnapshot warped = warpedIt->second;
+            lock.unlock();
+            MoshStatAdd(MOSH_STAT_FRAMES_PRECOMPUTED);
+            BlendWarpedToOutput(in_data, src, *warped, output, p.blend, format);
+            MOSH_LOG_DEBUG("Render frame %d using pre-computed result", currentFrame);
+            return PF_Err_NONE;
+        }
+        if (analyzed) {
+            break;
+        }
 
-// Key for storing pre-computed warped frames (negative keys to avoid collision with frame numbers)
-static const int32_t WARPED_KEY_BASE = -10000;  // Warped frame N stored at key WARPED_KEY_BASE - N
-static const int32_t INPUT_KEY_BASE = 0;  // Input frames stored at their actual frame number
+        // Only part of the frame wanted (zoomed viewer, cropped or nested use) and the motion is
+        // known: warp just the blocks that feed that part instead of precomputing the whole range
+        bool smallOutput = (int64_t)output.world->width * output.world->height * 2 <= (int64_t)width * height;
+        if (smallOutput && !frames.referenceFrame && !fetchedReference && canCheckoutInputs &&
+            HasAllMotionFields(seqData, p, width, height)) {
+            uint32_t generation = seqData->generation;
+            lock.unlock();
+            PF_Err err = FetchMissingInputFrames(in_data, seqData, generation, p.moshFrame - 1, p.moshFrame,
+                                                 width, height, format, CachesHalfFloat(p, format));
+            MoshStatLock(lock);
+            if (err) {
+                return err;
+            }
+            InvalidateForParams(seqData, p, format);
+            StoreReferenceFrame(seqData->FramesAt(width, height), p.moshFrame);
+            fetchedReference = true;
+            continue;
+        }
+        const MotionFieldMap* completeFields = smallOutput ? CompleteMotionFields(seqData, p, width, height) : nullptr;
+        if (frames.referenceFrame && completeFields) {
+            FrameSnapshot reference = frames.referenceFrame;
+            std::vector<MotionField> fields(currentFrame - p.moshFrame + 1);
+            for (size_t i = 0; i < fields.size(); ++i) {
+                fields[i] = completeFields->find(p.moshFrame + (int32_t)i)->second;
+            }
+            lock.unlock();
+
+            if (reference->IsPacked()) {
+                reference = UnpackFrame(seqData, reference, p.moshFrame - 1, width, height);
+                if (!reference) {
+                    MoshStatLock(lock);
+                    InvalidateForParams(seqData, p, format);
+                    continue;
+                }
+            }
 
-static inline int32_t WarpedKey(int32_t frameNum) { return WARPED_KEY_BASE - frameNum; }
+            ScaleMotionFields(fields, width, height, BlockSizeAt(p));
+            MoshRect roi = { output.originX, output.originY,
+                             output.originX + output.world->width, output.originY + output.world->height };
+            AccumulatedFrame region;
+            WarpRegion(*reference, fields, roi, &region);
+
+            // region holds just the output rect, so address everything relative to it
+            MoshWorldView regionSrc = { src.world, src.originX - roi.left, src.originY - roi.top };
+            MoshWorldView regionOut = { output.world, 0, 0 };
+            MoshStatAdd(MOSH_STAT_FRAMES_REGION);
+            BlendWarpedToOutput(in_data, regionSrc, region, regionOut, p.blend, format);
+            MOSH_LOG_DEBUG("Render frame %d by warping a %dx%d region", currentFrame, region.width, region.height);
+            return PF_Err_NONE;
+        }
 
-// Pre-compute all warped frames for the mosh range (called once when all inputs are cached)
-static void PrecomputeWarpedFrames(
-    MoshSequenceData* seqData,
-    int32_t moshFrame,
-    int32_t duration,
-    int32_t blockSize,
-    int width, int height)
-{
-    DebugLog("Pre-computing warped frames for mosh range [%d, %d)", moshFrame, moshFrame + duration);
+        if (seqData->analysisState == AnalysisState::InProgress) {
+            // Another render thread is analyzing this range - wait for it instead of duplicating the work
+            uint32_t generation = seqData->generation;
+            MoshStatScope wait(MOSH_TIMER_ANALYSIS_WAIT);
+            seqData->analysisDone.wait(lock, [seqData, generation] {
+                return seqData->analysisState != AnalysisState::InProgress || seqData->generation != generation;
+            });
+            InvalidateForParams(seqData, p, format);
+            continue;
+        }
 
-    // Start with reference frame as the accumulated image
-    AccumulatedFrame accumulated;
-    accumulated.Allocate(width, height);
-    accumulated.pixelData = seqData->referenceFrame.pixelData;  // Copy from reference
-    accumulated.valid = true;
+        uint32_t generation = seqData->generation;
+        seqData->analysisState = AnalysisState::InProgress;
+        lock.unlock();
 
-    int rowbytes = width * 4 * sizeof(float);
+        FrameSnapshot currentWarped;
+        PF_Err err = AnalyzeMoshRange(in_data, seqData, p, generation, format, width, height, canCheckoutInputs,
+                                      currentFrame, &currentWarped);
 
-    // Process each frame in the mosh range sequentially
-    for (int32_t f = moshFrame; f < moshFrame + duration; ++f) {
-        int32_t prevFrameNum = f - 1;
+        MoshStatLock(lock);
+        if (seqData->generation == generation && seqData->analysisState == AnalysisState::InProgress) {
+            // Inputs missing or aborted - let the next render try again
+            seqData->analysisState = AnalysisState::NotStarted;
+        }
+        seqData->analysisDone.notify_all();
+        if (err) {
+            return err;
+        }
+        if (currentWarped) {
+            // Our own result, which is right for p even if a render with other params won the cache
+            lock.unlock();
+            MoshStatAdd(MOSH_STAT_FRAMES_PRECOMPUTED);
+            BlendWarpedToOutput(in_data, src, *currentWarped, output, p.blend, format);
+            MOSH_LOG_DEBUG("Render frame %d using its own analysis", currentFrame);
+            return PF_Err_NONE;
+        }
+        // Another render may have switched the cache to its params while we analyzed
+        InvalidateForParams(seqData, p, format);
+        analyzed = true;
+    }
+    lock.unlock();
 
-        // Get cached input frames
-        AccumulatedFrame& prevInput = seqData->accumulatedFrames[prevFrameNum];
-        AccumulatedFrame& currInput = seqData->accumulatedFrames[f];
+    // Inputs still missing (checkout failed) - output cyan tint to indicate analysis in progress
+    MOSH_LOG_DEBUG("Input frames unavailable, outputting cyan tint for frame %d", currentFrame);
+    MoshStatAdd(MOSH_STAT_FRAMES_CYAN);
+    CyanTintToOutput(in_data, src, output, format);
+    return PF_Err_NONE;
+}
 
-        // Warp the accumulated frame using optical flow between prev and current
-        WarpAccumulated(
-            accumulated,
-            prevInput.pixelData.data(), rowbytes,
-            currInput.pixelData.data(), rowbytes,
-            width, height, blockSize);
+// This render's reference to the shared sequence data. Render threads must not modify
+// sequence_data, so it is read through the const sequence data suite when the host has it.
+static std::shared_ptr<MoshSequenceData> GetSequenceData(PF_InData* in_data) {
+    PF_Handle handle = in_data->sequence_data;
+
+    AEFX_SuiteScoper<PF_EffectSequenceDataSuite1, true> seqDataSuite(
+        in_data, kPFEffectSequenceDataSuite, kPFEffectSequenceDataSuiteVersion1);
+    if (seqDataSuite.get()) {
+        PF_ConstHandle constHandle = nullptr;
+        if (seqDataSuite->PF_GetConstSequenceData(in_data->effect_ref, &constHandle) == PF_Err_NONE && constHandle) {
+            handle = (PF_Handle)constHandle;
+        }
+    }
 
-        // Store a copy of the warped result for this frame
-        int32_t warpedKey = WarpedKey(f);
-        AccumulatedFrame& warpedResult = seqData->accumulatedFrames[warpedKey];
-        warpedResult.Allocate(width, height);
-        warpedResult.pixelData = accumulated.pixelData;  // Copy
-        warpedResult.valid = true;
-        warpedResult.frameIndex = f;
+    std::unique_lock<std::mutex> lock(g_seqDataMutex, std::defer_lock);
+    MoshStatLock(lock);
+    const MoshSequenceHandle* live = AsLiveHandle(in_data, handle);
+    return live ? *live->data : nullptr;
+}
 
-        DebugLog("Pre-computed warped frame %d", f);
+// Premiere tells us which of the formats registered in GlobalSetup it picked for this render
+static MoshPixelFormat PixelFormatForWorld(PF_InData* in_data, PF_LayerDef* world) {
+    PrPixelFormat prFormat = PrPixelFormat_BGRA_4444_32f;
+    if (in_data->appl_id == 'PrMr') {
+        AEFX_SuiteScoper<PF_PixelFormatSuite1, true> pixelFormatSuite(
+            in_data, kPFPixelFormatSuite, kPFPixelFormatSuiteVersion1);
+        if (pixelFormatSuite.get()) {
+            (*pixelFormatSuite->GetPixelFormat)(world, &prFormat);
+        }
     }
 
-    // Mark pre-computation as complete
-    seqData->analysisState = AnalysisState::Complete;
-    DebugLog("Pre-computation complete for %d frames", duration);
+    switch (prFormat) {
+        case PrPixelFormat_BGRA_4444_8u:  return MoshPixelFormat::BGRA_8u;
+        case PrPixelFormat_VUYA_4444_8u:  return MoshPixelFormat::VUYA_8u;
+        case PrPixelFormat_VUYA_4444_32f: return MoshPixelFormat::VUYA_32f;
+        default:                          return MoshPixelFormat::BGRA_32f;
+    }
 }
 
 static PF_Err Render(PF_InData* in_data, PF_OutData* out_data, PF_ParamDef* params[], PF_LayerDef* output) {
+    MoshStatScope timer(MOSH_TIMER_RENDER);
     PF_LayerDef* src = &params[MOSH_INPUT]->u.ld;
     int width = src->width;
     int height = src->height;
@@ -365,170 +3334,373 @@ static PF_Err Render(PF_InData* in_data, PF_OutData* out_data, PF_ParamDef* para
         return PF_Err_NONE;
     }
 
-    int32_t moshFrame = params[MOSH_FRAME]->u.sd.value;
-    int32_t duration = params[MOSH_DURATION]->u.sd.value;
-    int32_t blockSize = BlockSizeFromIndex(params[MOSH_BLOCK_SIZE]->u.pd.value);
-    float blend = (float)params[MOSH_BLEND]->u.fs_d.value / 100.0f;
-    int32_t currentFrame = (in_data->time_step > 0) ? (int32_t)(in_data->current_time / in_data->time_step) : 0;
+    MoshRenderParams p;
+    ReadMoshParams(in_data, params, &p);
+    int32_t currentFrame = CurrentFrameNumber(in_data);
 
-    // Get sequence data
-    MoshSequenceData* seqData = nullptr;
-    if (in_data->sequence_data) {
-        seqData = *((MoshSequenceData**)(*in_data->sequence_data));
-    }
+    // Get sequence data - the reference keeps it alive even if SequenceSetdown runs meanwhile
+    std::shared_ptr<MoshSequenceData> seqData = GetSequenceData(in_data);
 
     if (!seqData) {
         // No sequence data - just passthrough
         return PF_Err_NONE;
     }
 
-    // Lock global mutex for thread-safe access to cache
-    // Using global mutex because seqData can be deleted by SequenceSetdown
-    std::lock_guard<std::mutex> lock(g_seqDataMutex);
-
-    // Check if parameters changed - clear cache if so
-    if (seqData->analyzedMoshFrame != moshFrame || seqData->analyzedDuration != duration ||
-        seqData->analyzedBlockSize != blockSize) {
-        DebugLog("Parameters changed, clearing cache");
-        seqData->accumulatedFrames.clear();
-        seqData->referenceFrame.Clear();
-        seqData->analyzedMoshFrame = moshFrame;
-        seqData->analyzedDuration = duration;
-        seqData->analyzedBlockSize = blockSize;
-        seqData->analysisState = AnalysisState::NotStarted;
+    // Only the extent hint needs rendering (USE_OUTPUT_EXTENT); the rest of output is left alone.
+    // A host that leaves the hint empty gets the whole frame.
+    MoshPixelFormat format = PixelFormatForWorld(in_data, output);
+    PF_Rect extent = output->extent_hint;
+    if (extent.left >= extent.right || extent.top >= extent.bottom) {
+        extent.left = extent.top = 0;
+        extent.right = output->width;
+        extent.bottom = output->height;
     }
-
-    // Cache current input frame (use frame number as key)
-    if (seqData->accumulatedFrames.find(currentFrame) == seqData->accumulatedFrames.end()) {
-        AccumulatedFrame& cached = seqData->accumulatedFrames[currentFrame];
-        CopyFrameToAccumulated(src, cached);
-        cached.frameIndex = currentFrame;
-        DebugLog("Cached input frame %d (total cached: %zu)", currentFrame, seqData->accumulatedFrames.size());
+    extent.left = std::max(extent.left, (A_long)0);
+    extent.top = std::max(extent.top, (A_long)0);
+    extent.right = std::min(extent.right, std::min(output->width, (A_long)width));
+    extent.bottom = std::min(extent.bottom, std::min(output->height, (A_long)height));
+    if (extent.left >= extent.right || extent.top >= extent.bottom) {
+        return PF_Err_NONE;
     }
 
-    // Store reference frame (frame before mosh starts)
-    if (currentFrame == moshFrame - 1 && !seqData->referenceFrame.valid) {
-        CopyFrameToAccumulated(src, seqData->referenceFrame);
-        seqData->referenceFrame.frameIndex = currentFrame;
-        DebugLog("Stored reference frame %d", currentFrame);
-    }
+    PF_LayerDef outputExtent = *output;
+    outputExtent.data = (PF_PixelPtr)(WorldRow(output, extent.top) + extent.left * MoshBytesPerPixel(format));
+    outputExtent.width = extent.right - extent.left;
+    outputExtent.height = extent.bottom - extent.top;
 
-    // Not in mosh range - passthrough
-    if (currentFrame < moshFrame || currentFrame >= moshFrame + duration) {
-        int srcAbsRowbytes = src->rowbytes < 0 ? -src->rowbytes : src->rowbytes;
-        int outAbsRowbytes = output->rowbytes < 0 ? -output->rowbytes : output->rowbytes;
-        for (int y = 0; y < height; ++y) {
-            const char* srcRow = (src->rowbytes < 0)
-                ? (const char*)src->data - y * srcAbsRowbytes
-                : (const char*)src->data + y * srcAbsRowbytes;
-            char* dstRow = (output->rowbytes < 0)
-                ? (char*)output->data - y * outAbsRowbytes
-                : (char*)output->data + y * outAbsRowbytes;
-            memcpy(dstRow, srcRow, width * 4 * sizeof(float));
-        }
-        return PF_Err_NONE;
-    }
+    MoshWorldView srcView = { src, 0, 0 };
+    MoshWorldView outView = { &outputExtent, extent.left, extent.top };
+    return RenderMoshFrame(in_data, seqData.get(), p, currentFrame, format,
+                           srcView, outView, width, height, true, true, MoshHostFrames());
+}
+
+//==============================================================================
+// SMARTFX (After Effects)
+//==============================================================================
+
+// Checkout IDs for SMART_PRE_RENDER / SMART_RENDER
+enum {
+    CHECKOUT_ID_CURRENT = 0,        // current frame, output request rect
+    CHECKOUT_ID_CURRENT_FULL,       // current frame, full frame (only when it must be cached or streamed)
+    CHECKOUT_ID_INPUT_BASE          // other mosh-range inputs, CHECKOUT_ID_INPUT_BASE + i
+};
+
+// Handed from SMART_PRE_RENDER to SMART_RENDER
+struct MoshPreRenderData {
+    MoshRenderParams params;
+    int32_t currentFrame;
+    PF_LRect fullRect;                  // max result rect of the input - the cached frame area
+    PF_LRect inputRect;                 // rect of the CHECKOUT_ID_CURRENT checkout
+    PF_LRect resultRect;                // what we promised to render
+    bool currentFullFrame;              // CHECKOUT_ID_CURRENT_FULL was checked out
+    std::vector<int32_t> inputFrames;   // frames checked out at CHECKOUT_ID_INPUT_BASE + i
+    std::vector<int32_t> streamFrames;  // frames a stream catches up through, checked out after them
+};
+
+static void DeletePreRenderData(void* pre_render_data) {
+    delete (MoshPreRenderData*)pre_render_data;
+}
+
+static inline bool IsEmptyLRect(const PF_LRect& r) {
+    return r.left >= r.right || r.top >= r.bottom;
+}
+
+static inline PF_LRect IntersectLRect(const PF_LRect& a, const PF_LRect& b) {
+    PF_LRect r;
+    r.left = std::max(a.left, b.left);
+    r.top = std::max(a.top, b.top);
+    r.right = std::min(a.right, b.right);
+    r.bottom = std::min(a.bottom, b.bottom);
+    return r;
+}
 
-    // In mosh range - check if pre-computation is done
-    int32_t warpedKey = WarpedKey(currentFrame);
-    bool hasPrecomputed = seqData->accumulatedFrames.find(warpedKey) != seqData->accumulatedFrames.end();
+static inline bool LRectContains(const PF_LRect& outer, const PF_LRect& inner) {
+    return IsEmptyLRect(inner) || (inner.left >= outer.left && inner.top >= outer.top &&
+                                   inner.right <= outer.right && inner.bottom <= outer.bottom);
+}
+
+static PF_Err CheckoutMoshParams(PF_InData* in_data, MoshRenderParams* p) {
+    PF_Err err = PF_Err_NONE, err2 = PF_Err_NONE;
+    PF_ParamDef param;
+
+    AEFX_CLR_STRUCT(param);
+    ERR(PF_CHECKOUT_PARAM(in_data, MOSH_FRAME, in_data->current_time, in_data->time_step, in_data->time_scale, &param));
+    p->moshFrame = param.u.sd.value;
+    ERR2(PF_CHECKIN_PARAM(in_data, &param));
+
+    AEFX_CLR_STRUCT(param);
+    ERR(PF_CHECKOUT_PARAM(in_data, MOSH_DURATION, in_data->current_time, in_data->time_step, in_data->time_scale, &param));
+    p->duration = param.u.sd.value;
+    ERR2(PF_CHECKIN_PARAM(in_data, &param));
+
+    AEFX_CLR_STRUCT(param);
+    ERR(PF_CHECKOUT_PARAM(in_data, MOSH_BLOCK_SIZE, in_data->current_time, in_data->time_step, in_data->time_scale, &param));
+    p->blockSize = BlockSizeFromIndex(param.u.pd.value);
+    ERR2(PF_CHECKIN_PARAM(in_data, &param));
+
+    AEFX_CLR_STRUCT(param);
+    ERR(PF_CHECKOUT_PARAM(in_data, MOSH_BLEND, in_data->current_time, in_data->time_step, in_data->time_scale, &param));
+    p->blend = (float)param.u.fs_d.value / 100.0f;
+    ERR2(PF_CHECKIN_PARAM(in_data, &param));
+
+    AEFX_CLR_STRUCT(param);
+    ERR(PF_CHECKOUT_PARAM(in_data, MOSH_HALF_CACHE, in_data->current_time, in_data->time_step, in_data->time_scale, &param));
+    p->halfCache = param.u.bd.value != 0;
+    ERR2(PF_CHECKIN_PARAM(in_data, &param));
+
+    p->scale = DownsampleScale(in_data);
+    p->draft = in_data->quality == PF_Quality_LO;
+    return err ? err : err2;
+}
 
-    if (hasPrecomputed) {
-        // Use pre-computed result
-        AccumulatedFrame& warpedResult = seqData->accumulatedFrames[warpedKey];
+static MoshPixelFormat PixelFormatForBitDepth(A_short bitdepth) {
+    switch (bitdepth) {
+        case 8:  return MoshPixelFormat::ARGB_8u;
+        case 16: return MoshPixelFormat::ARGB_16u;
+        default: return MoshPixelFormat::ARGB_32f;
+    }
+}
 
-        int outAbsRowbytes = output->rowbytes < 0 ? -output->rowbytes : output->rowbytes;
-        int srcAbsRowbytes = src->rowbytes < 0 ? -src->rowbytes : src->rowbytes;
+static PF_Err SmartPreRender(PF_InData* in_data, PF_OutData* out_data, PF_PreRenderExtra* extra) {
+    PF_Err err = PF_Err_NONE;
+    PF_RenderRequest req = extra->input->output_request;
+    PF_CheckoutResult in_result;
+    AEFX_CLR_STRUCT(in_result);
+
+    MoshPreRenderData* preRender = new MoshPreRenderData();
+    preRender->currentFrame = CurrentFrameNumber(in_data);
+    preRender->currentFullFrame = false;
+    extra->output->pre_render_data = preRender;
+    extra->output->delete_pre_render_data_func = DeletePreRenderData;
+
+    ERR(CheckoutMoshParams(in_data, &preRender->params));
+
+    // The current frame is needed for whatever part of the output was requested
+    ERR(extra->cb->checkout_layer(in_data->effect_ref, MOSH_INPUT, CHECKOUT_ID_CURRENT, &req,
+        in_data->current_time, in_data->time_step, in_data->time_scale, &in_result));
+    if (err) {
+        return err;
+    }
 
-        for (int y = 0; y < height; ++y) {
-            const float* srcRow = (const float*)((src->rowbytes < 0)
-                ? (const char*)src->data - y * srcAbsRowbytes
-                : (const char*)src->data + y * srcAbsRowbytes);
-            const float* accRow = warpedResult.pixelData.data() + y * width * 4;
-            float* outRow = (float*)((output->rowbytes < 0)
-                ? (char*)output->data - y * outAbsRowbytes
-                : (char*)output->data + y * outAbsRowbytes);
+    preRender->fullRect = in_result.max_result_rect;
+    preRender->inputRect = in_result.result_rect;
+
+    const MoshRenderParams& p = preRender->params;
+    int32_t currentFrame = preRender->currentFrame;
+    bool inMoshRange = currentFrame >= p.moshFrame && currentFrame < p.moshFrame + p.duration;
+
+    // Mosh frames can produce any part of the frame; everything else is a passthrough
+    preRender->resultRect = inMoshRange
+        ? IntersectLRect(req.rect, in_result.max_result_rect)
+        : in_result.result_rect;
+    extra->output->result_rect = preRender->resultRect;
+    extra->output->max_result_rect = in_result.max_result_rect;
+
+    // Work out which full frames the analysis still needs, without holding the lock during checkouts.
+    // Hosts that skip empty pixels can hand back less input than we promised to render; the
+    // source for the rest comes from the full frame.
+    std::vector<int32_t> missing, streamMissing;
+    bool currentMissing = !LRectContains(preRender->inputRect, preRender->resultRect);
+    std::shared_ptr<MoshSequenceData> seqData = GetSequenceData(in_data);
+    if (seqData && !IsEmptyLRect(preRender->fullRect)) {
+        std::unique_lock<std::mutex> lock(seqData->cacheMutex, std::defer_lock);
+        MoshStatLock(lock);
+
+        // Source frames survive parameter changes, the flow survives range changes, the warped
+        // frames survive Duration changes (frames in range depend only on what comes before them)
+        bool framesMatch = seqData->analyzedFormat == PixelFormatForBitDepth(extra->input->bitdepth);
+        bool flowMatches = seqData->analyzedBlockSize == p.blockSize;
+        bool paramsMatch = flowMatches && seqData->analyzedMoshFrame == p.moshFrame;
+        bool feedsMoshRange = currentFrame >= p.moshFrame - 1 && currentFrame < p.moshFrame + p.duration;
+
+        // Frames are cached per resolution - the full rect is the frame size at this downsample
+        int fullWidth = preRender->fullRect.right - preRender->fullRect.left;
+        int fullHeight = preRender->fullRect.bottom - preRender->fullRect.top;
+        const MoshFrameCache& frames = seqData->FramesAt(fullWidth, fullHeight);
+        bool precomputed = framesMatch && paramsMatch &&
+            frames.warpedFrames.find(currentFrame) != frames.warpedFrames.end();
+
+        // Known motion fields leave the reference frame, plus the pairs past the warped prefix
+        // whose flow is missing
+        int32_t flowFirst = p.moshFrame, flowEnd = p.moshFrame + p.duration;
+        int32_t prefix = framesMatch ? WarpedPrefix(seqData.get(), p, fullWidth, fullHeight) : 0;
+        if (flowMatches &&
+            !MissingFlowRange(seqData.get(), p, fullWidth, fullHeight, prefix, &flowFirst, &flowEnd)) {
+            flowFirst = flowEnd = p.moshFrame;
+        }
 
-            for (int x = 0; x < width; ++x) {
-                outRow[x*4+0] = srcRow[x*4+0] * (1.0f - blend) + accRow[x*4+0] * blend;
-                outRow[x*4+1] = srcRow[x*4+1] * (1.0f - blend) + accRow[x*4+1] * blend;
-                outRow[x*4+2] = srcRow[x*4+2] * (1.0f - blend) + accRow[x*4+2] * blend;
-                outRow[x*4+3] = srcRow[x*4+3] * (1.0f - blend) + accRow[x*4+3] * blend;
+        // A streamed frame needs itself in full, plus the reference when it starts the stream and
+        // the source frames it catches up through. Frames of another format are dropped before the
+        // render, which then streams from the reference with nothing cached.
+        bool streams = framesMatch ? StreamsFrame(seqData.get(), p, currentFrame, fullWidth, fullHeight)
+                                   : inMoshRange && !p.draft;
+        if (streams && !precomputed) {
+            currentMissing = true;
+            if (framesMatch) {
+                bool referenceCached = frames.inputFrames.find(p.moshFrame - 1) != frames.inputFrames.end();
+                if (!referenceCached &&
+                    StreamStartFrame(seqData.get(), p, currentFrame, fullWidth, fullHeight) < p.moshFrame) {
+                    missing.push_back(p.moshFrame - 1);
+                }
+                StreamMissingInputs(seqData.get(), p, currentFrame, fullWidth, fullHeight, &streamMissing);
+            } else {
+                missing.push_back(p.moshFrame - 1);
+                for (int32_t f = p.moshFrame; f < currentFrame; ++f) {
+                    streamMissing.push_back(f);
+                }
+            }
+        } else if (feedsMoshRange && !precomputed) {
+            for (int32_t f = p.moshFrame - 1; f < std::max(flowEnd, p.moshFrame); ++f) {
+                if (f >= p.moshFrame && f < flowFirst) {
+                    continue;
+                }
+                bool cached = framesMatch && frames.inputFrames.find(f) != frames.inputFrames.end();
+                if (cached) {
+                    continue;
+                }
+                if (f == currentFrame) {
+                    currentMissing = true;
+                } else if (inMoshRange) {
+                    missing.push_back(f);
+                }
             }
         }
+    }
 
-        DebugLog("Render frame %d using pre-computed result", currentFrame);
-        return PF_Err_NONE;
+    PF_RenderRequest fullReq = req;
+    fullReq.rect = preRender->fullRect;
+
+    if (currentMissing) {
+        PF_CheckoutResult full_result;
+        ERR(extra->cb->checkout_layer(in_data->effect_ref, MOSH_INPUT, CHECKOUT_ID_CURRENT_FULL, &fullReq,
+            in_data->current_time, in_data->time_step, in_data->time_scale, &full_result));
+        preRender->currentFullFrame = !err;
     }
 
-    // Check if we have all required input frames to do pre-computation
-    bool hasAllInputs = seqData->referenceFrame.valid;
-    if (hasAllInputs) {
-        for (int32_t f = moshFrame - 1; f < moshFrame + duration; ++f) {
-            if (seqData->accumulatedFrames.find(f) == seqData->accumulatedFrames.end()) {
-                hasAllInputs = false;
-                DebugLog("Missing input frame %d for pre-computation", f);
-                break;
-            }
+    for (size_t i = 0; i < missing.size() && !err; ++i) {
+        PF_CheckoutResult frame_result;
+        ERR(extra->cb->checkout_layer(in_data->effect_ref, MOSH_INPUT, CHECKOUT_ID_INPUT_BASE + (A_long)i, &fullReq,
+            missing[i] * in_data->time_step, in_data->time_step, in_data->time_scale, &frame_result));
+        if (!err) {
+            preRender->inputFrames.push_back(missing[i]);
+        }
+    }
+    for (size_t i = 0; i < streamMissing.size() && !err; ++i) {
+        PF_CheckoutResult frame_result;
+        A_long checkoutId = CHECKOUT_ID_INPUT_BASE + (A_long)(preRender->inputFrames.size() + i);
+        ERR(extra->cb->checkout_layer(in_data->effect_ref, MOSH_INPUT, checkoutId, &fullReq,
+            streamMissing[i] * in_data->time_step, in_data->time_step, in_data->time_scale, &frame_result));
+        if (!err) {
+            preRender->streamFrames.push_back(streamMissing[i]);
         }
     }
 
-    if (hasAllInputs && seqData->analysisState != AnalysisState::Complete) {
-        // All inputs cached - do pre-computation now
-        PrecomputeWarpedFrames(seqData, moshFrame, duration, blockSize, width, height);
+    return err;
+}
+
+static PF_Err SmartRender(PF_InData* in_data, PF_OutData* out_data, PF_SmartRenderExtra* extra) {
+    MoshStatScope timer(MOSH_TIMER_RENDER);
+    PF_Err err = PF_Err_NONE, err2 = PF_Err_NONE;
+    MoshPreRenderData* preRender = (MoshPreRenderData*)extra->input->pre_render_data;
+    if (!preRender) {
+        return PF_Err_INTERNAL_STRUCT_DAMAGED;
+    }
 
-        // Now use the pre-computed result for this frame
-        warpedKey = WarpedKey(currentFrame);
-        if (seqData->accumulatedFrames.find(warpedKey) != seqData->accumulatedFrames.end()) {
-            AccumulatedFrame& warpedResult = seqData->accumulatedFrames[warpedKey];
+    const MoshRenderParams& p = preRender->params;
+    MoshPixelFormat format = PixelFormatForBitDepth(extra->input->bitdepth);
+    int width = preRender->fullRect.right - preRender->fullRect.left;
+    int height = preRender->fullRect.bottom - preRender->fullRect.top;
 
-            int outAbsRowbytes = output->rowbytes < 0 ? -output->rowbytes : output->rowbytes;
-            int srcAbsRowbytes = src->rowbytes < 0 ? -src->rowbytes : src->rowbytes;
+    PF_EffectWorld* inputWorld = nullptr;
+    PF_EffectWorld* fullWorld = nullptr;
+    PF_EffectWorld* outputWorld = nullptr;
 
-            for (int y = 0; y < height; ++y) {
-                const float* srcRow = (const float*)((src->rowbytes < 0)
-                    ? (const char*)src->data - y * srcAbsRowbytes
-                    : (const char*)src->data + y * srcAbsRowbytes);
-                const float* accRow = warpedResult.pixelData.data() + y * width * 4;
-                float* outRow = (float*)((output->rowbytes < 0)
-                    ? (char*)output->data - y * outAbsRowbytes
-                    : (char*)output->data + y * outAbsRowbytes);
-
-                for (int x = 0; x < width; ++x) {
-                    outRow[x*4+0] = srcRow[x*4+0] * (1.0f - blend) + accRow[x*4+0] * blend;
-                    outRow[x*4+1] = srcRow[x*4+1] * (1.0f - blend) + accRow[x*4+1] * blend;
-                    outRow[x*4+2] = srcRow[x*4+2] * (1.0f - blend) + accRow[x*4+2] * blend;
-                    outRow[x*4+3] = srcRow[x*4+3] * (1.0f - blend) + accRow[x*4+3] * blend;
-                }
+    ERR(extra->cb->checkout_layer_pixels(in_data->effect_ref, CHECKOUT_ID_CURRENT, &inputWorld));
+    if (!err && preRender->currentFullFrame) {
+        ERR(extra->cb->checkout_layer_pixels(in_data->effect_ref, CHECKOUT_ID_CURRENT_FULL, &fullWorld));
+    }
+    ERR(extra->cb->checkout_output(in_data->effect_ref, &outputWorld));
+
+    std::shared_ptr<MoshSequenceData> seqData = GetSequenceData(in_data);
+    if (!err && inputWorld && outputWorld && seqData) {
+        // Convert the temporal inputs before taking the lock; they never change once checked out
+        std::vector<FrameSnapshot> fetched;
+        std::vector<int32_t> fetchedIndices;
+        for (size_t i = 0; i < preRender->inputFrames.size() && !err; ++i) {
+            PF_EffectWorld* frameWorld = nullptr;
+            A_long checkoutId = CHECKOUT_ID_INPUT_BASE + (A_long)i;
+            ERR(extra->cb->checkout_layer_pixels(in_data->effect_ref, checkoutId, &frameWorld));
+            if (!err && frameWorld && frameWorld->width == width && frameWorld->height == height) {
+                fetched.push_back(CacheSourceFrame(frameWorld, preRender->inputFrames[i], format,
+                                                   CachesHalfFloat(p, format)));
+                fetchedIndices.push_back(preRender->inputFrames[i]);
             }
-
-            DebugLog("Render frame %d after pre-computation", currentFrame);
-            return PF_Err_NONE;
+            ERR2(extra->cb->checkin_layer_pixels(in_data->effect_ref, checkoutId));
         }
-    }
 
-    // Still collecting input frames - output cyan tint to indicate analysis in progress
-    DebugLog("Collecting input frames, outputting cyan tint for frame %d", currentFrame);
-    int outAbsRowbytes = output->rowbytes < 0 ? -output->rowbytes : output->rowbytes;
-    int srcAbsRowbytes = src->rowbytes < 0 ? -src->rowbytes : src->rowbytes;
+        // A stream reads the frames it catches up through in place, one at a time, so they stay
+        // checked out until the render is done instead of being cached
+        MoshHostFrames hostFrames;
+        A_long streamCheckoutBase = CHECKOUT_ID_INPUT_BASE + (A_long)preRender->inputFrames.size();
+        size_t streamCheckouts = 0;
+        for (; streamCheckouts < preRender->streamFrames.size() && !err; ++streamCheckouts) {
+            PF_EffectWorld* frameWorld = nullptr;
+            ERR(extra->cb->checkout_layer_pixels(in_data->effect_ref,
+                                                 streamCheckoutBase + (A_long)streamCheckouts, &frameWorld));
+            if (!err && frameWorld && frameWorld->width == width && frameWorld->height == height) {
+                hostFrames[preRender->streamFrames[streamCheckouts]] = frameWorld;
+            }
+        }
 
-    for (int y = 0; y < height; ++y) {
-        const float* srcRow = (const float*)((src->rowbytes < 0)
-            ? (const char*)src->data - y * srcAbsRowbytes
-            : (const char*)src->data + y * srcAbsRowbytes);
-        float* outRow = (float*)((output->rowbytes < 0)
-            ? (char*)output->data - y * outAbsRowbytes
-            : (char*)output->data + y * outAbsRowbytes);
+        if (!err) {
+            {
+                std::unique_lock<std::mutex> lock(seqData->cacheMutex, std::defer_lock);
+                MoshStatLock(lock);
+                InvalidateForParams(seqData.get(), p, format);
+                MoshFrameCache& frames = seqData->FramesAt(width, height);
+                for (size_t i = 0; i < fetched.size(); ++i) {
+                    if (frames.inputFrames.emplace(fetchedIndices[i], fetched[i]).second) {
+                        MoshStatAdd(MOSH_STAT_BYTES_CACHED, fetched[i]->CachedBytes());
+                    }
+                }
+            }
 
-        for (int x = 0; x < width; ++x) {
-            // Cyan tint: boost G and B, reduce R
-            outRow[x*4+0] = srcRow[x*4+0] * 1.0f + 0.2f;  // B boosted
-            outRow[x*4+1] = srcRow[x*4+1] * 1.0f + 0.2f;  // G boosted
-            outRow[x*4+2] = srcRow[x*4+2] * 0.5f;          // R reduced
-            outRow[x*4+3] = srcRow[x*4+3];  // A unchanged
+            // Prefer the full-frame checkout as the source so the current frame gets cached too
+            MoshWorldView srcView = { inputWorld,
+                preRender->inputRect.left - preRender->fullRect.left,
+                preRender->inputRect.top - preRender->fullRect.top };
+            if (fullWorld && fullWorld->width == width && fullWorld->height == height) {
+                srcView = { fullWorld, 0, 0 };
+            }
+            MoshWorldView outView = { outputWorld,
+                preRender->resultRect.left - preRender->fullRect.left,
+                preRender->resultRect.top - preRender->fullRect.top };
+
+            bool srcIsFullFrame = srcView.world == fullWorld ||
+                (inputWorld->width == width && inputWorld->height == height);
+            err = RenderMoshFrame(in_data, seqData.get(), p, preRender->currentFrame, format,
+                                  srcView, outView, width, height, srcIsFullFrame, false, hostFrames);
+        }
+        for (size_t i = 0; i < streamCheckouts; ++i) {
+            ERR2(extra->cb->checkin_layer_pixels(in_data->effect_ref, streamCheckoutBase + (A_long)i));
+        }
+    } else if (!err && inputWorld && outputWorld) {
+        // No sequence data - just passthrough
+        MoshWorldView srcView = { inputWorld, preRender->inputRect.left, preRender->inputRect.top };
+        if (fullWorld) {
+            srcView = { fullWorld, preRender->fullRect.left, preRender->fullRect.top };
         }
+        MoshWorldView outView = { outputWorld, preRender->resultRect.left, preRender->resultRect.top };
+        MoshStatAdd(MOSH_STAT_FRAMES_PASSTHROUGH);
+        PassthroughToOutput(in_data, srcView, outView, format);
     }
-    return PF_Err_NONE;
+
+    ERR2(extra->cb->checkin_layer_pixels(in_data->effect_ref, CHECKOUT_ID_CURRENT));
+    if (preRender->currentFullFrame) {
+        ERR2(extra->cb->checkin_layer_pixels(in_data->effect_ref, CHECKOUT_ID_CURRENT_FULL));
+    }
+
+    return err ? err : err2;
 }
 
 // Main entry point
@@ -554,20 +3726,32 @@ DllExport PF_Err EffectMain(PF_Cmd cmd, PF_InData* in_data, PF_OutData* out_data
             case PF_Cmd_SEQUENCE_SETUP:
                 err = SequenceSetup(in_data, out_data);
                 break;
+            case PF_Cmd_SEQUENCE_RESETUP:
+                err = SequenceResetup(in_data, out_data);
+                break;
             case PF_Cmd_SEQUENCE_SETDOWN:
                 err = SequenceSetdown(in_data, out_data);
                 break;
             case PF_Cmd_SEQUENCE_FLATTEN:
                 err = SequenceFlatten(in_data, out_data);
                 break;
+            case PF_Cmd_GET_FLATTENED_SEQUENCE_DATA:
+                err = GetFlattenedSequenceData(in_data, out_data);
+                break;
             case PF_Cmd_RENDER:
                 err = Render(in_data, out_data, params, output);
                 break;
+            case PF_Cmd_SMART_PRE_RENDER:
+                err = SmartPreRender(in_data, out_data, (PF_PreRenderExtra*)extra);
+                break;
+            case PF_Cmd_SMART_RENDER:
+                err = SmartRender(in_data, out_data, (PF_SmartRenderExtra*)extra);
+                break;
             default:
                 break;
         }
     } catch (...) {
-        DebugLog("Exception in EffectMain cmd=%d", cmd);
+        MOSH_LOG_ERROR("Exception in EffectMain cmd=%d", cmd);
         err = PF_Err_INTERNAL_STRUCT_DAMAGED;
     }
 
@@ -33,7 +33,10 @@
 #include <cmath>
 #include <algorithm>
 #include <cstring>
+#include <cstdint>
 #include <mutex>
+#include <memory>
+#include <condition_variable>
 
 // Plugin info
 #define PLUGIN_NAME         "MoshBrosh"
@@ -56,6 +59,7 @@ enum {
     MOSH_BLOCK_SIZE,
     MOSH_SEARCH_RANGE,
     MOSH_BLEND,
+    MOSH_HALF_CACHE,
     MOSH_NUM_PARAMS
 };
 
@@ -65,9 +69,13 @@ enum {
     DISK_ID_DURATION,
     DISK_ID_BLOCK_SIZE,
     DISK_ID_SEARCH_RANGE,
-    DISK_ID_BLEND
+    DISK_ID_BLEND,
+    DISK_ID_HALF_CACHE
 };
 
+// Flattened sequence data layout version (bump when MoshSequenceDataFlat changes)
+#define MOSH_SEQUENCE_DATA_VERSION 5
+
 // Parameter defaults and ranges
 #define MOSH_FRAME_DFLT         10
 #define MOSH_FRAME_MIN          1
@@ -85,6 +93,8 @@ enum {
 #define BLEND_MIN               0.0f
 #define BLEND_MAX               100.0f
 
+#define HALF_CACHE_DFLT         FALSE
+
 // Block size options (popup indices are 1-based)
 #define BLOCK_SIZE_8            1
 #define BLOCK_SIZE_16           2
@@ -108,11 +118,58 @@ typedef struct {
     PF_FpShort Pr, Pb, luma, alpha;
 } PF_Pixel_VUYA_32f;
 
+// Pixel formats the render paths understand. Cached frames keep the host world's format,
+// so the cache, flow and warp run natively on whatever the host hands us.
+enum class MoshPixelFormat : int32_t {
+    BGRA_32f = 0,   // Premiere (PrPixelFormat_BGRA_4444_32f)
+    ARGB_8u,        // After Effects 8 bpc (PF_PixelFormat_ARGB32)
+    ARGB_16u,       // After Effects 16 bpc (PF_PixelFormat_ARGB64)
+    ARGB_32f,       // After Effects 32 bpc (PF_PixelFormat_ARGB128)
+    BGRA_8u,        // Premiere (PrPixelFormat_BGRA_4444_8u)
+    VUYA_8u,        // Premiere (PrPixelFormat_VUYA_4444_8u)
+    VUYA_32f        // Premiere (PrPixelFormat_VUYA_4444_32f)
+};
+
+inline int32_t MoshBytesPerPixel(MoshPixelFormat format) {
+    switch (format) {
+        case MoshPixelFormat::ARGB_8u:
+        case MoshPixelFormat::BGRA_8u:
+        case MoshPixelFormat::VUYA_8u:  return 4;
+        case MoshPixelFormat::ARGB_16u: return 8;
+        default:                        return 16;
+    }
+}
+
+inline bool MoshIsFloatFormat(MoshPixelFormat format) {
+    return format == MoshPixelFormat::BGRA_32f || format == MoshPixelFormat::ARGB_32f ||
+           format == MoshPixelFormat::VUYA_32f;
+}
+
+// Bytes per cached pixel: float formats cached at half precision take 4 half floats
+inline int32_t MoshCachedBytesPerPixel(MoshPixelFormat format, bool halfFloat) {
+    return halfFloat ? 4 * (int32_t)sizeof(uint16_t) : MoshBytesPerPixel(format);
+}
+
+// Motion vectors are kept in quarter pixels, like a codec's; the warp moves whole blocks by
+// the nearest whole pixel, the fraction keeps scaled fields accurate
+#define MOSH_MV_SUBPIXEL_BITS   2
+#define MOSH_MV_UNITS_PER_PIXEL (1 << MOSH_MV_SUBPIXEL_BITS)
+
 // Motion vector for a single macroblock
 struct MotionVector {
-    int16_t dx;
+    int16_t dx;    // quarter pixels
     int16_t dy;
     uint32_t sad;  // Sum of Absolute Differences (match quality)
+
+    MotionVector() : dx(0), dy(0), sad(0) {}
+
+    // Whole-pixel displacement, rounded half away from zero
+    static int32_t ToPixels(int32_t units) {
+        const int32_t half = MOSH_MV_UNITS_PER_PIXEL / 2;
+        return units >= 0 ? (units + half) >> MOSH_MV_SUBPIXEL_BITS : -((-units + half) >> MOSH_MV_SUBPIXEL_BITS);
+    }
+    int32_t PixelDx() const { return ToPixels(dx); }
+    int32_t PixelDy() const { return ToPixels(dy); }
 };
 
 // Motion field for entire frame (grid of MVs)
@@ -125,6 +182,22 @@ struct MotionField {
     int32_t blocksY;
     std::vector<MotionVector> vectors;
 
+    MotionField() : frameIndex(0), width(0), height(0), blockSize(0), blocksX(0), blocksY(0) {}
+
+    void Allocate(int32_t w, int32_t h, int32_t block) {
+        width = w;
+        height = h;
+        blockSize = block;
+        blocksX = (w + block - 1) / block;
+        blocksY = (h + block - 1) / block;
+        vectors.assign(static_cast<size_t>(blocksX * blocksY), MotionVector());
+    }
+
+    bool Matches(int32_t w, int32_t h, int32_t block) const {
+        return width == w && height == h && blockSize == block &&
+               vectors.size() == static_cast<size_t>(blocksX * blocksY);
+    }
+
     size_t GetVectorIndex(int32_t bx, int32_t by) const {
         return static_cast<size_t>(by * blocksX + bx);
     }
@@ -137,27 +210,106 @@ struct MotionField {
     }
 };
 
+// One level of a source frame's flow pyramid: luma and its central-difference gradients,
+// width * height floats each. Level 0 is full resolution, each further level half the size.
+struct MoshFlowLevel {
+    int32_t width;
+    int32_t height;
+    std::vector<float> luma;
+    std::vector<float> gradX;
+    std::vector<float> gradY;
+
+    MoshFlowLevel() : width(0), height(0) {}
+
+    size_t Bytes() const {
+        return (luma.size() + gradX.size() + gradY.size()) * sizeof(float);
+    }
+};
+
+// Flow pyramid levels, finest first
+typedef std::vector<MoshFlowLevel> MoshFlowPyramid;
+
 // Accumulated frame buffer
 struct AccumulatedFrame {
     int32_t frameIndex;
     int32_t width;
     int32_t height;
     int32_t rowBytes;
-    std::vector<float> pixelData;  // BGRA 32f format
+    MoshPixelFormat format;          // channel order and depth of pixelData
+    std::vector<uint8_t> pixelData;  // height rows of rowBytes, 4 channels per pixel
+    bool halfFloat;                  // float format stored as IEEE half floats
     bool valid;
 
-    AccumulatedFrame() : frameIndex(0), width(0), height(0), rowBytes(0), valid(false) {}
+    // Flow pyramid of a source frame, built once when it is cached. Every frame is the "curr" of
+    // one pair and the "prev" of the next, so the flow reads these instead of converting pixels.
+    // Shared with the frame's packed copy; null on warped frames.
+    std::shared_ptr<const MoshFlowPyramid> flowPyramid;
+
+    // Packed copy of a source frame nobody reads the pixels of (see MoshPack.h): pixelData is
+    // empty, packedPixels holds it compressed. Content checks use the sampled pixels and the hash
+    // it was cached with, so only the reference frame ever needs unpacking.
+    std::vector<uint8_t> packedPixels;
+    std::vector<uint8_t> packedSamples;     // the pixels SourceMatchesCached compares, as cached
+
+    // Hash of the host pixels a source frame was cached from; 0 on warped frames. Source frames
+    // are shared between instances by it (MoshFrameRegistry), so one may sit at another frame
+    // number than frameIndex in some instance's cache.
+    uint64_t contentHash;
 
-    void Allocate(int32_t w, int32_t h) {
+    AccumulatedFrame() : frameIndex(0), width(0), height(0), rowBytes(0),
+        format(MoshPixelFormat::BGRA_32f), halfFloat(false), valid(false), contentHash(0) {}
+
+    void Allocate(int32_t w, int32_t h, MoshPixelFormat fmt, bool half = false) {
         width = w;
         height = h;
-        rowBytes = w * 4 * sizeof(float);
-        pixelData.resize(static_cast<size_t>(w * h * 4), 0.0f);
+        format = fmt;
+        halfFloat = half && MoshIsFloatFormat(fmt);
+        rowBytes = w * PixelBytes();
+        pixelData.assign(static_cast<size_t>(rowBytes) * h, 0);
         valid = true;
     }
 
+    int32_t PixelBytes() const {
+        return MoshCachedBytesPerPixel(format, halfFloat);
+    }
+
+    template<typename ChannelT>
+    const ChannelT* Row(int32_t y) const {
+        return reinterpret_cast<const ChannelT*>(pixelData.data() + static_cast<size_t>(y) * rowBytes);
+    }
+
+    template<typename ChannelT>
+    ChannelT* Row(int32_t y) {
+        return reinterpret_cast<ChannelT*>(pixelData.data() + static_cast<size_t>(y) * rowBytes);
+    }
+
+    bool IsPacked() const {
+        return !packedPixels.empty();
+    }
+
+    const MoshFlowLevel& FlowLevel(size_t level) const {
+        return (*flowPyramid)[level];
+    }
+
+    size_t FlowLevels() const {
+        return flowPyramid ? flowPyramid->size() : 0;
+    }
+
+    // Pixels (packed or not) plus flow pyramid, for the cache statistics
+    size_t CachedBytes() const {
+        size_t bytes = pixelData.size() + packedPixels.size() + packedSamples.size();
+        for (size_t l = 0; l < FlowLevels(); ++l) {
+            bytes += FlowLevel(l).Bytes();
+        }
+        return bytes;
+    }
+
     void Clear() {
         pixelData.clear();
+        flowPyramid.reset();
+        packedPixels.clear();
+        packedSamples.clear();
+        contentHash = 0;
         valid = false;
         frameIndex = 0;
         width = height = rowBytes = 0;
@@ -172,34 +324,106 @@ enum class AnalysisState : int32_t {
     Invalid = 3
 };
 
-// Sequence data - persists with the project
-struct MoshSequenceData {
+// Cached frames are immutable once published; render threads - and, for source frames, other
+// instances - share them by reference
+typedef std::shared_ptr<const AccumulatedFrame> FrameSnapshot;
+
+// Cached pixels at one render resolution. Reduced-resolution playback renders the same frames
+// at a fraction of the size, so every size the host asks for keeps its own frames.
+struct MoshFrameCache {
+    // Source frames by frame number - they depend on no parameter, so they outlive every
+    // parameter change and only go when the source or pixel format changes
+    std::unordered_map<int32_t, FrameSnapshot> inputFrames;
+
+    // Warped frames by frame number, derived from the reference frame and the motion fields;
+    // dropped when Mosh Frame or Block Size changes, trimmed when Duration does
+    std::unordered_map<int32_t, FrameSnapshot> warpedFrames;
+
+    // Reference frame (frozen at mosh_frame - 1)
+    FrameSnapshot referenceFrame;
+};
+
+#define MOSH_STREAM_IDLE    INT32_MIN
+
+// Where renders walking the mosh range in order (an export, or playback) stand: each next frame is
+// one flow and one warp away from the last, so the stream itself holds just the last frame, plus
+// the few warped results before it that render threads finishing out of order may still ask for
+// (see RenderStreamed)
+struct MoshStream {
+    uint32_t generation;        // MoshSequenceData::generation it was built under
+    int32_t frame;              // last frame streamed
+    int32_t pendingFrame;       // frame being streamed right now, if not MOSH_STREAM_IDLE
+    int32_t width;
+    int32_t height;
+    FrameSnapshot input;        // source frame `frame`, flow pyramid only
+    FrameSnapshot warped;       // its warped result, before the blend
+    MotionField flow;           // the flow into `frame` as computed - the next pair's warm start
+    std::vector<FrameSnapshot> recent;  // warped results of the frames before `frame`, oldest first
+    uint64_t chainKey;          // disk cache key of the flow into `frame`, 0 when not on disk
+
+    MoshStream() : generation(0), frame(0), pendingFrame(MOSH_STREAM_IDLE), width(0), height(0),
+                   chainKey(0) {}
+};
+
+inline uint64_t MoshResolutionKey(int32_t width, int32_t height) {
+    return ((uint64_t)(uint32_t)width << 32) | (uint32_t)height;
+}
+
+// Motion fields at one render resolution by frame number
+typedef std::unordered_map<int32_t, MotionField> MotionFieldMap;
+
+// Sequence data - persists with the project. One instance is shared by every copy of the
+// sequence_data handle the host makes for its render threads (see MoshSequenceHandle).
+struct MoshSequenceData : std::enable_shared_from_this<MoshSequenceData> {
     uint32_t version;
     AnalysisState analysisState;
 
+    // Bumped on every invalidation; analysis started under an older generation is discarded
+    uint32_t generation;
+
     // Parameters at time of analysis (for invalidation detection)
     int32_t analyzedMoshFrame;
     int32_t analyzedDuration;
     int32_t analyzedBlockSize;
     int32_t analyzedSearchRange;
-    int32_t analyzedWidth;
+    int32_t analyzedWidth;      // working resolution: the largest the motion fields were computed at
     int32_t analyzedHeight;
 
-    // Cached motion fields: frameIndex -> MotionField
-    std::unordered_map<int32_t, MotionField> motionFields;
+    // Pixel format and precision of every cached frame (runtime only - caches aren't flattened)
+    MoshPixelFormat analyzedFormat;
+    bool analyzedHalfFloat;
 
-    // Accumulated frames for mosh range
-    std::unordered_map<int32_t, AccumulatedFrame> accumulatedFrames;
+    // Some motion fields or warped frames came from a draft-quality render (runtime only - draft
+    // flow is never saved); the next full-quality render drops them
+    bool analyzedDraft;
 
-    // Reference frame (frozen at mosh_frame - 1)
-    AccumulatedFrame referenceFrame;
+    // Cached motion fields per render resolution (MoshResolutionKey): frameIndex -> MotionField
+    // (motion from frameIndex - 1 to frameIndex). A size without a complete range of its own
+    // scales a finer one down, and switching preview resolution keeps every size's fields, so
+    // going back to a size never analyzes it again. Per-pair flow doesn't depend on the mosh
+    // range, so fields outside it are kept for when the range moves back. The working resolution
+    // is saved with the project, so a reopened project rebuilds the warp from the reference
+    // frame alone.
+    std::unordered_map<uint64_t, MotionFieldMap> motionFields;
+
+    // Cached frames per render resolution (MoshResolutionKey)
+    std::unordered_map<uint64_t, MoshFrameCache> frameCaches;
+
+    // Sequential renders, which leave nothing in frameCaches, and the frames renders are waiting
+    // on it for - it keeps their results until they are served
+    MoshStream stream;
+    std::vector<int32_t> streamWaiters;
 
-    // Mutex for thread-safe access (Premiere renders frames in parallel)
+    // Guards everything above. Held for lookups and publishing only, never during pixel work.
     std::mutex cacheMutex;
 
-    MoshSequenceData() : version(1), analysisState(AnalysisState::NotStarted),
-        analyzedMoshFrame(0), analyzedDuration(0), analyzedBlockSize(16),
-        analyzedSearchRange(16), analyzedWidth(0), analyzedHeight(0) {}
+    // Signalled when an in-progress analysis is published or abandoned
+    std::condition_variable analysisDone;
+
+    MoshSequenceData() : version(MOSH_SEQUENCE_DATA_VERSION), analysisState(AnalysisState::NotStarted),
+        generation(0), analyzedMoshFrame(0), analyzedDuration(0), analyzedBlockSize(16),
+        analyzedSearchRange(16), analyzedWidth(0), analyzedHeight(0),
+        analyzedFormat(MoshPixelFormat::BGRA_32f), analyzedHalfFloat(false), analyzedDraft(false) {}
 
     bool IsValidForParams(int32_t moshFrame, int32_t duration,
                           int32_t blockSize, int32_t searchRange,
@@ -215,17 +439,83 @@ struct MoshSequenceData {
 
     void Invalidate() {
         analysisState = AnalysisState::Invalid;
+        ++generation;
     }
 
-    void Clear() {
-        analysisState = AnalysisState::NotStarted;
+    MoshFrameCache& FramesAt(int32_t width, int32_t height) {
+        return frameCaches[MoshResolutionKey(width, height)];
+    }
+
+    // Fields computed at this size; the largest size with fields becomes the working resolution
+    MotionFieldMap& FieldsAt(int32_t width, int32_t height) {
+        if ((int64_t)width * height > (int64_t)analyzedWidth * analyzedHeight) {
+            analyzedWidth = width;
+            analyzedHeight = height;
+        }
+        return motionFields[MoshResolutionKey(width, height)];
+    }
+
+    void ClearMotionFields() {
         motionFields.clear();
-        accumulatedFrames.clear();
-        referenceFrame.Clear();
+        analyzedWidth = analyzedHeight = 0;
+    }
+
+    // Drop what was derived for the mosh range (warped frames, reference) but keep the source
+    // frames and motion fields
+    void ClearWarped() {
+        analysisState = AnalysisState::NotStarted;
+        ++generation;
+        for (auto& entry : frameCaches) {
+            entry.second.warpedFrames.clear();
+            entry.second.referenceFrame.reset();
+        }
+        stream = MoshStream();
+    }
+
+    // Drop warped frames from endFrame on but keep the reference and everything before it:
+    // warped frame f depends only on the reference and the flow up to f (Duration changed)
+    void TrimWarped(int32_t endFrame) {
+        analysisState = AnalysisState::NotStarted;
+        ++generation;
+        for (auto& entry : frameCaches) {
+            std::unordered_map<int32_t, FrameSnapshot>& warped = entry.second.warpedFrames;
+            for (auto it = warped.begin(); it != warped.end();) {
+                it = it->first >= endFrame ? warped.erase(it) : std::next(it);
+            }
+        }
+    }
+
+    // Drop cached pixels but keep motion fields (pixel format or precision changed, not the source)
+    void ClearFrames() {
+        analysisState = AnalysisState::NotStarted;
+        ++generation;
+        frameCaches.clear();
+        stream = MoshStream();
+    }
+
+    void Clear() {
+        ClearFrames();
+        ClearMotionFields();
+        analyzedDraft = false;
     }
 };
 
-// Flattened version for project serialization
+// Unflattened sequence_data handle contents: this copy's reference to the shared sequence data.
+// Copies the host makes for render threads (GET_FLATTENED_SEQUENCE_DATA + resetup) find the same
+// data by instanceId; a duplicated or pasted effect gets an instanceId of its own.
+#define MOSH_SEQUENCE_LIVE_TAG  0x4D427371  // 'MBsq' - never a valid flat version
+
+struct MoshSequenceHandle {
+    uint32_t tag;
+    uint64_t instanceId;
+    std::shared_ptr<MoshSequenceData>* data;
+};
+
+#define MOSH_FLAT_RENDER_COPY   0x1     // made by GET_FLATTENED_SEQUENCE_DATA for a render thread
+
+// Flattened version for project serialization. Motion fields are stored per field as varints:
+// frameIndex (zigzag), width, height, blockSize, then each block's dx/dy as zigzag deltas
+// from the previous block in raster order.
 struct MoshSequenceDataFlat {
     uint32_t version;
     int32_t analysisState;
@@ -235,10 +525,12 @@ struct MoshSequenceDataFlat {
     int32_t analyzedSearchRange;
     int32_t analyzedWidth;
     int32_t analyzedHeight;
+    uint64_t instanceId;
+    uint32_t flags;             // MOSH_FLAT_*
+    uint32_t motionFieldCount;
+    uint32_t motionFieldBytes;  // encoded motion fields follow the struct
 };
 
-#define MOSH_SEQUENCE_DATA_VERSION 1
-
 // Entry point declaration
 #ifdef __cplusplus
 extern "C" {
@@ -55,21 +55,27 @@ resource 'PiPL' (16000) {
         },
 
         /* [9] Effect Global OutFlags
-         * PF_OutFlag_PIX_INDEPENDENT = 0x00000040
-         * PF_OutFlag_USE_OUTPUT_EXTENT = 0x00000400
-         * Combined = 0x00000440
+         * PF_OutFlag_WIDE_TIME_INPUT = 0x00000002
+         * PF_OutFlag_SEQUENCE_DATA_NEEDS_FLATTENING = 0x00000010
+         * PF_OutFlag_USE_OUTPUT_EXTENT = 0x00000040
+         * PF_OutFlag_PIX_INDEPENDENT = 0x00000400
+         * PF_OutFlag_DEEP_COLOR_AWARE = 0x02000000
+         * Combined = 0x02000452
          */
         AE_Effect_Global_OutFlags {
-            0x00000440
+            0x02000452
         },
 
         /* [10] Effect Global OutFlags2
-         * PF_OutFlag2_FLOAT_COLOR_AWARE = 0x00000400
-         * PF_OutFlag2_DOESNT_NEED_EMPTY_PIXELS = 0x00001000
-         * Combined = 0x00001400
+         * PF_OutFlag2_DOESNT_NEED_EMPTY_PIXELS = 0x00000040
+         * PF_OutFlag2_SUPPORTS_SMART_RENDER = 0x00000400
+         * PF_OutFlag2_FLOAT_COLOR_AWARE = 0x00001000
+         * PF_OutFlag2_SUPPORTS_GET_FLATTENED_SEQUENCE_DATA = 0x00800000
+         * PF_OutFlag2_SUPPORTS_THREADED_RENDERING = 0x08000000
+         * Combined = 0x08801440
          */
         AE_Effect_Global_OutFlags_2 {
-            0x00001400
+            0x08801440
         },
 
         /* [11] Match Name - unique identifier */
@@ -0,0 +1,173 @@
+/*
+ * MoshBrosh - on-disk analysis cache
+ */
+
+#include "MoshDiskCache.h"
+#include "MoshHash.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#define MOSH_DISK_CACHE_MAGIC   0x4D426463  // 'MBdc'
+
+// File layout: header, then payloadBytes of payload
+struct MoshDiskCacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key;
+    uint32_t recordCount;
+    uint32_t reserved;
+    uint64_t payloadBytes;
+    uint64_t payloadHash;   // FNV-1a, catches torn or damaged files
+};
+
+MoshDiskCache::MoshDiskCache(const std::string& directory, uint64_t maxBytes)
+    : directory(directory), maxBytes(maxBytes) {}
+
+std::string MoshDiskCache::DefaultDirectory() {
+    const char* home = getenv("HOME");
+    if (!home || !*home) {
+        return std::string();
+    }
+    return std::string(home) + "/Library/Caches/MoshBrosh";
+}
+
+std::string MoshDiskCache::PathForKey(uint64_t key) const {
+    char name[32];
+    snprintf(name, sizeof(name), "/%016llx.mbc", (unsigned long long)key);
+    return directory + name;
+}
+
+bool MoshDiskCache::Load(uint64_t key,
+                         const std::function<bool(const uint8_t* payload, size_t bytes, uint32_t recordCount)>& read) {
+    if (directory.empty()) {
+        return false;
+    }
+
+    std::string path = PathForKey(key);
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    void* mapped = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(MoshDiskCacheHeader)) {
+        mapped = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        return false;
+    }
+
+    const MoshDiskCacheHeader* header = (const MoshDiskCacheHeader*)mapped;
+    const uint8_t* payload = (const uint8_t*)(header + 1);
+    bool ok = header->magic == MOSH_DISK_CACHE_MAGIC &&
+              header->version == MOSH_DISK_CACHE_VERSION &&
+              header->key == key &&
+              header->payloadBytes == (uint64_t)st.st_size - sizeof(MoshDiskCacheHeader) &&
+              header->payloadHash == MoshHashBytes(payload, (size_t)header->payloadBytes) &&
+              read(payload, (size_t)header->payloadBytes, header->recordCount);
+    munmap(mapped, (size_t)st.st_size);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (ok) {
+        utimes(path.c_str(), nullptr);  // most recently used
+    } else {
+        unlink(path.c_str());
+    }
+    return ok;
+}
+
+bool MoshDiskCache::Store(uint64_t key, const std::vector<uint8_t>& payload, uint32_t recordCount) {
+    if (directory.empty()) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    mkdir(directory.c_str(), 0755);
+
+    std::string path = PathForKey(key);
+    std::string tempPath = path + ".XXXXXX";
+    std::vector<char> tempName(tempPath.begin(), tempPath.end());
+    tempName.push_back('\0');
+    int fd = mkstemp(tempName.data());
+    if (fd < 0) {
+        return false;
+    }
+
+    MoshDiskCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = MOSH_DISK_CACHE_MAGIC;
+    header.version = MOSH_DISK_CACHE_VERSION;
+    header.key = key;
+    header.recordCount = recordCount;
+    header.payloadBytes = payload.size();
+    header.payloadHash = MoshHashBytes(payload.data(), payload.size());
+
+    bool ok = write(fd, &header, sizeof(header)) == (ssize_t)sizeof(header) &&
+              (payload.empty() || write(fd, payload.data(), payload.size()) == (ssize_t)payload.size());
+    ok = (close(fd) == 0) && ok;
+    if (ok) {
+        ok = rename(tempName.data(), path.c_str()) == 0;
+    }
+    if (!ok) {
+        unlink(tempName.data());
+        return false;
+    }
+
+    EvictLocked();
+    return true;
+}
+
+void MoshDiskCache::EvictLocked() {
+    struct Entry {
+        std::string path;
+        uint64_t bytes;
+        time_t lastUsed;
+    };
+
+    DIR* dir = opendir(directory.c_str());
+    if (!dir) {
+        return;
+    }
+
+    std::vector<Entry> entries;
+    uint64_t totalBytes = 0;
+    while (struct dirent* ent = readdir(dir)) {
+        size_t len = strlen(ent->d_name);
+        if (len < 4 || strcmp(ent->d_name + len - 4, ".mbc") != 0) {
+            continue;
+        }
+        std::string path = directory + "/" + ent->d_name;
+        struct stat st;
+        if (stat(path.c_str(), &st) == 0) {
+            entries.push_back({ path, (uint64_t)st.st_size, st.st_mtime });
+            totalBytes += (uint64_t)st.st_size;
+        }
+    }
+    closedir(dir);
+
+    if (totalBytes <= maxBytes) {
+        return;
+    }
+
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+        return a.lastUsed < b.lastUsed;
+    });
+    for (const Entry& entry : entries) {
+        if (totalBytes <= maxBytes) {
+            break;
+        }
+        if (unlink(entry.path.c_str()) == 0) {
+            totalBytes -= entry.bytes;
+        }
+    }
+}
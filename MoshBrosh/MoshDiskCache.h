@@ -0,0 +1,41 @@
+/*
+ * MoshBrosh - on-disk analysis cache
+ * Keeps encoded motion fields across sessions, one file per key, LRU-evicted by size
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#define MOSH_DISK_CACHE_VERSION     2
+#define MOSH_DISK_CACHE_MAX_BYTES   (256ull * 1024 * 1024)
+
+class MoshDiskCache {
+public:
+    // directory is created on first store; an empty directory disables the cache
+    MoshDiskCache(const std::string& directory, uint64_t maxBytes);
+
+    // Default location: ~/Library/Caches/MoshBrosh
+    static std::string DefaultDirectory();
+
+    // Maps the entry for key and hands its payload to read(). Returns false when there is no
+    // usable entry or read() rejects it (the entry is then removed). A hit counts as a use for LRU.
+    bool Load(uint64_t key, const std::function<bool(const uint8_t* payload, size_t bytes, uint32_t recordCount)>& read);
+
+    // Writes the entry atomically (temp file + rename), then evicts least recently used
+    // entries until the directory is back under the size limit
+    bool Store(uint64_t key, const std::vector<uint8_t>& payload, uint32_t recordCount);
+
+private:
+    std::string PathForKey(uint64_t key) const;
+    void EvictLocked();
+
+    std::string directory;
+    uint64_t maxBytes;
+    std::mutex mutex;
+};
@@ -0,0 +1,96 @@
+/*
+ * MoshBrosh - process-wide source frame registry
+ */
+
+#include "MoshFrameRegistry.h"
+#include "MoshHash.h"
+
+// Expired entries are dropped every this many inserts
+#define MOSH_FRAME_REGISTRY_SWEEP_INTERVAL  256
+
+uint64_t MoshFrameRegistryKey(uint64_t contentHash, int32_t width, int32_t height,
+                              MoshPixelFormat format, bool halfFloat) {
+    uint64_t parts[] = { contentHash, (uint64_t)width, (uint64_t)height, (uint64_t)format, (uint64_t)halfFloat };
+    return MoshHashBytes(parts, sizeof(parts));
+}
+
+MoshFrameRegistry::MoshFrameRegistry(uint64_t retainBytes)
+    : retainBytes(retainBytes), retainedBytes(0), insertsSinceSweep(0) {}
+
+FrameSnapshot MoshFrameRegistry::Find(uint64_t key, bool packed) {
+    std::vector<FrameSnapshot> released;
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = entries.find(key);
+    if (it == entries.end()) {
+        return nullptr;
+    }
+    FrameSnapshot frame = (packed ? it->second.packed : it->second.frame).lock();
+    if (frame) {
+        if (it->second.retained != frame) {
+            released.push_back(std::move(it->second.retained));
+            retainedBytes -= it->second.retainedBytes;
+            it->second.retained = frame;
+            it->second.retainedBytes = frame->CachedBytes();
+            retainedBytes += it->second.retainedBytes;
+        }
+        TouchLocked(key, it->second);
+        EvictLocked(&released);
+    }
+    return frame;
+}
+
+FrameSnapshot MoshFrameRegistry::Insert(uint64_t key, const FrameSnapshot& frame) {
+    std::vector<FrameSnapshot> released;
+    std::lock_guard<std::mutex> lock(mutex);
+    if (++insertsSinceSweep >= MOSH_FRAME_REGISTRY_SWEEP_INTERVAL) {
+        SweepLocked();
+    }
+
+    Entry& entry = entries[key];
+    std::weak_ptr<const AccumulatedFrame>& slot = frame->IsPacked() ? entry.packed : entry.frame;
+    FrameSnapshot registered = slot.lock();
+    if (!registered) {
+        slot = frame;
+        registered = frame;
+    }
+    if (entry.retained != registered) {
+        released.push_back(std::move(entry.retained));
+        retainedBytes -= entry.retainedBytes;
+        entry.retained = registered;
+        entry.retainedBytes = registered->CachedBytes();
+        retainedBytes += entry.retainedBytes;
+    }
+    TouchLocked(key, entry);
+    EvictLocked(&released);
+    return registered;
+}
+
+void MoshFrameRegistry::TouchLocked(uint64_t key, Entry& entry) {
+    if (entry.used) {
+        useOrder.erase(entry.use);
+    }
+    useOrder.push_front(key);
+    entry.use = useOrder.begin();
+    entry.used = true;
+}
+
+// Lets go of the least recently used frames until the retained ones fit the pool. Released
+// frames are freed by the caller after the lock, if no instance still holds them.
+void MoshFrameRegistry::EvictLocked(std::vector<FrameSnapshot>* released) {
+    while (retainedBytes > retainBytes && !useOrder.empty()) {
+        Entry& entry = entries[useOrder.back()];
+        released->push_back(std::move(entry.retained));
+        retainedBytes -= entry.retainedBytes;
+        entry.retainedBytes = 0;
+        entry.used = false;
+        useOrder.pop_back();
+    }
+}
+
+void MoshFrameRegistry::SweepLocked() {
+    insertsSinceSweep = 0;
+    for (auto it = entries.begin(); it != entries.end();) {
+        bool expired = !it->second.retained && it->second.frame.expired() && it->second.packed.expired();
+        it = expired ? entries.erase(it) : std::next(it);
+    }
+}
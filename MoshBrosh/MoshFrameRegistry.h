@@ -0,0 +1,59 @@
+/*
+ * MoshBrosh - process-wide source frame registry
+ * Cached source frames by content, shared by every effect instance: a clip moshed twice, or
+ * copied to another sequence, is copied and gets its flow pyramid built once
+ */
+
+#pragma once
+
+#include "MoshBrosh.h"
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// Frames no instance caches any more that the registry keeps alive for the next instance. Not a
+// cap on source frame memory: frames instances cache count against their own caches only.
+#define MOSH_FRAME_REGISTRY_RETAIN_BYTES    (512ull * 1024 * 1024)
+
+class MoshFrameRegistry {
+public:
+    // Frames stay registered as long as any instance caches them, whatever their size; on top of
+    // that the most recently used ones are kept alive up to retainBytes, for instances that come
+    // later
+    explicit MoshFrameRegistry(uint64_t retainBytes);
+
+    // The registered frame for key (see MoshFrameRegistryKey), packed or not as asked; null if none
+    FrameSnapshot Find(uint64_t key, bool packed);
+
+    // Registers frame under key, unless a frame of the same kind (packed or not) is registered
+    // already - then that one is returned and should be cached instead
+    FrameSnapshot Insert(uint64_t key, const FrameSnapshot& frame);
+
+private:
+    struct Entry {
+        std::weak_ptr<const AccumulatedFrame> frame;    // unpacked
+        std::weak_ptr<const AccumulatedFrame> packed;
+        FrameSnapshot retained;                         // last one inserted or found, while in the pool
+        size_t retainedBytes = 0;
+        bool used = false;                              // retained, at use in useOrder
+        std::list<uint64_t>::iterator use;
+    };
+
+    void TouchLocked(uint64_t key, Entry& entry);
+    void EvictLocked(std::vector<FrameSnapshot>* released);
+    void SweepLocked();
+
+    uint64_t retainBytes;
+    uint64_t retainedBytes;
+    uint32_t insertsSinceSweep;
+    std::unordered_map<uint64_t, Entry> entries;
+    std::list<uint64_t> useOrder;   // retained keys, most recently used first
+    std::mutex mutex;
+};
+
+// Registry key of a source frame with content hash contentHash, cached in format (float
+// formats at half precision when halfFloat is set)
+uint64_t MoshFrameRegistryKey(uint64_t contentHash, int32_t width, int32_t height,
+                              MoshPixelFormat format, bool halfFloat);
@@ -0,0 +1,19 @@
+/*
+ * MoshBrosh - FNV-1a hashing for cache keys and checksums
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#define MOSH_HASH_SEED  1469598103934665603ull  // FNV-1a 64-bit offset basis
+
+// FNV-1a over bytes, continuing from hash - chain calls to hash several buffers as one
+inline uint64_t MoshHashBytes(const void* data, size_t bytes, uint64_t hash = MOSH_HASH_SEED) {
+    const uint8_t* p = (const uint8_t*)data;
+    for (size_t i = 0; i < bytes; ++i) {
+        hash = (hash ^ p[i]) * 1099511628211ull;
+    }
+    return hash;
+}
@@ -0,0 +1,264 @@
+/*
+ * MoshBrosh - asynchronous logging
+ */
+
+#include "MoshLog.h"
+#include "MoshThread.h"
+#include "AEConfig.h"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define MOSH_LOG_RING_SLOTS     256     // power of two
+#define MOSH_LOG_MESSAGE_BYTES  232
+#define MOSH_LOG_DRAIN_MS       50
+
+std::atomic<int> g_moshLogLevel(MOSH_LOG_DEFAULT_LEVEL);
+
+struct LogSlot {
+    uint64_t sequence;      // global order across threads
+    uint64_t timeUs;
+    int level;
+    char text[MOSH_LOG_MESSAGE_BYTES];
+};
+
+// Single producer (the owning thread), single consumer (the writer thread)
+struct LogRing {
+    LogSlot slots[MOSH_LOG_RING_SLOTS];
+    std::atomic<uint32_t> head{0};      // next slot the owner fills
+    std::atomic<uint32_t> tail{0};      // next slot the writer reads
+    std::atomic<uint32_t> dropped{0};
+    std::atomic<bool> retired{false};   // owner thread has exited
+    uint32_t threadIndex = 0;
+};
+
+static std::atomic<uint64_t> g_logSequence(0);
+static const std::chrono::steady_clock::time_point g_logEpoch = std::chrono::steady_clock::now();
+
+// Rings of every thread that has logged; the mutex is taken once per thread, not per message
+static std::mutex g_logRingsMutex;
+static std::vector<std::shared_ptr<LogRing>> g_logRings;
+static uint32_t g_logNextThreadIndex = 0;
+
+// Writer thread state, guarded by g_logWriterMutex (the file is only touched by the writer)
+static std::mutex g_logWriterMutex;
+static std::condition_variable g_logWriterWake;
+static std::thread g_logWriter;
+static bool g_logStopping = false;
+static std::string g_logPath;
+static FILE* g_logFile = nullptr;
+
+namespace {
+struct ThreadRingOwner {
+    std::shared_ptr<LogRing> ring;
+    ~ThreadRingOwner() {
+        if (ring) {
+            ring->retired.store(true, std::memory_order_release);
+        }
+    }
+};
+}
+
+static LogRing* ThreadRing() {
+    thread_local ThreadRingOwner owner;
+    if (!owner.ring) {
+        owner.ring = std::make_shared<LogRing>();
+        std::lock_guard<std::mutex> lock(g_logRingsMutex);
+        owner.ring->threadIndex = g_logNextThreadIndex++;
+        g_logRings.push_back(owner.ring);
+    }
+    return owner.ring.get();
+}
+
+static bool EqualsIgnoringCase(const char* a, const char* b) {
+    for (; *a && *b; ++a, ++b) {
+        if (tolower((unsigned char)*a) != tolower((unsigned char)*b)) {
+            return false;
+        }
+    }
+    return *a == *b;
+}
+
+static int ParseLevel(const char* value, int fallback) {
+    static const char* names[] = { "off", "error", "warn", "info", "debug" };
+    if (!value || !*value) {
+        return fallback;
+    }
+    for (int i = 0; i <= MOSH_LOG_LEVEL_DEBUG; ++i) {
+        if (EqualsIgnoringCase(value, names[i])) {
+            return i;
+        }
+    }
+    if (value[0] >= '0' && value[0] <= '9') {
+        return std::min(atoi(value), (int)MOSH_LOG_LEVEL_DEBUG);
+    }
+    return fallback;
+}
+
+// %LOCALAPPDATA%\MoshBrosh.log on Windows, ~/Library/Logs/MoshBrosh.log on macOS
+static std::string DefaultLogPath() {
+#ifdef AE_OS_WIN
+    const char* base = getenv("LOCALAPPDATA");
+    const char* file = "\\MoshBrosh.log";
+#else
+    const char* base = getenv("HOME");
+    const char* file = "/Library/Logs/MoshBrosh.log";
+#endif
+    if (!base || !*base) {
+        return std::string();
+    }
+    return std::string(base) + file;
+}
+
+struct LogEntry {
+    uint64_t sequence;
+    uint64_t timeUs;
+    int level;
+    uint32_t threadIndex;
+    std::string text;
+};
+
+// Writer thread only
+static void DrainRings() {
+    std::vector<std::shared_ptr<LogRing>> rings;
+    {
+        std::lock_guard<std::mutex> lock(g_logRingsMutex);
+        rings = g_logRings;
+    }
+
+    std::vector<LogEntry> entries;
+    std::vector<std::pair<uint32_t, uint32_t>> drops;
+    for (const std::shared_ptr<LogRing>& ring : rings) {
+        uint32_t tail = ring->tail.load(std::memory_order_relaxed);
+        uint32_t head = ring->head.load(std::memory_order_acquire);
+        for (; tail != head; ++tail) {
+            const LogSlot& slot = ring->slots[tail % MOSH_LOG_RING_SLOTS];
+            entries.push_back({ slot.sequence, slot.timeUs, slot.level, ring->threadIndex, slot.text });
+        }
+        ring->tail.store(tail, std::memory_order_release);
+
+        uint32_t dropped = ring->dropped.exchange(0, std::memory_order_relaxed);
+        if (dropped) {
+            drops.push_back({ ring->threadIndex, dropped });
+        }
+    }
+
+    // Forget rings of exited threads once they are empty
+    {
+        std::lock_guard<std::mutex> lock(g_logRingsMutex);
+        g_logRings.erase(std::remove_if(g_logRings.begin(), g_logRings.end(),
+            [](const std::shared_ptr<LogRing>& ring) {
+                return ring->retired.load(std::memory_order_acquire) &&
+                       ring->head.load(std::memory_order_acquire) == ring->tail.load(std::memory_order_relaxed);
+            }), g_logRings.end());
+    }
+
+    if (entries.empty() && drops.empty()) {
+        return;
+    }
+
+    if (!g_logFile && !g_logPath.empty()) {
+        g_logFile = fopen(g_logPath.c_str(), "a");
+        if (g_logFile) {
+            fprintf(g_logFile, "\n\n=== MoshBrosh Plugin Started ===\n");
+        }
+    }
+    if (!g_logFile) {
+        return;
+    }
+
+    static const char* levelNames[] = { "", "ERROR", "WARN ", "INFO ", "DEBUG" };
+    std::sort(entries.begin(), entries.end(), [](const LogEntry& a, const LogEntry& b) {
+        return a.sequence < b.sequence;
+    });
+    for (const auto& drop : drops) {
+        fprintf(g_logFile, "[T%u] dropped %u messages (log ring full)\n", drop.first, drop.second);
+    }
+    for (const LogEntry& entry : entries) {
+        fprintf(g_logFile, "[%8.3f] [T%u] %s %s\n", entry.timeUs / 1.0e6, entry.threadIndex,
+                levelNames[std::min(std::max(entry.level, 0), (int)MOSH_LOG_LEVEL_DEBUG)], entry.text.c_str());
+    }
+    fflush(g_logFile);
+}
+
+static void WriterMain() {
+    std::unique_lock<std::mutex> lock(g_logWriterMutex);
+    for (;;) {
+        g_logWriterWake.wait_for(lock, std::chrono::milliseconds(MOSH_LOG_DRAIN_MS),
+                                 [] { return g_logStopping; });
+        bool stopping = g_logStopping;
+        DrainRings();
+        if (stopping) {
+            break;
+        }
+    }
+    if (g_logFile) {
+        fclose(g_logFile);
+        g_logFile = nullptr;
+    }
+}
+
+void MoshLogStart() {
+    std::lock_guard<std::mutex> lock(g_logWriterMutex);
+    if (g_logWriter.joinable()) {
+        return;
+    }
+
+    g_moshLogLevel.store(ParseLevel(getenv("MOSHBROSH_LOG_LEVEL"), MOSH_LOG_DEFAULT_LEVEL), std::memory_order_relaxed);
+    const char* path = getenv("MOSHBROSH_LOG_PATH");
+    g_logPath = (path && *path) ? std::string(path) : DefaultLogPath();
+    g_logStopping = false;
+    g_logWriter = std::thread(WriterMain);
+}
+
+void MoshLogStop() {
+    {
+        std::lock_guard<std::mutex> lock(g_logWriterMutex);
+        if (!g_logWriter.joinable()) {
+            return;
+        }
+        g_logStopping = true;
+    }
+    g_logWriterWake.notify_one();
+    g_logWriter.join();
+}
+
+void MoshLogSetLevel(int level) {
+    g_moshLogLevel.store(std::min(std::max(level, (int)MOSH_LOG_LEVEL_OFF), (int)MOSH_LOG_LEVEL_DEBUG),
+                         std::memory_order_relaxed);
+}
+
+void MoshLogWrite(int level, const char* fmt, ...) {
+    LogRing* ring = ThreadRing();
+    uint32_t head = ring->head.load(std::memory_order_relaxed);
+    if (head - ring->tail.load(std::memory_order_acquire) >= MOSH_LOG_RING_SLOTS) {
+        ring->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    LogSlot& slot = ring->slots[head % MOSH_LOG_RING_SLOTS];
+    slot.sequence = g_logSequence.fetch_add(1, std::memory_order_relaxed);
+    slot.timeUs = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - g_logEpoch).count();
+    slot.level = level;
+
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(slot.text, sizeof(slot.text), fmt, args);
+    va_end(args);
+
+    ring->head.store(head + 1, std::memory_order_release);
+}
+
+static MoshJoinAtUnload g_logJoin(MoshLogStop);
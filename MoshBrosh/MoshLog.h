@@ -0,0 +1,69 @@
+/*
+ * MoshBrosh - asynchronous logging
+ * Render threads format into their own lock-free ring buffer; a background thread drains
+ * the rings to the log file, so no render thread ever waits on disk
+ */
+
+#pragma once
+
+#include <atomic>
+
+enum MoshLogLevel {
+    MOSH_LOG_LEVEL_OFF = 0,
+    MOSH_LOG_LEVEL_ERROR,
+    MOSH_LOG_LEVEL_WARN,
+    MOSH_LOG_LEVEL_INFO,
+    MOSH_LOG_LEVEL_DEBUG
+};
+
+// Messages above this level are compiled out, arguments included (Xcode Debug defines DEBUG=1)
+#ifndef MOSH_LOG_MAX_LEVEL
+    #ifdef DEBUG
+        #define MOSH_LOG_MAX_LEVEL  MOSH_LOG_LEVEL_DEBUG
+    #else
+        #define MOSH_LOG_MAX_LEVEL  MOSH_LOG_LEVEL_INFO
+    #endif
+#endif
+
+// Runtime level when MOSHBROSH_LOG_LEVEL is not set
+#ifndef MOSH_LOG_DEFAULT_LEVEL
+    #ifdef DEBUG
+        #define MOSH_LOG_DEFAULT_LEVEL  MOSH_LOG_LEVEL_DEBUG
+    #else
+        #define MOSH_LOG_DEFAULT_LEVEL  MOSH_LOG_LEVEL_WARN
+    #endif
+#endif
+
+// Runtime level, read from MOSHBROSH_LOG_LEVEL (off/error/warn/info/debug) by MoshLogStart
+extern std::atomic<int> g_moshLogLevel;
+
+#define MOSH_LOG(level, ...) \
+    do { \
+        if ((level) <= MOSH_LOG_MAX_LEVEL && \
+            (level) <= g_moshLogLevel.load(std::memory_order_relaxed)) { \
+            MoshLogWrite((level), __VA_ARGS__); \
+        } \
+    } while (0)
+
+#define MOSH_LOG_ERROR(...) MOSH_LOG(MOSH_LOG_LEVEL_ERROR, __VA_ARGS__)
+#define MOSH_LOG_WARN(...)  MOSH_LOG(MOSH_LOG_LEVEL_WARN, __VA_ARGS__)
+#define MOSH_LOG_INFO(...)  MOSH_LOG(MOSH_LOG_LEVEL_INFO, __VA_ARGS__)
+#define MOSH_LOG_DEBUG(...) MOSH_LOG(MOSH_LOG_LEVEL_DEBUG, __VA_ARGS__)
+
+// Reads MOSHBROSH_LOG_LEVEL and MOSHBROSH_LOG_PATH (default ~/Library/Logs/MoshBrosh.log, or
+// %LOCALAPPDATA%\MoshBrosh.log on Windows) and starts the writer thread. The file is opened on the
+// first message that reaches it.
+void MoshLogStart();
+
+// Drains every pending message, closes the file and joins the writer thread
+void MoshLogStop();
+
+void MoshLogSetLevel(int level);
+
+// Formats into the calling thread's ring. Never blocks: when the ring is full the message
+// is dropped and counted, and the writer reports the count with the next message it writes.
+void MoshLogWrite(int level, const char* fmt, ...)
+#if defined(__GNUC__) || defined(__clang__)
+    __attribute__((format(printf, 2, 3)))
+#endif
+    ;
@@ -0,0 +1,354 @@
+/*
+ * MoshBrosh - packed frame storage
+ */
+
+#include "MoshPack.h"
+#include "MoshThread.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+// Chunk layout: a 32-bit word holding the payload size, with MOSH_PACK_STORED set when the
+// payload is the raw planes (they didn't compress), then the payload. A chunk covers
+// MOSH_PACK_CHUNK_PIXELS pixels, the last one whatever is left.
+#define MOSH_PACK_STORED    0x80000000u
+
+// LZ4 block format (lz4.org): sequences of literals followed by a back reference. Matches are
+// at least 4 bytes, the last 5 bytes of a block are always literals and no match starts in its
+// last 12 bytes.
+#define LZ4_MIN_MATCH       4
+#define LZ4_LAST_LITERALS   5
+#define LZ4_MF_LIMIT        12
+#define LZ4_MAX_OFFSET      65535
+#define LZ4_HASH_BITS       12
+#define LZ4_SKIP_SHIFT      6       // after 64 misses in a row, skip ahead two bytes at a time, ...
+
+static inline uint32_t Read32(const uint8_t* p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline uint32_t HashSequence(uint32_t sequence) {
+    return (sequence * 2654435761u) >> (32 - LZ4_HASH_BITS);
+}
+
+// Worst case: everything literal, plus a length byte per 255 of them
+static size_t Lz4Bound(size_t bytes) {
+    return bytes + bytes / 255 + 16;
+}
+
+static uint8_t* WriteLength(uint8_t* op, size_t length) {
+    while (length >= 255) {
+        *op++ = 255;
+        length -= 255;
+    }
+    *op++ = (uint8_t)length;
+    return op;
+}
+
+static bool ReadLength(const uint8_t** ip, const uint8_t* end, size_t* length) {
+    uint8_t byte;
+    do {
+        if (*ip >= end) {
+            return false;
+        }
+        byte = *(*ip)++;
+        *length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+// Greedy single-probe compressor; dst holds at least Lz4Bound(bytes). Returns the block size.
+static size_t Lz4Compress(const uint8_t* src, size_t bytes, uint8_t* dst) {
+    uint8_t* op = dst;
+    size_t anchor = 0;
+
+    if (bytes > LZ4_MF_LIMIT) {
+        uint32_t table[1 << LZ4_HASH_BITS];
+        memset(table, 0, sizeof(table));
+        size_t matchLimit = bytes - LZ4_LAST_LITERALS;
+        size_t mfLimit = bytes - LZ4_MF_LIMIT;
+        size_t ip = 0;
+        uint32_t misses = 0;
+
+        while (ip < mfLimit) {
+            uint32_t sequence = Read32(src + ip);
+            uint32_t hash = HashSequence(sequence);
+            size_t ref = table[hash];
+            table[hash] = (uint32_t)ip;
+            if (ref >= ip || ip - ref > LZ4_MAX_OFFSET || Read32(src + ref) != sequence) {
+                ip += 1 + (misses++ >> LZ4_SKIP_SHIFT);
+                continue;
+            }
+            misses = 0;
+
+            while (ip > anchor && ref > 0 && src[ip - 1] == src[ref - 1]) {
+                --ip;
+                --ref;
+            }
+            size_t length = LZ4_MIN_MATCH;
+            while (ip + length < matchLimit && src[ip + length] == src[ref + length]) {
+                ++length;
+            }
+
+            size_t literals = ip - anchor;
+            uint8_t* token = op++;
+            *token = (uint8_t)(std::min(literals, (size_t)15) << 4);
+            if (literals >= 15) {
+                op = WriteLength(op, literals - 15);
+            }
+            memcpy(op, src + anchor, literals);
+            op += literals;
+
+            size_t offset = ip - ref;
+            *op++ = (uint8_t)(offset & 0xff);
+            *op++ = (uint8_t)(offset >> 8);
+            size_t extra = length - LZ4_MIN_MATCH;
+            *token |= (uint8_t)std::min(extra, (size_t)15);
+            if (extra >= 15) {
+                op = WriteLength(op, extra - 15);
+            }
+
+            ip += length;
+            anchor = ip;
+        }
+    }
+
+    size_t literals = bytes - anchor;
+    *op++ = (uint8_t)(std::min(literals, (size_t)15) << 4);
+    if (literals >= 15) {
+        op = WriteLength(op, literals - 15);
+    }
+    memcpy(op, src + anchor, literals);
+    op += literals;
+    return (size_t)(op - dst);
+}
+
+// Bounds-checked decoder: false unless the block decodes to exactly dstBytes
+static bool Lz4Decompress(const uint8_t* src, size_t srcBytes, uint8_t* dst, size_t dstBytes) {
+    const uint8_t* ip = src;
+    const uint8_t* srcEnd = src + srcBytes;
+    uint8_t* op = dst;
+    uint8_t* dstEnd = dst + dstBytes;
+
+    for (;;) {
+        if (ip >= srcEnd) {
+            return false;
+        }
+        unsigned token = *ip++;
+
+        size_t literals = token >> 4;
+        if (literals == 15 && !ReadLength(&ip, srcEnd, &literals)) {
+            return false;
+        }
+        if (literals > (size_t)(srcEnd - ip) || literals > (size_t)(dstEnd - op)) {
+            return false;
+        }
+        memcpy(op, ip, literals);
+        op += literals;
+        ip += literals;
+        if (ip == srcEnd) {
+            return op == dstEnd;
+        }
+
+        if (srcEnd - ip < 2) {
+            return false;
+        }
+        size_t offset = (size_t)ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - dst)) {
+            return false;
+        }
+        size_t length = token & 15;
+        if (length == 15 && !ReadLength(&ip, srcEnd, &length)) {
+            return false;
+        }
+        length += LZ4_MIN_MATCH;
+        if (length > (size_t)(dstEnd - op)) {
+            return false;
+        }
+
+        // Overlapping matches repeat the last offset bytes
+        const uint8_t* match = op - offset;
+        if (offset >= length) {
+            memcpy(op, match, length);
+        } else if (offset == 1) {
+            memset(op, *match, length);
+        } else {
+            for (size_t i = 0; i < length; ++i) {
+                op[i] = match[i];
+            }
+        }
+        op += length;
+    }
+}
+
+// Byte b of every pixel into plane b, each plane as differences from the previous pixel
+static void SplitPlanes(const uint8_t* pixels, size_t bytes, int pixelBytes, uint8_t* planes) {
+    size_t count = bytes / pixelBytes;
+    for (int b = 0; b < pixelBytes; ++b) {
+        const uint8_t* in = pixels + b;
+        uint8_t* plane = planes + (size_t)b * count;
+        uint8_t previous = 0;
+        for (size_t i = 0; i < count; ++i) {
+            uint8_t value = in[i * pixelBytes];
+            plane[i] = (uint8_t)(value - previous);
+            previous = value;
+        }
+    }
+}
+
+static void MergePlanes(const uint8_t* planes, size_t bytes, int pixelBytes, uint8_t* pixels) {
+    size_t count = bytes / pixelBytes;
+    for (int b = 0; b < pixelBytes; ++b) {
+        const uint8_t* plane = planes + (size_t)b * count;
+        uint8_t* out = pixels + b;
+        uint8_t value = 0;
+        for (size_t i = 0; i < count; ++i) {
+            value = (uint8_t)(value + plane[i]);
+            out[i * pixelBytes] = value;
+        }
+    }
+}
+
+void MoshPackPixels(const uint8_t* pixels, size_t bytes, int pixelBytes, std::vector<uint8_t>* packed) {
+    if (pixelBytes <= 0 || bytes % pixelBytes) {
+        pixelBytes = 1;
+    }
+    size_t chunkBytes = (size_t)MOSH_PACK_CHUNK_PIXELS * pixelBytes;
+    std::vector<uint8_t> planes(std::min(chunkBytes, bytes));
+
+    packed->clear();
+    for (size_t offset = 0; offset < bytes; offset += chunkBytes) {
+        size_t size = std::min(chunkBytes, bytes - offset);
+        SplitPlanes(pixels + offset, size, pixelBytes, planes.data());
+
+        size_t header = packed->size();
+        packed->resize(header + sizeof(uint32_t) + Lz4Bound(size));
+        uint8_t* payload = packed->data() + header + sizeof(uint32_t);
+        size_t payloadBytes = Lz4Compress(planes.data(), size, payload);
+        uint32_t word = (uint32_t)payloadBytes;
+        if (payloadBytes >= size) {
+            memcpy(payload, planes.data(), size);
+            payloadBytes = size;
+            word = (uint32_t)size | MOSH_PACK_STORED;
+        }
+        memcpy(packed->data() + header, &word, sizeof(word));
+        packed->resize(header + sizeof(uint32_t) + payloadBytes);
+    }
+    packed->shrink_to_fit();
+}
+
+bool MoshUnpackPixels(const uint8_t* packed, size_t packedBytes, int pixelBytes, uint8_t* pixels, size_t bytes) {
+    if (pixelBytes <= 0 || bytes % pixelBytes) {
+        pixelBytes = 1;
+    }
+    size_t chunkBytes = (size_t)MOSH_PACK_CHUNK_PIXELS * pixelBytes;
+    std::vector<uint8_t> planes(std::min(chunkBytes, bytes));
+
+    const uint8_t* ip = packed;
+    const uint8_t* end = packed + packedBytes;
+    for (size_t offset = 0; offset < bytes; offset += chunkBytes) {
+        size_t size = std::min(chunkBytes, bytes - offset);
+        uint32_t word;
+        if ((size_t)(end - ip) < sizeof(word)) {
+            return false;
+        }
+        memcpy(&word, ip, sizeof(word));
+        ip += sizeof(word);
+
+        size_t payloadBytes = word & ~MOSH_PACK_STORED;
+        if (payloadBytes > (size_t)(end - ip)) {
+            return false;
+        }
+        if (word & MOSH_PACK_STORED) {
+            if (payloadBytes != size) {
+                return false;
+            }
+            memcpy(planes.data(), ip, size);
+        } else if (!Lz4Decompress(ip, payloadBytes, planes.data(), size)) {
+            return false;
+        }
+        ip += payloadBytes;
+        MergePlanes(planes.data(), size, pixelBytes, pixels + offset);
+    }
+    return ip == end;
+}
+
+// Packing thread state, guarded by g_packMutex
+static std::mutex g_packMutex;
+static std::condition_variable g_packWake;
+static std::thread g_packThread;
+static std::deque<std::function<void()>> g_packJobs;
+static bool g_packStopping = false;
+static std::atomic<bool> g_packRunning(false);
+
+static void PackMain() {
+    std::unique_lock<std::mutex> lock(g_packMutex);
+    for (;;) {
+        g_packWake.wait(lock, [] { return g_packStopping || !g_packJobs.empty(); });
+        if (g_packStopping) {
+            break;
+        }
+        std::function<void()> job = std::move(g_packJobs.front());
+        g_packJobs.pop_front();
+        lock.unlock();
+        job();
+        job = nullptr;  // drop what it holds before taking the lock again
+        lock.lock();
+    }
+}
+
+void MoshPackStart() {
+    std::lock_guard<std::mutex> lock(g_packMutex);
+    if (g_packThread.joinable()) {
+        return;
+    }
+
+    const char* enabled = getenv("MOSHBROSH_PACK");
+    if (enabled && strcmp(enabled, "0") == 0) {
+        return;
+    }
+
+    g_packStopping = false;
+    g_packThread = std::thread(PackMain);
+    g_packRunning.store(true, std::memory_order_relaxed);
+}
+
+void MoshPackStop() {
+    std::deque<std::function<void()>> dropped;
+    {
+        std::lock_guard<std::mutex> lock(g_packMutex);
+        if (!g_packThread.joinable()) {
+            return;
+        }
+        g_packStopping = true;
+        g_packRunning.store(false, std::memory_order_relaxed);
+        dropped.swap(g_packJobs);
+    }
+    g_packWake.notify_one();
+    g_packThread.join();
+}
+
+bool MoshPackEnabled() {
+    return g_packRunning.load(std::memory_order_relaxed);
+}
+
+void MoshPackPost(std::function<void()> job) {
+    {
+        std::lock_guard<std::mutex> lock(g_packMutex);
+        if (!g_packThread.joinable() || g_packStopping) {
+            return;
+        }
+        g_packJobs.push_back(std::move(job));
+    }
+    g_packWake.notify_one();
+}
+
+static MoshJoinAtUnload g_packJoin(MoshPackStop);
@@ -0,0 +1,36 @@
+/*
+ * MoshBrosh - packed frame storage
+ * Lossless compression for cached frames that are rarely read again, and the background thread
+ * that packs them so render threads never pay for it
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// Pixels per independently packed chunk; bounds LZ4 match offsets and the unpack granularity
+#define MOSH_PACK_CHUNK_PIXELS  16384
+
+// Packs bytes of pixels (pixelBytes each) into *packed: per chunk the bytes are split into one
+// plane per byte of the pixel and each plane delta coded - the sign and exponent bytes of float
+// channels then run in long, mostly zero stretches - before LZ4 block compression
+void MoshPackPixels(const uint8_t* pixels, size_t bytes, int pixelBytes, std::vector<uint8_t>* packed);
+
+// Restores exactly bytes of pixels; false when packed is damaged or was made for another size
+bool MoshUnpackPixels(const uint8_t* packed, size_t packedBytes, int pixelBytes, uint8_t* pixels, size_t bytes);
+
+// Reads MOSHBROSH_PACK (0 keeps every cached frame unpacked) and starts the packing thread
+void MoshPackStart();
+
+// Drops pending jobs and joins the packing thread
+void MoshPackStop();
+
+// True while the packing thread is running
+bool MoshPackEnabled();
+
+// Runs job on the packing thread, in posting order. Jobs must not assume anything they
+// reference is still alive: hold weak references and revalidate under the owner's lock.
+void MoshPackPost(std::function<void()> job);
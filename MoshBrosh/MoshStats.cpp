@@ -0,0 +1,238 @@
+/*
+ * MoshBrosh - render instrumentation
+ */
+
+#include "MoshStats.h"
+#include "MoshThread.h"
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#define MOSH_STATS_DEFAULT_INTERVAL_S   10
+
+std::atomic<bool> g_moshStatsEnabled(MOSH_STATS_DEFAULT_ENABLED != 0);
+
+// One cache line each, so render threads bumping different stats don't contend
+struct alignas(64) StatCounterSlot {
+    std::atomic<uint64_t> value{0};
+};
+
+struct alignas(64) StatTimerSlot {
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> totalNs{0};
+    std::atomic<uint64_t> maxNs{0};
+};
+
+static StatCounterSlot g_statCounters[MOSH_STAT_COUNTER_COUNT];
+static StatTimerSlot g_statTimers[MOSH_TIMER_COUNT];
+
+static const char* kCounterNames[MOSH_STAT_COUNTER_COUNT] = {
+    "frames_precomputed",
+    "frames_region_warp",
+    "frames_streamed",
+    "frames_cyan",
+    "frames_passthrough",
+    "input_cache_hits",
+    "input_cache_misses",
+    "warped_cache_hits",
+    "warped_cache_misses",
+    "invalidations",
+    "bytes_cached",
+    "input_checkouts",
+    "disk_cache_hits",
+    "disk_cache_misses",
+    "lock_contended",
+    "flow_warm_blocks",
+    "flow_cold_fallbacks",
+    "frames_packed",
+    "pack_bytes_in",
+    "pack_bytes_out",
+    "frames_unpacked",
+    "shared_frame_hits",
+    "shared_frame_misses",
+    "draft_fields",
+};
+
+static const char* kTimerNames[MOSH_TIMER_COUNT] = {
+    "render",
+    "copy_frame",
+    "motion_field",
+    "warp",
+    "precompute",
+    "region_warp",
+    "lock_wait",
+    "analysis_wait",
+    "pack",
+    "unpack",
+    "hash_frame",
+};
+
+// Dump thread state, guarded by g_statsMutex
+static std::mutex g_statsMutex;
+static std::condition_variable g_statsWake;
+static std::thread g_statsThread;
+static bool g_statsStopping = false;
+static std::string g_statsPath;
+static int g_statsIntervalS = MOSH_STATS_DEFAULT_INTERVAL_S;
+
+void MoshStatAdd(MoshStatCounter counter, uint64_t amount) {
+    if (g_moshStatsEnabled.load(std::memory_order_relaxed)) {
+        g_statCounters[counter].value.fetch_add(amount, std::memory_order_relaxed);
+    }
+}
+
+void MoshStatRecord(MoshStatTimer timer, uint64_t nanoseconds) {
+    StatTimerSlot& slot = g_statTimers[timer];
+    slot.count.fetch_add(1, std::memory_order_relaxed);
+    slot.totalNs.fetch_add(nanoseconds, std::memory_order_relaxed);
+    uint64_t seen = slot.maxNs.load(std::memory_order_relaxed);
+    while (nanoseconds > seen &&
+           !slot.maxNs.compare_exchange_weak(seen, nanoseconds, std::memory_order_relaxed)) {
+    }
+}
+
+uint64_t MoshStatValue(MoshStatCounter counter) {
+    return g_statCounters[counter].value.load(std::memory_order_relaxed);
+}
+
+void MoshStatTimerValue(MoshStatTimer timer, uint64_t* count, uint64_t* totalNs, uint64_t* maxNs) {
+    const StatTimerSlot& slot = g_statTimers[timer];
+    *count = slot.count.load(std::memory_order_relaxed);
+    *totalNs = slot.totalNs.load(std::memory_order_relaxed);
+    *maxNs = slot.maxNs.load(std::memory_order_relaxed);
+}
+
+struct StatSnapshot {
+    uint64_t counters[MOSH_STAT_COUNTER_COUNT];
+    uint64_t timerCount[MOSH_TIMER_COUNT];
+    uint64_t timerTotalNs[MOSH_TIMER_COUNT];
+    uint64_t timerMaxNs[MOSH_TIMER_COUNT];
+};
+
+static void TakeSnapshot(StatSnapshot* snapshot) {
+    for (int i = 0; i < MOSH_STAT_COUNTER_COUNT; ++i) {
+        snapshot->counters[i] = g_statCounters[i].value.load(std::memory_order_relaxed);
+    }
+    for (int i = 0; i < MOSH_TIMER_COUNT; ++i) {
+        snapshot->timerCount[i] = g_statTimers[i].count.load(std::memory_order_relaxed);
+        snapshot->timerTotalNs[i] = g_statTimers[i].totalNs.load(std::memory_order_relaxed);
+        snapshot->timerMaxNs[i] = g_statTimers[i].maxNs.load(std::memory_order_relaxed);
+    }
+}
+
+// Rewrites the stats file (temp file + rename, so a reader never sees half a dump)
+static void WriteStatsFile(const StatSnapshot& now, const StatSnapshot& last, double uptimeS, double intervalS) {
+    if (g_statsPath.empty()) {
+        return;
+    }
+
+    std::string tempPath = g_statsPath + ".tmp";
+    FILE* file = fopen(tempPath.c_str(), "w");
+    if (!file) {
+        return;
+    }
+
+    fprintf(file, "MoshBrosh stats - uptime %.1f s, last interval %.1f s\n\n", uptimeS, intervalS);
+    fprintf(file, "%-22s %16s %16s\n", "counter", "total", "interval");
+    for (int i = 0; i < MOSH_STAT_COUNTER_COUNT; ++i) {
+        fprintf(file, "%-22s %16llu %16llu\n", kCounterNames[i],
+                (unsigned long long)now.counters[i], (unsigned long long)(now.counters[i] - last.counters[i]));
+    }
+
+    uint64_t packedIn = now.counters[MOSH_STAT_PACK_BYTES_IN];
+    uint64_t packedOut = now.counters[MOSH_STAT_PACK_BYTES_OUT];
+    if (packedOut) {
+        fprintf(file, "%-22s %16.2f\n", "pack_ratio", (double)packedIn / packedOut);
+    }
+
+    fprintf(file, "\n%-22s %12s %12s %12s %12s %12s %12s\n", "timer",
+            "count", "total ms", "mean us", "max us", "int. count", "int. ms");
+    for (int i = 0; i < MOSH_TIMER_COUNT; ++i) {
+        uint64_t count = now.timerCount[i];
+        double totalMs = now.timerTotalNs[i] / 1.0e6;
+        double meanUs = count ? now.timerTotalNs[i] / 1.0e3 / count : 0.0;
+        fprintf(file, "%-22s %12llu %12.2f %12.2f %12.2f %12llu %12.2f\n", kTimerNames[i],
+                (unsigned long long)count, totalMs, meanUs, now.timerMaxNs[i] / 1.0e3,
+                (unsigned long long)(count - last.timerCount[i]),
+                (now.timerTotalNs[i] - last.timerTotalNs[i]) / 1.0e6);
+    }
+
+    bool ok = fclose(file) == 0;
+    if (!ok || rename(tempPath.c_str(), g_statsPath.c_str()) != 0) {
+        remove(tempPath.c_str());
+    }
+}
+
+static void StatsMain() {
+    std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point lastDump = started;
+    StatSnapshot last;
+    memset(&last, 0, sizeof(last));
+
+    std::unique_lock<std::mutex> lock(g_statsMutex);
+    for (;;) {
+        g_statsWake.wait_for(lock, std::chrono::seconds(g_statsIntervalS), [] { return g_statsStopping; });
+        bool stopping = g_statsStopping;
+
+        StatSnapshot now;
+        TakeSnapshot(&now);
+        if (memcmp(&now, &last, sizeof(now)) != 0) {
+            std::chrono::steady_clock::time_point time = std::chrono::steady_clock::now();
+            WriteStatsFile(now, last,
+                           std::chrono::duration<double>(time - started).count(),
+                           std::chrono::duration<double>(time - lastDump).count());
+            last = now;
+            lastDump = time;
+        }
+        if (stopping) {
+            break;
+        }
+    }
+}
+
+void MoshStatsStart() {
+    std::lock_guard<std::mutex> lock(g_statsMutex);
+    if (g_statsThread.joinable()) {
+        return;
+    }
+
+    const char* enabled = getenv("MOSHBROSH_STATS");
+    bool enable = (enabled && *enabled) ? strcmp(enabled, "0") != 0 : MOSH_STATS_DEFAULT_ENABLED != 0;
+    g_moshStatsEnabled.store(enable, std::memory_order_relaxed);
+    if (!g_moshStatsEnabled.load(std::memory_order_relaxed)) {
+        return;
+    }
+
+    const char* path = getenv("MOSHBROSH_STATS_PATH");
+    const char* home = getenv("HOME");
+    if (path && *path) {
+        g_statsPath = path;
+    } else if (home && *home) {
+        g_statsPath = std::string(home) + "/Library/Logs/MoshBrosh-stats.txt";
+    }
+
+    const char* interval = getenv("MOSHBROSH_STATS_INTERVAL");
+    g_statsIntervalS = interval ? std::max(atoi(interval), 1) : MOSH_STATS_DEFAULT_INTERVAL_S;
+
+    g_statsStopping = false;
+    g_statsThread = std::thread(StatsMain);
+}
+
+void MoshStatsStop() {
+    {
+        std::lock_guard<std::mutex> lock(g_statsMutex);
+        if (!g_statsThread.joinable()) {
+            return;
+        }
+        g_statsStopping = true;
+    }
+    g_statsWake.notify_one();
+    g_statsThread.join();
+}
+
+static MoshJoinAtUnload g_statsJoin(MoshStatsStop);
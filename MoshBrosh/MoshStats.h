@@ -0,0 +1,116 @@
+/*
+ * MoshBrosh - render instrumentation
+ * Process-wide counters and stage timers, dumped periodically to a stats file so a stuttering
+ * clip can be traced to analysis, lock contention, cache misses or copies
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+enum MoshStatCounter {
+    MOSH_STAT_FRAMES_PRECOMPUTED = 0,   // mosh frames served from the warped cache
+    MOSH_STAT_FRAMES_REGION,            // mosh frames served by warping only the output region
+    MOSH_STAT_FRAMES_STREAMED,          // mosh frames warped from the one rendered before (in order)
+    MOSH_STAT_FRAMES_CYAN,              // mosh frames served as the cyan placeholder
+    MOSH_STAT_FRAMES_PASSTHROUGH,       // frames outside the mosh range or the cached area
+    MOSH_STAT_INPUT_HITS,               // current frame was already cached
+    MOSH_STAT_INPUT_MISSES,             // current frame had to be copied into the cache
+    MOSH_STAT_WARPED_HITS,              // warped frame ready on the first lookup
+    MOSH_STAT_WARPED_MISSES,            // render had to analyze or wait for another thread
+    MOSH_STAT_INVALIDATIONS,            // cache cleared for params, format or source changes
+    MOSH_STAT_BYTES_CACHED,             // frame bytes inserted into the in-memory cache
+    MOSH_STAT_INPUT_CHECKOUTS,          // PF_CHECKOUT_PARAM of other frames
+    MOSH_STAT_DISK_HITS,
+    MOSH_STAT_DISK_MISSES,
+    MOSH_STAT_LOCK_CONTENDED,           // lock acquisitions that had to wait
+    MOSH_STAT_FLOW_WARM_BLOCKS,         // blocks solved from the previous pair's vector
+    MOSH_STAT_FLOW_COLD_FALLBACKS,      // warm-started blocks that needed the full pyramid after all
+    MOSH_STAT_FRAMES_PACKED,            // cached source frames compressed after analysis
+    MOSH_STAT_PACK_BYTES_IN,            // their pixel bytes before packing
+    MOSH_STAT_PACK_BYTES_OUT,           // and after
+    MOSH_STAT_FRAMES_UNPACKED,          // packed frames that became the reference and were restored
+    MOSH_STAT_SHARED_HITS,              // source frames found in the registry, cached by any instance
+    MOSH_STAT_SHARED_MISSES,            // source frames copied, new to the registry
+    MOSH_STAT_DRAFT_FIELDS,             // motion fields computed at draft quality
+    MOSH_STAT_COUNTER_COUNT
+};
+
+enum MoshStatTimer {
+    MOSH_TIMER_RENDER = 0,              // RENDER / SMART_RENDER, end to end
+    MOSH_TIMER_COPY_FRAME,              // CopyFrameToAccumulated
+    MOSH_TIMER_MOTION_FIELD,            // ComputeMotionField, per frame pair
+    MOSH_TIMER_WARP,                    // ApplyMotionField, per frame
+    MOSH_TIMER_PRECOMPUTE,              // PrecomputeWarpedFrames, whole range
+    MOSH_TIMER_REGION_WARP,             // WarpRegion, per frame
+    MOSH_TIMER_LOCK_WAIT,               // contended cache / registry lock acquisitions
+    MOSH_TIMER_ANALYSIS_WAIT,           // waiting for another thread's analysis
+    MOSH_TIMER_PACK,                    // packing one frame, on the packing thread
+    MOSH_TIMER_UNPACK,                  // unpacking one frame, on the render thread that needs it
+    MOSH_TIMER_HASH,                    // content hash of a source frame, per frame
+    MOSH_TIMER_COUNT
+};
+
+// Whether stats are collected when MOSHBROSH_STATS is not set (Xcode Debug defines DEBUG=1):
+// release builds leave the render path alone and write no stats file unless asked to
+#ifndef MOSH_STATS_DEFAULT_ENABLED
+    #ifdef DEBUG
+        #define MOSH_STATS_DEFAULT_ENABLED  1
+    #else
+        #define MOSH_STATS_DEFAULT_ENABLED  0
+    #endif
+#endif
+
+// Set by MoshStatsStart (MOSHBROSH_STATS=1 turns it on, 0 off); when false nothing reads the clock
+extern std::atomic<bool> g_moshStatsEnabled;
+
+void MoshStatAdd(MoshStatCounter counter, uint64_t amount = 1);
+void MoshStatRecord(MoshStatTimer timer, uint64_t nanoseconds);
+
+// Running totals, for tools that drive the plugin in-process and diff them around a workload
+uint64_t MoshStatValue(MoshStatCounter counter);
+void MoshStatTimerValue(MoshStatTimer timer, uint64_t* count, uint64_t* totalNs, uint64_t* maxNs);
+
+// Times the enclosing scope
+class MoshStatScope {
+public:
+    explicit MoshStatScope(MoshStatTimer timer)
+        : timer(timer), enabled(g_moshStatsEnabled.load(std::memory_order_relaxed)) {
+        if (enabled) {
+            start = std::chrono::steady_clock::now();
+        }
+    }
+    ~MoshStatScope() {
+        if (enabled) {
+            MoshStatRecord(timer, (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count());
+        }
+    }
+    MoshStatScope(const MoshStatScope&) = delete;
+    MoshStatScope& operator=(const MoshStatScope&) = delete;
+
+private:
+    MoshStatTimer timer;
+    bool enabled;
+    std::chrono::steady_clock::time_point start;
+};
+
+// lock.lock(), timing the wait only when the lock is contended
+template<typename Lock>
+inline void MoshStatLock(Lock& lock) {
+    if (!lock.try_lock()) {
+        MoshStatAdd(MOSH_STAT_LOCK_CONTENDED);
+        MoshStatScope wait(MOSH_TIMER_LOCK_WAIT);
+        lock.lock();
+    }
+}
+
+// Reads MOSHBROSH_STATS (1 enables, 0 disables), MOSHBROSH_STATS_PATH (default
+// ~/Library/Logs/MoshBrosh-stats.txt) and MOSHBROSH_STATS_INTERVAL (seconds, default 10), and
+// starts the thread that rewrites the stats file whenever the numbers changed
+void MoshStatsStart();
+
+// Writes a final dump and joins the stats thread
+void MoshStatsStop();
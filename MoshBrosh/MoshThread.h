@@ -0,0 +1,20 @@
+/*
+ * MoshBrosh - background thread lifetime
+ */
+
+#pragma once
+
+// Calls stop() when the plugin is unloaded. The modules that own a background thread (log writer,
+// stats, packing) keep one at namespace scope with their Stop function, so the thread is joined
+// even if the host unloads us without GLOBAL_SETDOWN - destroying it joinable would terminate.
+class MoshJoinAtUnload {
+public:
+    explicit MoshJoinAtUnload(void (*stop)()) : stop(stop) {}
+    ~MoshJoinAtUnload() { stop(); }
+
+    MoshJoinAtUnload(const MoshJoinAtUnload&) = delete;
+    MoshJoinAtUnload& operator=(const MoshJoinAtUnload&) = delete;
+
+private:
+    void (*stop)();
+};
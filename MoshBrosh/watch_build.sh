@@ -6,7 +6,7 @@ set -e
 
 SCRIPT_DIR="$(cd "$(dirname "$0")" && pwd)"
 PROJECT_DIR="$SCRIPT_DIR/Mac"
-DEBUG_LOG="$HOME/Desktop/moshbrosh_debug.log"
+DEBUG_LOG="${MOSHBROSH_LOG_PATH:-$HOME/Library/Logs/MoshBrosh.log}"
 USER_PLUGIN_DIR="$HOME/Library/Application Support/Adobe/Common/Plug-ins/7.0/MediaCore"
 
 # Create user plugin dir if needed